@@ -0,0 +1,1092 @@
+#include "mp4be.h"
+#include "mp4bytes.h"
+#include "mp4index.h"
+#include "mp4samplepack.h"
+#include "mp4walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmarks of the mp4index library over synthetic files, generated in
+// memory so no sample files are needed. Built at -O2 whatever the build
+// type, against an -O2 copy of the library; each command prints one table
+// row per size.
+
+// Keep repeating a run until this much time has passed, and report the best
+#define BENCH_MIN_SECONDS 0.3
+
+#define SYNTH_TIME_SCALE 90000
+#define SYNTH_SAMPLE_SIZE 16
+// a sync sample every SYNTH_GOP samples
+#define SYNTH_GOP 30
+#define SYNTH_MAX_DEPTH 16
+// samples of the sparse file
+#define SYNTH_SPARSE_SAMPLES 300
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s keyframes [--rescan-max N] [entries...]\n", prog);
+    fprintf(stderr, "       %s tables <entries> <filename>\n", prog);
+    fprintf(stderr, "       %s sparse <GiB> <filename>\n", prog);
+    fprintf(stderr, "       %s fragments <moof boxes> <filename>\n", prog);
+    fprintf(stderr, "       %s walk [moof boxes...]\n", prog);
+    fprintf(stderr, "       %s be32 [entries...]\n", prog);
+    fprintf(stderr, "       %s samplepack [entries...|--file <filename>]\n", prog);
+    fprintf(stderr, "  keyframes        time mp4_index_build() over a moov whose stts, stsc,\n");
+    fprintf(stderr, "                   stsz and stco have one entry a sample (default 10^3 to\n");
+    fprintf(stderr, "                   10^6 entries) against the stts and stsc rescan per\n");
+    fprintf(stderr, "                   keyframe that it replaced\n");
+    fprintf(stderr, "  --rescan-max N   skip the rescan above N entries (default 100000), it\n");
+    fprintf(stderr, "                   takes minutes at 10^6\n");
+    fprintf(stderr, "  tables           write that moov and its mdat as an MP4 file\n");
+    fprintf(stderr, "  sparse           write a sparse MP4 file with a 64-bit mdat of that many\n");
+    fprintf(stderr, "                   GiB, its samples spread over it and a co64 moov after it,\n");
+    fprintf(stderr, "                   and print its keyframes the way mp4keyframes does\n");
+    fprintf(stderr, "  fragments        write a fragmented MP4 file of that many moof boxes, each\n");
+    fprintf(stderr, "                   with mfhd, traf, tfhd, tfdt and a one-sample trun, and an\n");
+    fprintf(stderr, "                   mdat: seven boxes a fragment\n");
+    fprintf(stderr, "  walk             time mp4_walk() over such a file in memory (default 10^3\n");
+    fprintf(stderr, "                   to 10^6 fragments) against a recursive walk with the same\n");
+    fprintf(stderr, "                   bounds checks\n");
+    fprintf(stderr, "  be32             time mp4_be32_decode() and mp4_be32_decode_u64() over a\n");
+    fprintf(stderr, "                   table of that many entries (default 10^3 to 10^7)\n");
+    fprintf(stderr, "                   against a get_u32() per entry\n");
+    fprintf(stderr, "  samplepack       time mp4_samples_pack() and mp4_samples_unpack() over the\n");
+    fprintf(stderr, "                   samples of that keyframes moov (default 10^3 to 10^6\n");
+    fprintf(stderr, "                   entries), or of every track of a file, and check that\n");
+    fprintf(stderr, "                   the unpacked columns are the packed ones\n");
+}
+
+// Growable buffer the synthetic boxes are written into, with the boxes still
+// open
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    size_t open[SYNTH_MAX_DEPTH];
+    int depth;
+} synth_t;
+
+static uint8_t *
+synth_grow(synth_t *s, size_t n)
+{
+    if (s->len + n > s->cap) {
+        size_t cap = s->cap ? s->cap : 4096;
+        while (cap < s->len + n) {
+            cap *= 2;
+        }
+        uint8_t *buf = realloc(s->buf, cap);
+        if (!buf) {
+            fprintf(stderr, "%s:%d %s realloc(%zu) error: %s\n", __FILE__, __LINE__, __FUNCTION__, cap, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        s->buf = buf;
+        s->cap = cap;
+    }
+    uint8_t *p = s->buf + s->len;
+    s->len += n;
+    return p;
+}
+
+static void
+put_u8(synth_t *s, uint8_t v)
+{
+    *synth_grow(s, 1) = v;
+}
+
+static void
+put_u16(synth_t *s, uint16_t v)
+{
+    uint8_t *p = synth_grow(s, 2);
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void
+put_u32(synth_t *s, uint32_t v)
+{
+    uint8_t *p = synth_grow(s, 4);
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void
+put_zeros(synth_t *s, size_t n)
+{
+    memset(synth_grow(s, n), 0, n);
+}
+
+static void
+put_fourcc(synth_t *s, const char *type)
+{
+    memcpy(synth_grow(s, 4), type, 4);
+}
+
+// Start a box inside the open one; box_close() fills in its size once the
+// payload is written
+static void
+box_open(synth_t *s, const char *type)
+{
+    s->open[s->depth++] = s->len;
+    put_u32(s, 0);
+    put_fourcc(s, type);
+}
+
+static void
+full_box_open(synth_t *s, const char *type, uint8_t version, uint32_t flags)
+{
+    box_open(s, type);
+    put_u32(s, (uint32_t)version << 24 | flags);
+}
+
+static void
+box_close(synth_t *s)
+{
+    const size_t box = s->open[--s->depth];
+    const size_t size = s->len - box;
+    uint8_t *p = s->buf + box;
+    p[0] = size >> 24;
+    p[1] = size >> 16;
+    p[2] = size >> 8;
+    p[3] = size;
+}
+
+static void
+synth_ftyp(synth_t *s)
+{
+    box_open(s, "ftyp");
+    put_fourcc(s, "isom");
+    put_u32(s, 0x200);
+    put_fourcc(s, "isom");
+    put_fourcc(s, "avc1");
+    box_close(s);
+}
+
+static void
+synth_matrix(synth_t *s)
+{
+    static const uint32_t matrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+    for (int i = 0; i < 9; i++) {
+        put_u32(s, matrix[i]);
+    }
+}
+
+static void
+synth_mvhd(synth_t *s, uint32_t next_track_id)
+{
+    full_box_open(s, "mvhd", 0, 0);
+    put_zeros(s, 8);  // creation and modification time
+    put_u32(s, SYNTH_TIME_SCALE);
+    put_u32(s, 0);  // duration
+    put_u32(s, 0x00010000);
+    put_u16(s, 0x0100);
+    put_zeros(s, 10);
+    synth_matrix(s);
+    put_zeros(s, 24);
+    put_u32(s, next_track_id);
+    box_close(s);
+}
+
+// trak, tkhd, mdia, mdhd, hdlr, minf, stbl and an avc1 stsd of a video
+// track, leaving trak, mdia, minf and stbl open for the sample tables
+static void
+synth_video_trak_open(synth_t *s, uint32_t track_id)
+{
+    box_open(s, "trak");
+    full_box_open(s, "tkhd", 0, 3);
+    put_zeros(s, 8);
+    put_u32(s, track_id);
+    put_zeros(s, 4 + 4 + 8 + 2 + 2 + 2 + 2);
+    synth_matrix(s);
+    put_u32(s, 1280 << 16);
+    put_u32(s, 720 << 16);
+    box_close(s);
+
+    box_open(s, "mdia");
+    full_box_open(s, "mdhd", 0, 0);
+    put_zeros(s, 8);
+    put_u32(s, SYNTH_TIME_SCALE);
+    put_u32(s, 0);
+    put_u16(s, 0x55c4);  // "und"
+    put_u16(s, 0);
+    box_close(s);
+    full_box_open(s, "hdlr", 0, 0);
+    put_u32(s, 0);
+    put_fourcc(s, "vide");
+    put_zeros(s, 12);
+    put_u8(s, 0);
+    box_close(s);
+
+    box_open(s, "minf");
+    box_open(s, "stbl");
+    full_box_open(s, "stsd", 0, 0);
+    put_u32(s, 1);
+    box_open(s, "avc1");
+    put_zeros(s, 6);
+    put_u16(s, 1);  // data reference index
+    put_zeros(s, 16);
+    put_u16(s, 1280);
+    put_u16(s, 720);
+    put_u32(s, 0x00480000);
+    put_u32(s, 0x00480000);
+    put_u32(s, 0);
+    put_u16(s, 1);
+    put_zeros(s, 32);
+    put_u16(s, 0x0018);
+    put_u16(s, 0xffff);
+    box_open(s, "avcC");
+    put_u8(s, 1);
+    put_u8(s, 0x64);
+    put_u8(s, 0);
+    put_u8(s, 0x1f);
+    put_u8(s, 0xff);  // 4-byte NAL unit lengths
+    put_u8(s, 0xe0);  // no SPS
+    put_u8(s, 0);     // nor PPS
+    box_close(s);
+    box_close(s);
+    box_close(s);
+}
+
+// Payload offsets of the sample tables of a synthetic moov in its buffer
+typedef struct {
+    size_t stts;
+    size_t stss;
+    size_t stsc;
+    size_t stco;
+} synth_tables_t;
+
+// stts, stss, stsc, stsz and stco (co64 with co64 set) of n samples, each
+// SYNTH_SAMPLE_SIZE bytes at data + i * spacing: one entry a sample in
+// stts (alternating durations, as variable frame rate files have), stsc (a
+// chunk a sample), stsz and the chunk offsets, and a sync sample every
+// SYNTH_GOP samples
+static void
+synth_sample_tables(synth_t *s, uint32_t n, uint64_t data, uint64_t spacing, bool co64, synth_tables_t *tables)
+{
+    tables->stts = s->len + 8;
+    full_box_open(s, "stts", 0, 0);
+    put_u32(s, n);
+    for (uint32_t i = 0; i < n; i++) {
+        put_u32(s, 1);
+        put_u32(s, i & 1 ? 3003 : 3000);
+    }
+    box_close(s);
+
+    tables->stss = s->len + 8;
+    full_box_open(s, "stss", 0, 0);
+    put_u32(s, (n + SYNTH_GOP - 1) / SYNTH_GOP);
+    for (uint32_t i = 0; i < n; i += SYNTH_GOP) {
+        put_u32(s, i + 1);
+    }
+    box_close(s);
+
+    tables->stsc = s->len + 8;
+    full_box_open(s, "stsc", 0, 0);
+    put_u32(s, n);
+    for (uint32_t i = 0; i < n; i++) {
+        put_u32(s, i + 1);
+        put_u32(s, 1);
+        put_u32(s, 1);
+    }
+    box_close(s);
+
+    full_box_open(s, "stsz", 0, 0);
+    put_u32(s, 0);
+    put_u32(s, n);
+    for (uint32_t i = 0; i < n; i++) {
+        put_u32(s, SYNTH_SAMPLE_SIZE);
+    }
+    box_close(s);
+
+    tables->stco = s->len + 8;
+    full_box_open(s, co64 ? "co64" : "stco", 0, 0);
+    put_u32(s, n);
+    for (uint32_t i = 0; i < n; i++) {
+        const uint64_t offset = data + i * spacing;
+        if (co64) {
+            put_u32(s, offset >> 32);
+        }
+        put_u32(s, offset);
+    }
+    box_close(s);
+}
+
+// ftyp, an mdat of n samples back to back, then a moov with their tables.
+// *moov is the offset of the moov box.
+static void
+synth_tables(synth_t *s, uint32_t n, size_t *moov, synth_tables_t *tables)
+{
+    synth_ftyp(s);
+    box_open(s, "mdat");
+    const uint64_t data = s->len;
+    put_zeros(s, (size_t)n * SYNTH_SAMPLE_SIZE);
+    box_close(s);
+
+    *moov = s->len;
+    box_open(s, "moov");
+    synth_mvhd(s, 2);
+    synth_video_trak_open(s, 1);
+    synth_sample_tables(s, n, data, SYNTH_SAMPLE_SIZE, false, tables);
+    // stbl, minf, mdia, trak and moov
+    while (s->depth > 0) {
+        box_close(s);
+    }
+}
+
+// Every sample: an AUD and a filler NAL unit with 4-byte lengths
+static const uint8_t synth_sample[SYNTH_SAMPLE_SIZE] = {0, 0, 0, 2, 0x09, 0xf0, 0, 0, 0, 6, 0x0c, 0xff, 0xff, 0xff, 0xff, 0x80};
+
+// ftyp, a moov with no samples of its own and a trex, then n fragments of a
+// moof box (mfhd, traf, tfhd, tfdt and a trun of one sample) and an mdat
+// box. Every SYNTH_GOP-th sample is a sync sample.
+static void
+synth_fragments(synth_t *s, uint32_t n)
+{
+    synth_ftyp(s);
+    box_open(s, "moov");
+    synth_mvhd(s, 2);
+    synth_video_trak_open(s, 1);
+    synth_tables_t tables;
+    synth_sample_tables(s, 0, 0, 0, false, &tables);
+    while (s->depth > 1) {
+        box_close(s);
+    }
+    box_open(s, "mvex");
+    full_box_open(s, "trex", 0, 0);
+    put_u32(s, 1);  // track ID
+    put_u32(s, 1);  // sample description index
+    put_u32(s, 3000);
+    put_u32(s, SYNTH_SAMPLE_SIZE);
+    put_u32(s, 0x00010000);  // non-sync
+    box_close(s);
+    box_close(s);
+    box_close(s);
+
+    for (uint32_t i = 0; i < n; i++) {
+        const size_t moof = s->len;
+        box_open(s, "moof");
+        full_box_open(s, "mfhd", 0, 0);
+        put_u32(s, i + 1);
+        box_close(s);
+        box_open(s, "traf");
+        full_box_open(s, "tfhd", 0, 0x020000);  // default-base-is-moof
+        put_u32(s, 1);
+        box_close(s);
+        full_box_open(s, "tfdt", 1, 0);
+        const uint64_t decode_time = (uint64_t)i * 3000;
+        put_u32(s, decode_time >> 32);
+        put_u32(s, decode_time);
+        box_close(s);
+        full_box_open(s, "trun", 0, 0x000005);  // data offset, first sample flags
+        put_u32(s, 1);
+        const size_t data_offset = s->len;
+        put_u32(s, 0);
+        put_u32(s, i % SYNTH_GOP == 0 ? 0x02000000 : 0x00010000);
+        box_close(s);
+        box_close(s);
+        box_close(s);
+        // the sample follows the mdat header
+        const uint32_t offset = s->len - moof + 8;
+        s->buf[data_offset] = offset >> 24;
+        s->buf[data_offset + 1] = offset >> 16;
+        s->buf[data_offset + 2] = offset >> 8;
+        s->buf[data_offset + 3] = offset;
+        box_open(s, "mdat");
+        memcpy(synth_grow(s, SYNTH_SAMPLE_SIZE), synth_sample, SYNTH_SAMPLE_SIZE);
+        box_close(s);
+    }
+}
+
+static void
+synth_write(const synth_t *s, const char *filename)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s:%d %s open(\"%s\", O_WRONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (size_t off = 0; off < s->len;) {
+        ssize_t n = write(fd, s->buf + off, s->len - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "%s:%d %s write(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        off += n;
+    }
+    close(fd);
+}
+
+static void
+synth_pwrite(int fd, const uint8_t *buf, size_t len, uint64_t offset, const char *filename)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "%s:%d %s pwrite(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best seconds of one run of fn(arg), over as many runs as fit in
+// BENCH_MIN_SECONDS (at least one)
+static double
+bench_time(void (*fn)(void *arg), void *arg)
+{
+    double best = 0;
+    const double start = now();
+    for (int i = 0; i == 0 || now() - start < BENCH_MIN_SECONDS; i++) {
+        const double t = now();
+        fn(arg);
+        const double elapsed = now() - t;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+static long
+parse_number(const char *arg, const char *what, long min, long max)
+{
+    char *end = NULL;
+    long value = strtol(arg, &end, 0);
+    if (end == arg || *end != '\0' || value < min || value > max) {
+        fprintf(stderr, "%s:%d %s invalid %s: %s\n", __FILE__, __LINE__, __FUNCTION__, what, arg);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+typedef struct {
+    const synth_t *s;
+    size_t moov;
+    synth_tables_t tables;
+    mp4_index_t *index;
+    // the rescan's keyframe offsets and times
+    uint32_t keyframes_num;
+    uint64_t *offset;
+    uint64_t *time;
+} keyframes_bench_t;
+
+static void
+keyframes_build(void *arg)
+{
+    keyframes_bench_t *b = arg;
+    int err = mp4_index_build(b->s->buf + b->moov, b->s->len - b->moov, b->index);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_index_build error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// The resolver before the forward walk: the tables decoded a get_u32() at a
+// time, then stts and stsc scanned from their first entry for every
+// keyframe. Sums are 64-bit, the old int ones overflow on these sizes.
+static void
+keyframes_rescan(void *arg)
+{
+    keyframes_bench_t *b = arg;
+    const uint8_t *buf = b->s->buf;
+    const uint32_t stss_num = get_u32(buf + b->tables.stss + 4);
+    const uint32_t stts_num = get_u32(buf + b->tables.stts + 4);
+    const uint32_t stsc_num = get_u32(buf + b->tables.stsc + 4);
+    const uint32_t stco_num = get_u32(buf + b->tables.stco + 4);
+    uint32_t *stss = calloc(stss_num, sizeof(*stss));
+    uint32_t *stts = calloc(stts_num, 2 * sizeof(*stts));
+    uint32_t *stsc = calloc(stsc_num, 2 * sizeof(*stsc));
+    uint32_t *stco = calloc(stco_num, sizeof(*stco));
+    uint32_t *sync_chunk = calloc(stss_num, sizeof(*sync_chunk));
+    if (!stss || !stts || !stsc || !stco || !sync_chunk) {
+        fprintf(stderr, "%s:%d %s calloc error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < stss_num; i++) {
+        stss[i] = get_u32(buf + b->tables.stss + 8 + i * 4);
+    }
+    for (uint32_t i = 0; i < stts_num; i++) {
+        stts[2 * i] = get_u32(buf + b->tables.stts + 8 + i * 8);
+        stts[2 * i + 1] = get_u32(buf + b->tables.stts + 8 + i * 8 + 4);
+    }
+    for (uint32_t i = 0; i < stsc_num; i++) {
+        stsc[2 * i] = get_u32(buf + b->tables.stsc + 8 + 12 * i);
+        stsc[2 * i + 1] = get_u32(buf + b->tables.stsc + 8 + 12 * i + 4);
+    }
+    for (uint32_t i = 0; i < stco_num; i++) {
+        stco[i] = get_u32(buf + b->tables.stco + 8 + i * 4);
+    }
+
+    for (uint32_t i = 0; i < stss_num; i++) {
+        uint64_t total_count = 0;
+        uint64_t total_duration = 0;
+        for (uint32_t j = 0; j < stts_num; j++) {
+            if (total_count + stts[2 * j] >= stss[i] - 1) {
+                b->time[i] = total_duration + (stss[i] - 1 - total_count) * stts[2 * j + 1];
+                break;
+            }
+            total_count += stts[2 * j];
+            total_duration += (uint64_t)stts[2 * j] * stts[2 * j + 1];
+        }
+    }
+    for (uint32_t i = 0; i < stss_num; i++) {
+        uint64_t total_sample = 0;
+        for (uint32_t j = 0; j < stsc_num; j++) {
+            const uint32_t next_first_chunk = j < stsc_num - 1 ? stsc[2 * (j + 1)] : stco_num + 1;
+            const uint64_t cur_sample = (uint64_t)stsc[2 * j + 1] * (next_first_chunk - stsc[2 * j]);
+            if (total_sample + cur_sample >= stss[i]) {
+                sync_chunk[i] = stsc[2 * j] + (stss[i] - total_sample - 1) / stsc[2 * j + 1];
+                break;
+            }
+            total_sample += cur_sample;
+        }
+    }
+    for (uint32_t i = 0; i < stss_num; i++) {
+        b->offset[i] = stco[sync_chunk[i] - 1];
+    }
+    b->keyframes_num = stss_num;
+
+    free(stss);
+    free(stts);
+    free(stsc);
+    free(stco);
+    free(sync_chunk);
+}
+
+static int
+keyframes_main(int argc, char **argv)
+{
+    long rescan_max = 100000;
+    int first = 0;
+    if (argc >= 2 && strcmp(argv[0], "--rescan-max") == 0) {
+        rescan_max = parse_number(argv[1], "entries", 0, UINT32_MAX);
+        first = 2;
+    }
+    static char *sizes[] = {"1000", "10000", "100000", "1000000"};
+    if (first == argc) {
+        argv = sizes;
+        argc = sizeof(sizes) / sizeof(sizes[0]);
+        first = 0;
+    }
+
+    mp4_index_t *index = mp4_index_create();
+    if (!index) {
+        fprintf(stderr, "%s:%d %s mp4_index_create error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    printf("%-10s %-10s %-14s %-14s %s\n", "entries", "keyframes", "build (ms)", "rescan (ms)", "speedup");
+    for (int i = first; i < argc; i++) {
+        const uint32_t n = parse_number(argv[i], "entries", 1, 50000000);
+        synth_t s = {0};
+        keyframes_bench_t b = {.s = &s, .index = index};
+        synth_tables(&s, n, &b.moov, &b.tables);
+
+        const double build = bench_time(keyframes_build, &b);
+        const mp4_track_t *track = mp4_index_default_track(index);
+        if (n > rescan_max) {
+            printf("%-10u %-10zu %-14.3f %-14s %s\n", n, track->keyframes.num, build * 1e3, "-", "-");
+            free(s.buf);
+            continue;
+        }
+
+        b.offset = calloc(n, sizeof(*b.offset));
+        b.time = calloc(n, sizeof(*b.time));
+        if (!b.offset || !b.time) {
+            fprintf(stderr, "%s:%d %s calloc error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        const double rescan = bench_time(keyframes_rescan, &b);
+        // both resolvers must agree for the times to mean anything
+        bool same = b.keyframes_num == track->keyframes.num;
+        for (size_t k = 0; same && k < track->keyframes.num; k++) {
+            same = b.offset[k] == track->keyframes.offset[k] && (double)b.time[k] / SYNTH_TIME_SCALE == track->keyframes.dts[k];
+        }
+        if (!same) {
+            fprintf(stderr, "%s:%d %s the rescan and mp4_index_build disagree at %u entries\n", __FILE__, __LINE__, __FUNCTION__, n);
+            return EXIT_FAILURE;
+        }
+        printf("%-10u %-10zu %-14.3f %-14.3f %.1fx\n", n, track->keyframes.num, build * 1e3, rescan * 1e3, rescan / build);
+        free(b.offset);
+        free(b.time);
+        free(s.buf);
+    }
+    mp4_index_destroy(index);
+    return EXIT_SUCCESS;
+}
+
+static int
+tables_main(int argc, char **argv)
+{
+    if (argc != 2) {
+        return -1;
+    }
+    const uint32_t n = parse_number(argv[0], "entries", 1, 50000000);
+    synth_t s = {0};
+    size_t moov = 0;
+    synth_tables_t tables;
+    synth_tables(&s, n, &moov, &tables);
+    synth_write(&s, argv[1]);
+    free(s.buf);
+    return EXIT_SUCCESS;
+}
+
+// Only the headers, the sample bytes and the moov are written, the rest of
+// the mdat is a hole, so the file takes a few blocks of disk whatever its size
+static int
+sparse_main(int argc, char **argv)
+{
+    if (argc != 2) {
+        return -1;
+    }
+    const uint64_t mdat_size = (uint64_t)parse_number(argv[0], "size in GiB", 1, 1024) << 30;
+    const char *filename = argv[1];
+
+    synth_t head = {0};
+    synth_ftyp(&head);
+    const uint64_t mdat = head.len;
+    put_u32(&head, 1);
+    put_fourcc(&head, "mdat");
+    put_u32(&head, mdat_size >> 32);
+    put_u32(&head, mdat_size);
+    const uint64_t data = head.len;
+    const uint64_t spacing = (mdat_size - 16) / SYNTH_SPARSE_SAMPLES;
+
+    synth_t moov = {0};
+    synth_tables_t tables;
+    box_open(&moov, "moov");
+    synth_mvhd(&moov, 2);
+    synth_video_trak_open(&moov, 1);
+    synth_sample_tables(&moov, SYNTH_SPARSE_SAMPLES, data, spacing, true, &tables);
+    while (moov.depth > 0) {
+        box_close(&moov);
+    }
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s:%d %s open(\"%s\", O_WRONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    synth_pwrite(fd, head.buf, head.len, 0, filename);
+    for (uint32_t i = 0; i < SYNTH_SPARSE_SAMPLES; i++) {
+        synth_pwrite(fd, synth_sample, sizeof(synth_sample), data + i * spacing, filename);
+    }
+    synth_pwrite(fd, moov.buf, moov.len, mdat + mdat_size, filename);
+    close(fd);
+
+    // the durations alternate 3000, 3003 and every sync sample is an even one
+    for (uint32_t i = 0; i < SYNTH_SPARSE_SAMPLES; i += SYNTH_GOP) {
+        const double time = (double)(i / 2) * (3000 + 3003) / SYNTH_TIME_SCALE;
+        printf("%-7g %llu %g\n", time, (unsigned long long)(data + i * spacing), time);
+    }
+    free(head.buf);
+    free(moov.buf);
+    return EXIT_SUCCESS;
+}
+
+static int
+fragments_main(int argc, char **argv)
+{
+    if (argc != 2) {
+        return -1;
+    }
+    const uint32_t n = parse_number(argv[0], "moof boxes", 1, 50000000);
+    synth_t s = {0};
+    synth_fragments(&s, n);
+    synth_write(&s, argv[1]);
+    free(s.buf);
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    const synth_t *s;
+    size_t boxes;
+} walk_bench_t;
+
+static bool
+walk_is_container(const uint8_t *type)
+{
+    static const char containers[][4] = {"moov", "trak", "mdia", "minf", "stbl", "mvex", "moof", "traf"};
+    for (size_t i = 0; i < sizeof(containers) / sizeof(containers[0]); i++) {
+        if (memcmp(type, containers[i], 4) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int
+walk_enter(void *arg, const mp4_walk_box_t *box, const uint8_t **children, size_t *children_len)
+{
+    walk_bench_t *b = arg;
+    b->boxes++;
+    if (!walk_is_container(box->type)) {
+        return MP4_WALK_NEXT;
+    }
+    *children = box->data;
+    *children_len = box->len;
+    return MP4_WALK_DESCEND;
+}
+
+static void
+walk_iterative(void *arg)
+{
+    walk_bench_t *b = arg;
+    const mp4_walker_t walker = {.enter = walk_enter, .arg = b};
+    b->boxes = 0;
+    int err = mp4_walk(&walker, b->s->buf, b->s->len);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_walk error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// The recursion mp4_walk() replaced, a call per container, with the bounds
+// and depth checks mp4_walk() makes
+static int
+walk_recurse(walk_bench_t *b, const uint8_t *p, size_t len, int depth)
+{
+    while (len >= 8) {
+        uint64_t size = get_u32(p);
+        size_t header = 8;
+        if (size == 1) {
+            if (len < 16) {
+                return MP4_INDEX_ERR_FORMAT;
+            }
+            size = get_u64(p + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = len;
+        }
+        if (size < header || size > len) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        b->boxes++;
+        if (walk_is_container(p + 4)) {
+            if (depth >= MP4_WALK_MAX_DEPTH) {
+                return MP4_INDEX_ERR_DEPTH;
+            }
+            int err = walk_recurse(b, p + header, size - header, depth + 1);
+            if (err != MP4_INDEX_OK) {
+                return err;
+            }
+        }
+        p += size;
+        len -= size;
+    }
+    return MP4_INDEX_OK;
+}
+
+static void
+walk_recursive(void *arg)
+{
+    walk_bench_t *b = arg;
+    b->boxes = 0;
+    int err = walk_recurse(b, b->s->buf, b->s->len, 0);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s walk_recurse error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int
+walk_main(int argc, char **argv)
+{
+    static char *sizes[] = {"1000", "10000", "100000", "1000000"};
+    if (argc == 0) {
+        argv = sizes;
+        argc = sizeof(sizes) / sizeof(sizes[0]);
+    }
+    printf("%-10s %-10s %-14s %-14s %s\n", "fragments", "boxes", "walk (ms)", "recurse (ms)", "walk/recurse");
+    for (int i = 0; i < argc; i++) {
+        const uint32_t n = parse_number(argv[i], "moof boxes", 1, 50000000);
+        synth_t s = {0};
+        synth_fragments(&s, n);
+        walk_bench_t b = {.s = &s};
+
+        const double walk = bench_time(walk_iterative, &b);
+        const size_t boxes = b.boxes;
+        const double recurse = bench_time(walk_recursive, &b);
+        if (b.boxes != boxes) {
+            fprintf(stderr, "%s:%d %s mp4_walk and the recursion disagree at %u fragments\n", __FILE__, __LINE__, __FUNCTION__, n);
+            return EXIT_FAILURE;
+        }
+        printf("%-10u %-10zu %-14.3f %-14.3f %.2f\n", n, boxes, walk * 1e3, recurse * 1e3, walk / recurse);
+        free(s.buf);
+    }
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    const uint8_t *src;
+    size_t num;
+    uint32_t *dst;
+    uint64_t *dst64;
+} be32_bench_t;
+
+static void
+be32_decode(void *arg)
+{
+    be32_bench_t *b = arg;
+    mp4_be32_decode(b->dst, b->src, b->num);
+}
+
+static void
+be32_decode_u64(void *arg)
+{
+    be32_bench_t *b = arg;
+    mp4_be32_decode_u64(b->dst64, b->src, b->num);
+}
+
+// The decode the table readers did before mp4be.c
+static void
+be32_get_u32(void *arg)
+{
+    be32_bench_t *b = arg;
+    for (size_t i = 0; i < b->num; i++) {
+        b->dst[i] = get_u32(b->src + i * 4);
+    }
+}
+
+static void
+be32_get_u32_u64(void *arg)
+{
+    be32_bench_t *b = arg;
+    for (size_t i = 0; i < b->num; i++) {
+        b->dst64[i] = get_u32(b->src + i * 4);
+    }
+}
+
+static int
+be32_main(int argc, char **argv)
+{
+    static char *sizes[] = {"1000", "10000", "100000", "1000000", "10000000"};
+    if (argc == 0) {
+        argv = sizes;
+        argc = sizeof(sizes) / sizeof(sizes[0]);
+    }
+    printf("%-10s %-12s %-12s %-8s %-12s %-12s %s\n", "entries", "be32 (us)", "get_u32 (us)", "speedup", "u64 (us)", "get_u32 (us)", "speedup");
+    for (int i = 0; i < argc; i++) {
+        const size_t n = parse_number(argv[i], "entries", 1, 100000000);
+        // one byte past the table, so src is not aligned, as in a box
+        uint8_t *src = malloc(n * 4 + 1);
+        uint32_t *dst = malloc(n * sizeof(*dst));
+        uint32_t *expected = malloc(n * sizeof(*expected));
+        uint64_t *dst64 = malloc(n * sizeof(*dst64));
+        if (!src || !dst || !expected || !dst64) {
+            fprintf(stderr, "%s:%d %s malloc error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        srand(1);
+        for (size_t k = 0; k < n * 4 + 1; k++) {
+            src[k] = rand();
+        }
+        be32_bench_t b = {.src = src + 1, .num = n, .dst = expected, .dst64 = dst64};
+        const double scalar = bench_time(be32_get_u32, &b);
+        const double scalar64 = bench_time(be32_get_u32_u64, &b);
+        b.dst = dst;
+        const double vector = bench_time(be32_decode, &b);
+        bool same = memcmp(dst, expected, n * sizeof(*dst)) == 0;
+        const double vector64 = bench_time(be32_decode_u64, &b);
+        for (size_t k = 0; same && k < n; k++) {
+            same = dst64[k] == expected[k];
+        }
+        if (!same) {
+            fprintf(stderr, "%s:%d %s mp4_be32_decode and get_u32 disagree at %zu entries\n", __FILE__, __LINE__, __FUNCTION__, n);
+            return EXIT_FAILURE;
+        }
+        printf("%-10zu %-12.1f %-12.1f %-8.1f %-12.1f %-12.1f %.1f\n", n, vector * 1e6, scalar * 1e6, scalar / vector, vector64 * 1e6, scalar64 * 1e6, scalar64 / vector64);
+        free(src);
+        free(dst);
+        free(expected);
+        free(dst64);
+    }
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    const mp4_samples_t *samples;
+    mp4_samples_packed_t packed;
+    // the unpacked columns
+    uint64_t *offset;
+    uint32_t *size;
+    uint64_t *dts;
+    int32_t *cts_offset;
+    uint32_t *chunk;
+    uint8_t *sync;
+} samplepack_bench_t;
+
+static void
+samplepack_pack(void *arg)
+{
+    samplepack_bench_t *b = arg;
+    mp4_samples_packed_free(&b->packed);
+    int err = mp4_samples_pack(b->samples, &b->packed);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_samples_pack error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+samplepack_unpack(void *arg)
+{
+    samplepack_bench_t *b = arg;
+    int err = mp4_samples_unpack(&b->packed, b->offset, b->size, b->dts, b->cts_offset, b->chunk, b->sync);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_samples_unpack error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Pack and unpack the samples of one track, and print a row if the unpacked
+// columns are the ones packed
+static bool
+samplepack_check(const mp4_samples_t *samples, const char *label)
+{
+    const size_t n = samples->num ? samples->num : 1;
+    samplepack_bench_t b = {.samples = samples};
+    b.offset = malloc(n * sizeof(*b.offset));
+    b.size = malloc(n * sizeof(*b.size));
+    b.dts = malloc(n * sizeof(*b.dts));
+    b.cts_offset = malloc(n * sizeof(*b.cts_offset));
+    b.chunk = malloc(n * sizeof(*b.chunk));
+    b.sync = malloc(n * sizeof(*b.sync));
+    if (!b.offset || !b.size || !b.dts || !b.cts_offset || !b.chunk || !b.sync) {
+        fprintf(stderr, "%s:%d %s malloc error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const double pack = bench_time(samplepack_pack, &b);
+    const double unpack = bench_time(samplepack_unpack, &b);
+    const size_t num = samples->num;
+    const bool same = b.packed.num == num && (num == 0
+        || (memcmp(b.offset, samples->offset, num * sizeof(*b.offset)) == 0 && memcmp(b.size, samples->size, num * sizeof(*b.size)) == 0
+            && memcmp(b.dts, samples->dts, num * sizeof(*b.dts)) == 0
+            && memcmp(b.cts_offset, samples->cts_offset, num * sizeof(*b.cts_offset)) == 0
+            && memcmp(b.chunk, samples->chunk, num * sizeof(*b.chunk)) == 0 && memcmp(b.sync, samples->sync, num * sizeof(*b.sync)) == 0));
+    if (same) {
+        size_t packed = 0;
+        for (int column = 0; column < MP4_SAMPLES_COLUMNS; column++) {
+            packed += b.packed.len[column];
+        }
+        const size_t unpacked = num * (8 + 4 + 8 + 4 + 4 + 1);
+        printf("%-10s %-10zu %-12zu %-12zu %-12.3f %.3f\n", label, num, packed, unpacked, pack * 1e3, unpack * 1e3);
+    } else {
+        fprintf(stderr, "%s:%d %s the unpacked columns differ from the packed ones at %s\n", __FILE__, __LINE__, __FUNCTION__, label);
+    }
+    mp4_samples_packed_free(&b.packed);
+    free(b.offset);
+    free(b.size);
+    free(b.dts);
+    free(b.cts_offset);
+    free(b.chunk);
+    free(b.sync);
+    return same;
+}
+
+static int
+samplepack_main(int argc, char **argv)
+{
+    mp4_index_t *index = mp4_index_create();
+    if (!index) {
+        fprintf(stderr, "%s:%d %s mp4_index_create error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    mp4_index_set_samples(index, true);
+    const bool file = argc == 2 && strcmp(argv[0], "--file") == 0;
+    printf("%-10s %-10s %-12s %-12s %-12s %s\n", file ? "track" : "entries", "samples", "packed", "unpacked", "pack (ms)", "unpack (ms)");
+
+    bool same = true;
+    if (file) {
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "%s:%d %s open(\"%s\", O_RDONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, argv[1], strerror(errno));
+            return EXIT_FAILURE;
+        }
+        int err = mp4_index_build_fd(fd, index);
+        close(fd);
+        if (err != MP4_INDEX_OK) {
+            fprintf(stderr, "%s:%d %s mp4_index_build_fd(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, argv[1], mp4_index_strerror(err));
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; same && i < mp4_index_track_num(index); i++) {
+            const mp4_track_t *track = mp4_index_track(index, i);
+            char label[16];
+            snprintf(label, sizeof(label), "%u", track->track_id);
+            same = samplepack_check(&track->samples, label);
+        }
+    } else {
+        static char *sizes[] = {"1000", "10000", "100000", "1000000"};
+        if (argc == 0) {
+            argv = sizes;
+            argc = sizeof(sizes) / sizeof(sizes[0]);
+        }
+        for (int i = 0; same && i < argc; i++) {
+            const uint32_t n = parse_number(argv[i], "entries", 1, 50000000);
+            synth_t s = {0};
+            size_t moov = 0;
+            synth_tables_t tables;
+            synth_tables(&s, n, &moov, &tables);
+            int err = mp4_index_build(s.buf + moov, s.len - moov, index);
+            if (err != MP4_INDEX_OK) {
+                fprintf(stderr, "%s:%d %s mp4_index_build error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+                return EXIT_FAILURE;
+            }
+            same = samplepack_check(&mp4_index_default_track(index)->samples, argv[i]);
+            free(s.buf);
+        }
+    }
+    mp4_index_destroy(index);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    int ret = -1;
+    if (argc >= 2 && strcmp(argv[1], "keyframes") == 0) {
+        ret = keyframes_main(argc - 2, argv + 2);
+    } else if (argc >= 2 && strcmp(argv[1], "tables") == 0) {
+        ret = tables_main(argc - 2, argv + 2);
+    } else if (argc >= 2 && strcmp(argv[1], "sparse") == 0) {
+        ret = sparse_main(argc - 2, argv + 2);
+    } else if (argc >= 2 && strcmp(argv[1], "fragments") == 0) {
+        ret = fragments_main(argc - 2, argv + 2);
+    } else if (argc >= 2 && strcmp(argv[1], "walk") == 0) {
+        ret = walk_main(argc - 2, argv + 2);
+    } else if (argc >= 2 && strcmp(argv[1], "be32") == 0) {
+        ret = be32_main(argc - 2, argv + 2);
+    } else if (argc >= 2 && strcmp(argv[1], "samplepack") == 0) {
+        ret = samplepack_main(argc - 2, argv + 2);
+    }
+    if (ret < 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    return ret;
+}
@@ -0,0 +1,109 @@
+#include "mp4arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MP4_ARENA_ALIGN 16
+#define MP4_ARENA_MIN_BLOCK (64 * 1024)
+
+struct mp4_arena_block {
+    mp4_arena_block_t *next;
+    size_t size;
+    size_t used;
+    _Alignas(MP4_ARENA_ALIGN) uint8_t data[];
+};
+
+static mp4_arena_block_t *
+mp4_arena_block_new(size_t size)
+{
+    mp4_arena_block_t *block = malloc(sizeof(*block) + size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void *
+mp4_arena_alloc(mp4_arena_t *arena, size_t size)
+{
+    if (size > SIZE_MAX - MP4_ARENA_ALIGN) {
+        return NULL;
+    }
+    size = (size + MP4_ARENA_ALIGN - 1) & ~(size_t)(MP4_ARENA_ALIGN - 1);
+
+    // After a reset the existing blocks are reused in order before new ones are added
+    mp4_arena_block_t *last = NULL;
+    for (mp4_arena_block_t *block = arena->cur; block; block = block->next) {
+        if (block->size - block->used >= size) {
+            void *p = block->data + block->used;
+            block->used += size;
+            arena->cur = block;
+            return p;
+        }
+        last = block;
+    }
+
+    size_t block_size = MP4_ARENA_MIN_BLOCK;
+    if (last && last->size > block_size / 2) {
+        block_size = last->size * 2;
+    }
+    if (block_size < size) {
+        block_size = size;
+    }
+    mp4_arena_block_t *block = mp4_arena_block_new(block_size);
+    if (!block) {
+        return NULL;
+    }
+    if (last) {
+        last->next = block;
+    } else {
+        arena->head = block;
+    }
+    arena->cur = block;
+    block->used = size;
+    return block->data;
+}
+
+void *
+mp4_arena_array(mp4_arena_t *arena, size_t num, size_t size)
+{
+    if (size && num > SIZE_MAX / size) {
+        return NULL;
+    }
+    return mp4_arena_alloc(arena, num * size);
+}
+
+void *
+mp4_arena_calloc(mp4_arena_t *arena, size_t num, size_t size)
+{
+    void *p = mp4_arena_array(arena, num, size);
+    if (p) {
+        memset(p, 0, num * size);
+    }
+    return p;
+}
+
+void
+mp4_arena_reset(mp4_arena_t *arena)
+{
+    for (mp4_arena_block_t *block = arena->head; block; block = block->next) {
+        block->used = 0;
+    }
+    arena->cur = arena->head;
+}
+
+void
+mp4_arena_free(mp4_arena_t *arena)
+{
+    mp4_arena_block_t *block = arena->head;
+    while (block) {
+        mp4_arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->cur = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef _MP4_ARENA_H_2018
+#define _MP4_ARENA_H_2018
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator that owns every table of one index build. Nothing is freed
+// individually: mp4_arena_reset() recycles all blocks for the next build and
+// mp4_arena_free() gives them back to the system.
+typedef struct mp4_arena_block mp4_arena_block_t;
+
+typedef struct {
+    mp4_arena_block_t *head;
+    mp4_arena_block_t *cur;
+} mp4_arena_t;
+
+void *mp4_arena_alloc(mp4_arena_t *arena, size_t size);
+void *mp4_arena_array(mp4_arena_t *arena, size_t num, size_t size);
+void *mp4_arena_calloc(mp4_arena_t *arena, size_t num, size_t size);
+void mp4_arena_reset(mp4_arena_t *arena);
+void mp4_arena_free(mp4_arena_t *arena);
+
+#endif  //_MP4_ARENA_H_2018
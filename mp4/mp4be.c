@@ -0,0 +1,175 @@
+#include "mp4be.h"
+#include "mp4bytes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MP4_BE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    void (*be32)(uint32_t *dst, const uint8_t *src, size_t num);
+    void (*be64)(uint64_t *dst, const uint8_t *src, size_t num);
+    void (*be32_u64)(uint64_t *dst, const uint8_t *src, size_t num);
+} mp4_be_impl_t;
+
+static void
+mp4_be32_decode_scalar(uint32_t *dst, const uint8_t *src, size_t num)
+{
+    for (size_t i = 0; i < num; i++) {
+        dst[i] = get_u32(src + i * 4);
+    }
+}
+
+static void
+mp4_be64_decode_scalar(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    for (size_t i = 0; i < num; i++) {
+        dst[i] = get_u64(src + i * 8);
+    }
+}
+
+static void
+mp4_be32_decode_u64_scalar(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    for (size_t i = 0; i < num; i++) {
+        dst[i] = get_u32(src + i * 4);
+    }
+}
+
+static const mp4_be_impl_t mp4_be_scalar = {mp4_be32_decode_scalar, mp4_be64_decode_scalar, mp4_be32_decode_u64_scalar};
+
+#ifdef MP4_BE_X86
+
+__attribute__((target("ssse3"))) static void
+mp4_be32_decode_ssse3(uint32_t *dst, const uint8_t *src, size_t num)
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, swap));
+    }
+    mp4_be32_decode_scalar(dst + i, src + i * 4, num - i);
+}
+
+__attribute__((target("ssse3"))) static void
+mp4_be64_decode_ssse3(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    const __m128i swap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+    for (; i + 2 <= num; i += 2) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 8));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, swap));
+    }
+    mp4_be64_decode_scalar(dst + i, src + i * 8, num - i);
+}
+
+// Swapped, then interleaved with zeros: the low and high pairs of entries
+// widened to 64 bits
+__attribute__((target("ssse3"))) static void
+mp4_be32_decode_u64_ssse3(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4)), swap);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi32(v, zero));
+        _mm_storeu_si128((__m128i *)(dst + i + 2), _mm_unpackhi_epi32(v, zero));
+    }
+    mp4_be32_decode_u64_scalar(dst + i, src + i * 4, num - i);
+}
+
+// _mm256_shuffle_epi8 shuffles within each 128-bit lane, so both lanes take
+// the same pattern
+__attribute__((target("avx2"))) static void
+mp4_be32_decode_avx2(uint32_t *dst, const uint8_t *src, size_t num)
+{
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        const __m256i b = _mm256_loadu_si256((const __m256i *)(src + i * 4 + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, swap));
+        _mm256_storeu_si256((__m256i *)(dst + i + 8), _mm256_shuffle_epi8(b, swap));
+    }
+    for (; i + 8 <= num; i += 8) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, swap));
+    }
+    mp4_be32_decode_scalar(dst + i, src + i * 4, num - i);
+}
+
+__attribute__((target("avx2"))) static void
+mp4_be64_decode_avx2(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, swap));
+    }
+    mp4_be64_decode_scalar(dst + i, src + i * 8, num - i);
+}
+
+// Four entries swapped in 128 bits, then zero-extended to 256
+__attribute__((target("avx2"))) static void
+mp4_be32_decode_u64_avx2(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4)), swap);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4 + 16)), swap);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_cvtepu32_epi64(a));
+        _mm256_storeu_si256((__m256i *)(dst + i + 4), _mm256_cvtepu32_epi64(b));
+    }
+    mp4_be32_decode_u64_scalar(dst + i, src + i * 4, num - i);
+}
+
+static const mp4_be_impl_t mp4_be_ssse3 = {mp4_be32_decode_ssse3, mp4_be64_decode_ssse3, mp4_be32_decode_u64_ssse3};
+static const mp4_be_impl_t mp4_be_avx2 = {mp4_be32_decode_avx2, mp4_be64_decode_avx2, mp4_be32_decode_u64_avx2};
+
+#endif  // MP4_BE_X86
+
+static const mp4_be_impl_t *
+mp4_be_impl(void)
+{
+    // picked once; threads racing here all store the same pointer
+    static const mp4_be_impl_t *impl = NULL;
+    const mp4_be_impl_t *p = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+    if (p) {
+        return p;
+    }
+    p = &mp4_be_scalar;
+#ifdef MP4_BE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        p = &mp4_be_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        p = &mp4_be_ssse3;
+    }
+#endif
+    __atomic_store_n(&impl, p, __ATOMIC_RELAXED);
+    return p;
+}
+
+void
+mp4_be32_decode(uint32_t *dst, const uint8_t *src, size_t num)
+{
+    mp4_be_impl()->be32(dst, src, num);
+}
+
+void
+mp4_be64_decode(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    mp4_be_impl()->be64(dst, src, num);
+}
+
+void
+mp4_be32_decode_u64(uint64_t *dst, const uint8_t *src, size_t num)
+{
+    mp4_be_impl()->be32_u64(dst, src, num);
+}
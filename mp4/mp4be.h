@@ -0,0 +1,20 @@
+#ifndef _MP4_BE_H_2018
+#define _MP4_BE_H_2018
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decoding of whole big-endian sample tables (stsz, stco, stss, stts,
+// ctts...) into native arrays, instead of a get_u32() per entry. The byte
+// swap runs 8 or 4 entries at a time with AVX2 or SSSE3 shuffles when the
+// CPU has them, picked on the first call, and one entry at a time otherwise.
+// src needs no alignment and may not overlap dst.
+
+// num 32-bit entries, e.g. stsz sizes or stts count/duration pairs as 2 * num
+void mp4_be32_decode(uint32_t *dst, const uint8_t *src, size_t num);
+// num 64-bit entries, e.g. co64 chunk offsets
+void mp4_be64_decode(uint64_t *dst, const uint8_t *src, size_t num);
+// num 32-bit entries widened to 64 bits, e.g. stco chunk offsets
+void mp4_be32_decode_u64(uint64_t *dst, const uint8_t *src, size_t num);
+
+#endif  //_MP4_BE_H_2018
@@ -0,0 +1,475 @@
+#include "mp4boxtree.h"
+#include "mp4bytes.h"
+#include "mp4index.h"
+#include "mp4walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Serialized layout, host byte order like the keyframe cache:
+//   header
+//   uint64_t offset[box_num]
+//   uint64_t size[box_num]
+//   uint32_t type[box_num]
+//   int32_t  parent[box_num]
+//   uint32_t depth[box_num]
+//   uint32_t header_size[box_num]
+#define MP4_BOX_TREE_MAGIC "MP4BIDX"
+#define MP4_BOX_TREE_VERSION 1
+#define MP4_BOX_TREE_BYTE_ORDER 0x01020304
+#define MP4_BOX_TREE_ENTRY_SIZE (2 * sizeof(uint64_t) + 4 * sizeof(uint32_t))
+
+struct mp4_box_tree {
+    mp4_boxes_t boxes;  // views of the arrays below or of the mapped file
+    size_t cap;
+    uint64_t *offset;
+    uint64_t *size;
+    uint32_t *type;
+    int32_t *parent;
+    uint32_t *depth;
+    uint32_t *header_size;
+    void *map;
+    size_t map_len;
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t inode;
+    uint64_t dev;
+    uint64_t box_num;
+} mp4_box_tree_header_t;
+
+// Where the header bytes of a box come from during the build
+typedef struct {
+    int fd;
+    const uint8_t *buf;
+    uint64_t len;
+} mp4_box_source_t;
+
+mp4_box_tree_t *
+mp4_box_tree_create(void)
+{
+    return calloc(1, sizeof(mp4_box_tree_t));
+}
+
+static void
+mp4_box_tree_reset(mp4_box_tree_t *tree)
+{
+    if (tree->map) {
+        munmap(tree->map, tree->map_len);
+        tree->map = NULL;
+        tree->map_len = 0;
+    }
+    tree->boxes.num = 0;
+    tree->boxes.offset = tree->offset;
+    tree->boxes.size = tree->size;
+    tree->boxes.type = tree->type;
+    tree->boxes.parent = tree->parent;
+    tree->boxes.depth = tree->depth;
+    tree->boxes.header_size = tree->header_size;
+}
+
+void
+mp4_box_tree_destroy(mp4_box_tree_t *tree)
+{
+    if (!tree) {
+        return;
+    }
+    mp4_box_tree_reset(tree);
+    free(tree->offset);
+    free(tree->size);
+    free(tree->type);
+    free(tree->parent);
+    free(tree->depth);
+    free(tree->header_size);
+    free(tree);
+}
+
+const mp4_boxes_t *
+mp4_box_tree_boxes(const mp4_box_tree_t *tree)
+{
+    return &tree->boxes;
+}
+
+static bool
+mp4_box_tree_grow(void **array, size_t cap, size_t esize)
+{
+    void *p = realloc(*array, cap * esize);
+    if (!p) {
+        return false;
+    }
+    *array = p;
+    return true;
+}
+
+static int
+mp4_box_tree_append(mp4_box_tree_t *tree, uint64_t offset, uint64_t size, uint32_t type, int32_t parent, uint32_t depth, uint32_t header_size)
+{
+    if (tree->boxes.num == tree->cap) {
+        const size_t cap = tree->cap ? tree->cap * 2 : 256;
+        if (!mp4_box_tree_grow((void **)&tree->offset, cap, sizeof(*tree->offset))
+            || !mp4_box_tree_grow((void **)&tree->size, cap, sizeof(*tree->size))
+            || !mp4_box_tree_grow((void **)&tree->type, cap, sizeof(*tree->type))
+            || !mp4_box_tree_grow((void **)&tree->parent, cap, sizeof(*tree->parent))
+            || !mp4_box_tree_grow((void **)&tree->depth, cap, sizeof(*tree->depth))
+            || !mp4_box_tree_grow((void **)&tree->header_size, cap, sizeof(*tree->header_size))) {
+            return MP4_INDEX_ERR_NOMEM;
+        }
+        tree->cap = cap;
+        tree->boxes.offset = tree->offset;
+        tree->boxes.size = tree->size;
+        tree->boxes.type = tree->type;
+        tree->boxes.parent = tree->parent;
+        tree->boxes.depth = tree->depth;
+        tree->boxes.header_size = tree->header_size;
+    }
+    const size_t i = tree->boxes.num++;
+    tree->offset[i] = offset;
+    tree->size[i] = size;
+    tree->type[i] = type;
+    tree->parent[i] = parent;
+    tree->depth[i] = depth;
+    tree->header_size[i] = header_size;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_fourcc_cmp(const void *key, const void *entry)
+{
+    const uint32_t a = *(const uint32_t *)key;
+    const uint32_t b = get_u32(*(const uint8_t *const *)entry);
+    return a < b ? -1 : a > b;
+}
+
+// Bytes between the header of a box and its first child, -1 for a box
+// without children. Sample entries only have children inside stsd.
+static int
+mp4_box_children_offset(uint32_t type, uint32_t parent_type)
+{
+    static const struct mp4_container {
+        const char *type;
+        int children_offset;
+    } containers[] = {
+        // sorted by type bytes, for the binary search below
+        {"dinf", 0},
+        {"edts", 0},
+        {"mdia", 0},
+        {"mfra", 0},
+        {"minf", 0},
+        {"moof", 0},
+        {"moov", 0},
+        {"mvex", 0},
+        {"schi", 0},
+        {"sinf", 0},
+        {"stbl", 0},
+        {"stsd", 8},
+        {"traf", 0},
+        {"trak", 0},
+        {"udta", 0},
+    };
+    static const struct mp4_container entries[] = {
+        // sorted by type bytes; visual entries are 78 bytes, audio ones 28
+        {"avc1", 78},
+        {"avc3", 78},
+        {"enca", 28},
+        {"encv", 78},
+        {"hev1", 78},
+        {"hvc1", 78},
+        {"mp4a", 28},
+        {"mp4v", 78},
+    };
+
+    static const uint32_t stsd = ('s' << 24) | ('t' << 16) | ('s' << 8) | 'd';
+    const struct mp4_container *container;
+    if (parent_type == stsd) {
+        container = bsearch(&type, entries, sizeof(entries) / sizeof(entries[0]), sizeof(entries[0]), mp4_fourcc_cmp);
+    } else {
+        container = bsearch(&type, containers, sizeof(containers) / sizeof(containers[0]), sizeof(containers[0]), mp4_fourcc_cmp);
+    }
+    return container ? container->children_offset : -1;
+}
+
+static bool
+pread_full(int fd, uint8_t *buf, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool
+mp4_box_source_read(const mp4_box_source_t *src, uint8_t *buf, size_t len, uint64_t offset)
+{
+    if (src->buf) {
+        memcpy(buf, src->buf + offset, len);
+        return true;
+    }
+    return pread_full(src->fd, buf, len, offset);
+}
+
+// One pass over the box headers with an explicit stack of the open
+// containers: a box is appended, then either its children are walked next or
+// it is stepped over by its size
+static int
+mp4_box_tree_walk(mp4_box_tree_t *tree, const mp4_box_source_t *src)
+{
+    struct {
+        uint64_t end;
+        int32_t index;
+    } stack[MP4_WALK_MAX_DEPTH];
+    int depth = 0;
+    uint64_t offset = 0;
+
+    mp4_box_tree_reset(tree);
+    for (;;) {
+        while (depth > 0 && offset + 8 > stack[depth - 1].end) {
+            offset = stack[--depth].end;
+        }
+        const uint64_t end = depth > 0 ? stack[depth - 1].end : src->len;
+        if (offset + 8 > end) {
+            break;
+        }
+
+        uint8_t header[16];
+        if (!mp4_box_source_read(src, header, 8, offset)) {
+            return MP4_INDEX_ERR_IO;
+        }
+        uint64_t size = get_u32(header);
+        uint32_t header_size = 8;
+        if (size == 1) {
+            if (offset + 16 > end) {
+                return MP4_INDEX_ERR_FORMAT;
+            }
+            if (!mp4_box_source_read(src, header + 8, 8, offset + 8)) {
+                return MP4_INDEX_ERR_IO;
+            }
+            size = get_u64(header + 8);
+            header_size = 16;
+        } else if (size == 0) {
+            // box extends to the end of its parent
+            size = end - offset;
+        }
+        if (size < header_size || size > end - offset) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+
+        const uint32_t type = get_u32(header + 4);
+        const int32_t parent = depth > 0 ? stack[depth - 1].index : -1;
+        const int32_t index = tree->boxes.num;
+        int err = mp4_box_tree_append(tree, offset, size, type, parent, depth, header_size);
+        if (err != MP4_INDEX_OK) {
+            return err;
+        }
+
+        const int children_offset = mp4_box_children_offset(type, parent >= 0 ? tree->type[parent] : 0);
+        if (children_offset >= 0 && header_size + children_offset + 8 <= size) {
+            if (depth == MP4_WALK_MAX_DEPTH) {
+                return MP4_INDEX_ERR_DEPTH;
+            }
+            stack[depth].end = offset + size;
+            stack[depth].index = index;
+            depth++;
+            offset += header_size + children_offset;
+        } else {
+            offset += size;
+        }
+    }
+    return MP4_INDEX_OK;
+}
+
+int
+mp4_box_tree_build(mp4_box_tree_t *tree, const uint8_t *buf, size_t len)
+{
+    const mp4_box_source_t src = {.fd = -1, .buf = buf, .len = len};
+    return mp4_box_tree_walk(tree, &src);
+}
+
+int
+mp4_box_tree_build_fd(mp4_box_tree_t *tree, int fd)
+{
+    struct stat sb = {0};
+    if (fstat(fd, &sb) < 0) {
+        return MP4_INDEX_ERR_IO;
+    }
+    const mp4_box_source_t src = {.fd = fd, .buf = NULL, .len = sb.st_size};
+    return mp4_box_tree_walk(tree, &src);
+}
+
+size_t
+mp4_box_tree_next(const mp4_box_tree_t *tree, size_t from, const char type[4])
+{
+    const uint32_t key = get_u32((const uint8_t *)type);
+    const uint32_t *types = tree->boxes.type;
+    const size_t num = tree->boxes.num;
+    size_t i = from;
+    while (i < num && types[i] != key) {
+        i++;
+    }
+    return i;
+}
+
+size_t
+mp4_box_tree_count(const mp4_box_tree_t *tree, const char type[4])
+{
+    const uint32_t key = get_u32((const uint8_t *)type);
+    const uint32_t *types = tree->boxes.type;
+    size_t count = 0;
+    for (size_t i = 0; i < tree->boxes.num; i++) {
+        count += types[i] == key;
+    }
+    return count;
+}
+
+static void
+mp4_box_tree_header_init(mp4_box_tree_header_t *header, const struct stat *sb, uint64_t box_num)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, MP4_BOX_TREE_MAGIC, sizeof(MP4_BOX_TREE_MAGIC));
+    header->version = MP4_BOX_TREE_VERSION;
+    header->byte_order = MP4_BOX_TREE_BYTE_ORDER;
+    header->file_size = sb->st_size;
+    header->mtime_sec = sb->st_mtim.tv_sec;
+    header->mtime_nsec = sb->st_mtim.tv_nsec;
+    header->inode = sb->st_ino;
+    header->dev = sb->st_dev;
+    header->box_num = box_num;
+}
+
+int
+mp4_box_tree_load(mp4_box_tree_t *tree, const char *path, const struct stat *sb)
+{
+    mp4_box_tree_reset(tree);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? MP4_INDEX_ERR_STALE : MP4_INDEX_ERR_IO;
+    }
+    struct stat tree_sb = {0};
+    if (fstat(fd, &tree_sb) < 0) {
+        close(fd);
+        return MP4_INDEX_ERR_IO;
+    }
+    const uint64_t map_len = tree_sb.st_size;
+    if (map_len < sizeof(mp4_box_tree_header_t)) {
+        close(fd);
+        return MP4_INDEX_ERR_STALE;
+    }
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return MP4_INDEX_ERR_IO;
+    }
+
+    mp4_box_tree_header_t expected;
+    const mp4_box_tree_header_t *header = map;
+    mp4_box_tree_header_init(&expected, sb, header->box_num);
+    if (memcmp(header, &expected, sizeof(expected)) != 0
+        || header->box_num != (map_len - sizeof(*header)) / MP4_BOX_TREE_ENTRY_SIZE
+        || (map_len - sizeof(*header)) % MP4_BOX_TREE_ENTRY_SIZE != 0) {
+        munmap(map, map_len);
+        return MP4_INDEX_ERR_STALE;
+    }
+
+    const size_t num = header->box_num;
+    const uint8_t *p = (const uint8_t *)(header + 1);
+    tree->boxes.num = num;
+    tree->boxes.offset = (const uint64_t *)p;
+    tree->boxes.size = (const uint64_t *)(p + num * sizeof(uint64_t));
+    p += num * 2 * sizeof(uint64_t);
+    tree->boxes.type = (const uint32_t *)p;
+    tree->boxes.parent = (const int32_t *)(p + num * sizeof(uint32_t));
+    tree->boxes.depth = (const uint32_t *)(p + num * 2 * sizeof(uint32_t));
+    tree->boxes.header_size = (const uint32_t *)(p + num * 3 * sizeof(uint32_t));
+    tree->map = map;
+    tree->map_len = map_len;
+    return MP4_INDEX_OK;
+}
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return MP4_INDEX_ERR_IO;
+        }
+        p += n;
+        len -= n;
+    }
+    return MP4_INDEX_OK;
+}
+
+int
+mp4_box_tree_save(const mp4_box_tree_t *tree, const char *path, const struct stat *sb)
+{
+    const mp4_boxes_t *boxes = &tree->boxes;
+    mp4_box_tree_header_t header;
+    mp4_box_tree_header_init(&header, sb, boxes->num);
+
+    // Written to a temporary file and renamed into place, as the keyframe cache
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(tmp_path)) {
+        return MP4_INDEX_ERR_IO;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return MP4_INDEX_ERR_IO;
+    }
+
+    int err = write_full(fd, &header, sizeof(header));
+    if (err == MP4_INDEX_OK) {
+        err = write_full(fd, boxes->offset, boxes->num * sizeof(*boxes->offset));
+    }
+    if (err == MP4_INDEX_OK) {
+        err = write_full(fd, boxes->size, boxes->num * sizeof(*boxes->size));
+    }
+    if (err == MP4_INDEX_OK) {
+        err = write_full(fd, boxes->type, boxes->num * sizeof(*boxes->type));
+    }
+    if (err == MP4_INDEX_OK) {
+        err = write_full(fd, boxes->parent, boxes->num * sizeof(*boxes->parent));
+    }
+    if (err == MP4_INDEX_OK) {
+        err = write_full(fd, boxes->depth, boxes->num * sizeof(*boxes->depth));
+    }
+    if (err == MP4_INDEX_OK) {
+        err = write_full(fd, boxes->header_size, boxes->num * sizeof(*boxes->header_size));
+    }
+    if (close(fd) < 0 && err == MP4_INDEX_OK) {
+        err = MP4_INDEX_ERR_IO;
+    }
+    if (err == MP4_INDEX_OK && rename(tmp_path, path) < 0) {
+        err = MP4_INDEX_ERR_IO;
+    }
+    if (err != MP4_INDEX_OK) {
+        unlink(tmp_path);
+    }
+    return err;
+}
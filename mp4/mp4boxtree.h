@@ -0,0 +1,51 @@
+#ifndef _MP4_BOXTREE_H_2018
+#define _MP4_BOXTREE_H_2018
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Flat index of every box of a file, built in one pass over the box headers.
+// Boxes are stored in file order (a parent before its children) as parallel
+// arrays, so questions like "every trun" or "every moof offset" are plain
+// loops over contiguous memory instead of another walk of the file.
+//
+// Container boxes (moov, trak, mdia, minf, stbl, moof, traf, mfra, stsd and
+// the avc/hevc/mp4a sample entries in it...) are descended, everything else,
+// mdat included, is stepped over by its size. Nesting deeper than
+// MP4_WALK_MAX_DEPTH fails with MP4_INDEX_ERR_DEPTH. Error codes are the
+// MP4_INDEX_* codes of mp4index.h.
+
+typedef struct mp4_box_tree mp4_box_tree_t;
+
+typedef struct {
+    size_t num;
+    const uint64_t *offset;       // file offset of the box header
+    const uint64_t *size;         // header included
+    const uint32_t *type;         // FourCC, first character in the high byte
+    const int32_t *parent;        // index of the enclosing box, -1 at the top level
+    const uint32_t *depth;        // 0 at the top level
+    const uint32_t *header_size;  // 8 or 16
+} mp4_boxes_t;
+
+mp4_box_tree_t *mp4_box_tree_create(void);
+void mp4_box_tree_destroy(mp4_box_tree_t *tree);
+
+// Index the boxes of a buffer holding a file from its start, or of an open
+// file, reading only the box headers
+int mp4_box_tree_build(mp4_box_tree_t *tree, const uint8_t *buf, size_t len);
+int mp4_box_tree_build_fd(mp4_box_tree_t *tree, int fd);
+
+const mp4_boxes_t *mp4_box_tree_boxes(const mp4_box_tree_t *tree);
+// Index of the first box of the given type at or after from, boxes->num if
+// there is none
+size_t mp4_box_tree_next(const mp4_box_tree_t *tree, size_t from, const char type[4]);
+size_t mp4_box_tree_count(const mp4_box_tree_t *tree, const char type[4]);
+
+// Serialized index, checked against the size, mtime and inode of the source
+// file (sb) like the keyframe cache. Loading maps the file read-only; it
+// fails with MP4_INDEX_ERR_STALE when it does not describe sb any more.
+int mp4_box_tree_load(mp4_box_tree_t *tree, const char *path, const struct stat *sb);
+int mp4_box_tree_save(const mp4_box_tree_t *tree, const char *path, const struct stat *sb);
+
+#endif  //_MP4_BOXTREE_H_2018
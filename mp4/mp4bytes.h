@@ -0,0 +1,30 @@
+#ifndef _MP4_BYTES_H_2018
+#define _MP4_BYTES_H_2018
+
+#include <stdint.h>
+
+static inline uint16_t
+get_u16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t
+get_u24(const uint8_t *p)
+{
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static inline uint32_t
+get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint64_t
+get_u64(const uint8_t *p)
+{
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+#endif  //_MP4_BYTES_H_2018
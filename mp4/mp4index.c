@@ -0,0 +1,1658 @@
+#include "mp4index.h"
+#include "mp4be.h"
+#include "mp4bytes.h"
+#include "mp4indexpriv.h"
+#include "mp4walk.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+mp4_index_t *
+mp4_index_create(void)
+{
+    return calloc(1, sizeof(mp4_index_t));
+}
+
+void
+mp4_index_destroy(mp4_index_t *ctx)
+{
+    if (!ctx) {
+        return;
+    }
+    mp4_index_reset(ctx);
+    mp4_arena_free(&ctx->arena);
+    free(ctx);
+}
+
+void
+mp4_index_reset(mp4_index_t *ctx)
+{
+    if (ctx->cache_map) {
+        munmap(ctx->cache_map, ctx->cache_map_len);
+    }
+    mp4_arena_t arena = ctx->arena;
+    const int max_depth = ctx->max_depth;
+    const bool samples = ctx->samples;
+    mp4_arena_reset(&arena);
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->arena = arena;
+    ctx->max_depth = max_depth;
+    ctx->samples = samples;
+}
+
+void
+mp4_index_set_max_depth(mp4_index_t *ctx, int max_depth)
+{
+    ctx->max_depth = max_depth;
+}
+
+void
+mp4_index_set_samples(mp4_index_t *ctx, bool samples)
+{
+    ctx->samples = samples;
+}
+
+size_t
+mp4_index_track_num(const mp4_index_t *ctx)
+{
+    return ctx->trak_num;
+}
+
+const mp4_track_t *
+mp4_index_track(const mp4_index_t *ctx, size_t i)
+{
+    return i < ctx->trak_num ? &ctx->traks[i].track : NULL;
+}
+
+const mp4_track_t *
+mp4_index_track_by_id(const mp4_index_t *ctx, uint32_t track_id)
+{
+    for (size_t i = 0; i < ctx->trak_num; i++) {
+        if (ctx->traks[i].track.track_id == track_id) {
+            return &ctx->traks[i].track;
+        }
+    }
+    return NULL;
+}
+
+const mp4_track_t *
+mp4_index_track_by_handler(const mp4_index_t *ctx, const char *handler)
+{
+    for (size_t i = 0; i < ctx->trak_num; i++) {
+        if (strncmp(ctx->traks[i].track.handler, handler, 4) == 0) {
+            return &ctx->traks[i].track;
+        }
+    }
+    return NULL;
+}
+
+const mp4_track_t *
+mp4_index_default_track(const mp4_index_t *ctx)
+{
+    const mp4_track_t *track = mp4_index_track_by_handler(ctx, "vide");
+    if (track) {
+        return track;
+    }
+    for (size_t i = 0; i < ctx->trak_num; i++) {
+        if (ctx->traks[i].has_stss) {
+            return &ctx->traks[i].track;
+        }
+    }
+    return mp4_index_track(ctx, 0);
+}
+
+const mp4_keyframes_t *
+mp4_index_keyframes(const mp4_index_t *ctx)
+{
+    static const mp4_keyframes_t empty = {0};
+    const mp4_track_t *track = mp4_index_default_track(ctx);
+    return track ? &track->keyframes : &empty;
+}
+
+long
+mp4_keyframes_seek(const mp4_keyframes_t *keyframes, double time)
+{
+    if (keyframes->num == 0) {
+        return -1;
+    }
+
+    // first keyframe after time
+    size_t lo = 0;
+    size_t hi = keyframes->num;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keyframes->pts[mid] <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? (long)lo - 1 : 0;
+}
+
+const char *
+mp4_index_strerror(int err)
+{
+    switch (err) {
+    case MP4_INDEX_OK:
+        return "success";
+    case MP4_INDEX_ERR_NOMEM:
+        return "out of memory";
+    case MP4_INDEX_ERR_IO:
+        return "I/O error";
+    case MP4_INDEX_ERR_FORMAT:
+        return "malformed box";
+    case MP4_INDEX_ERR_NO_MOOV:
+        return "no moov box";
+    case MP4_INDEX_ERR_STALE:
+        return "stale or invalid index cache";
+    case MP4_INDEX_ERR_DEPTH:
+        return "boxes nested too deep";
+    default:
+        return "unknown error";
+    }
+}
+
+typedef int (*mp4_box_func)(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_moov(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_trak(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_mvhd(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_tkhd(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_mdhd(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_hdlr(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_stsd(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_stss(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_stts(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_ctts(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_elst(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_stsc(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_stsz(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_stz2(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_stco(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_co64(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_trex(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_traf(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_tfdt(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_trun(mp4_index_t *ctx, const uint8_t *p, size_t len);
+static int mp4_box_tfra(mp4_index_t *ctx, const uint8_t *p, size_t len);
+
+// Walker callbacks: moov, trak, traf and the plain containers are descended,
+// the boxes with a parser are handed to it
+static int
+mp4_box_enter(void *arg, const mp4_walk_box_t *box, const uint8_t **children, size_t *children_len)
+{
+    mp4_index_t *ctx = arg;
+    const uint8_t *type = box->type;
+    *children = box->data;
+    *children_len = box->len;
+
+    mp4_box_func func = NULL;
+    if (memcmp(type, "moov", 4) == 0
+        || memcmp(type, "trak", 4) == 0
+        || memcmp(type, "traf", 4) == 0) {
+        if (memcmp(type, "moov", 4) == 0) {
+            if (ctx->trak_depth != 0) {
+                // moov in moov
+                return MP4_INDEX_ERR_FORMAT;
+            }
+            func = mp4_box_moov;
+        } else if (memcmp(type, "trak", 4) == 0) {
+            // only the trak boxes that mp4_box_moov() counted: children of moov
+            if (ctx->trak_depth == 0 || box->depth != ctx->trak_depth) {
+                return MP4_INDEX_ERR_FORMAT;
+            }
+            func = mp4_box_trak;
+        } else {
+            func = mp4_box_traf;
+        }
+        int err = func(ctx, box->data, box->len);
+        if (err != MP4_INDEX_OK) {
+            return err;
+        }
+        if (memcmp(type, "moov", 4) == 0) {
+            ctx->trak_depth = box->depth + 1;
+        }
+        if (memcmp(type, "traf", 4) == 0) {
+            if (!ctx->cur_trak) {
+                // a track without trak box
+                return MP4_WALK_NEXT;
+            }
+            // tfhd was parsed by mp4_box_traf
+            const uint32_t tfhd_size = get_u32(box->data);
+            *children = box->data + tfhd_size;
+            *children_len = box->len - tfhd_size;
+        }
+        return MP4_WALK_DESCEND;
+    } else if (memcmp(type, "mvhd", 4) == 0) {
+        func = mp4_box_mvhd;
+    } else if (memcmp(type, "mdia", 4) == 0
+        || memcmp(type, "edts", 4) == 0
+        || memcmp(type, "minf", 4) == 0
+        || memcmp(type, "stbl", 4) == 0
+        || memcmp(type, "mvex", 4) == 0
+        || memcmp(type, "moof", 4) == 0
+        || memcmp(type, "mfra", 4) == 0) {
+        return MP4_WALK_DESCEND;
+    } else if (memcmp(type, "trex", 4) == 0) {
+        func = mp4_box_trex;
+    } else if (memcmp(type, "tfra", 4) == 0) {
+        func = mp4_box_tfra;
+    } else if (!ctx->cur_trak) {
+        // sample tables only mean something inside a trak or traf
+    } else if (memcmp(type, "tkhd", 4) == 0) {
+        func = mp4_box_tkhd;
+    } else if (memcmp(type, "mdhd", 4) == 0) {
+        func = mp4_box_mdhd;
+    } else if (memcmp(type, "hdlr", 4) == 0) {
+        func = mp4_box_hdlr;
+    } else if (memcmp(type, "stsd", 4) == 0) {
+        func = mp4_box_stsd;
+    } else if (memcmp(type, "stss", 4) == 0) {
+        func = mp4_box_stss;
+    } else if (memcmp(type, "stts", 4) == 0) {
+        func = mp4_box_stts;
+    } else if (memcmp(type, "ctts", 4) == 0) {
+        func = mp4_box_ctts;
+    } else if (memcmp(type, "elst", 4) == 0) {
+        func = mp4_box_elst;
+    } else if (memcmp(type, "stsc", 4) == 0) {
+        func = mp4_box_stsc;
+    } else if (memcmp(type, "stsz", 4) == 0) {
+        func = mp4_box_stsz;
+    } else if (memcmp(type, "stz2", 4) == 0) {
+        func = mp4_box_stz2;
+    } else if (memcmp(type, "stco", 4) == 0) {
+        func = mp4_box_stco;
+    } else if (memcmp(type, "co64", 4) == 0) {
+        func = mp4_box_co64;
+    } else if (memcmp(type, "tfdt", 4) == 0) {
+        func = mp4_box_tfdt;
+    } else if (memcmp(type, "trun", 4) == 0) {
+        func = mp4_box_trun;
+    }
+    if (func) {
+        int err = func(ctx, box->data, box->len);
+        if (err != MP4_INDEX_OK) {
+            return err;
+        }
+    }
+    return MP4_WALK_NEXT;
+}
+
+static int
+mp4_box_leave(void *arg, const mp4_walk_box_t *box)
+{
+    mp4_index_t *ctx = arg;
+    if (memcmp(box->type, "trak", 4) == 0 || memcmp(box->type, "traf", 4) == 0) {
+        ctx->cur_trak = NULL;
+    } else if (memcmp(box->type, "moov", 4) == 0) {
+        ctx->trak_depth = 0;
+    }
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box(mp4_index_t *ctx, const uint8_t *buf, size_t len)
+{
+    const mp4_walker_t walker = {
+        .max_depth = ctx->max_depth,
+        .enter = mp4_box_enter,
+        .leave = mp4_box_leave,
+        .arg = ctx,
+    };
+    return mp4_walk(&walker, buf, len);
+}
+
+// Count the trak boxes before they are walked, so every track gets its own
+// table set
+static int
+mp4_box_moov(mp4_index_t *ctx, const uint8_t *buf, size_t len)
+{
+    size_t trak_num = 0;
+    for (const uint8_t *p = buf; buf + len - p >= 8;) {
+        uint64_t box_size = get_u32(p);
+        if (box_size == 1 && buf + len - p >= 16) {
+            box_size = get_u64(p + 8);
+        } else if (box_size == 0) {
+            box_size = buf + len - p;
+        }
+        if (box_size < 8 || box_size > (uint64_t)(buf + len - p)) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        if (memcmp(p + 4, "trak", 4) == 0) {
+            trak_num++;
+        }
+        p += box_size;
+    }
+
+    ctx->traks = mp4_arena_calloc(&ctx->arena, trak_num, sizeof(*ctx->traks));
+    if (!ctx->traks && trak_num) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    ctx->trak_num = 0;
+    ctx->trak_cap = trak_num;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_trak(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    if (!ctx->traks || ctx->cur_trak || ctx->trak_num == ctx->trak_cap) {
+        // trak outside of moov, nested in another trak or not counted
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    // mp4_box_leave() clears it after the children
+    ctx->cur_trak = &ctx->traks[ctx->trak_num++];
+    return MP4_INDEX_OK;
+}
+
+// Sample sizes decoded at a time before they are summed
+#define MP4_TABLE_BLOCK 1024
+
+// Check a full box table of num entries of esize bytes starting at offset
+static bool
+mp4_table_fits(size_t len, size_t offset, uint32_t num, size_t esize)
+{
+    return len >= offset && (len - offset) / esize >= num;
+}
+
+static int
+mp4_box_mvhd(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    const size_t time_scale_offset = p[0] == 1 ? 20 : 12;
+    if (len < time_scale_offset + 4) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    ctx->movie_time_scale = get_u32(p + time_scale_offset);
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_tkhd(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    // version 1 has 64-bit creation and modification times
+    const size_t track_id_offset = p[0] == 1 ? 20 : 12;
+    if (len < track_id_offset + 4) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    ctx->cur_trak->track.track_id = get_u32(p + track_id_offset);
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_mdhd(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    const size_t time_scale_offset = p[0] == 1 ? 20 : 12;
+    if (len < time_scale_offset + 4) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    ctx->cur_trak->track.time_scale = get_u32(p + time_scale_offset);
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_hdlr(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    if (len < 12) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    memcpy(ctx->cur_trak->track.handler, p + 8, 4);
+    ctx->cur_trak->track.handler[4] = '\0';
+    return MP4_INDEX_OK;
+}
+
+// Codec of the first sample entry, and for avc1/hvc1 style entries the size
+// of the NAL unit length fields from the lengthSizeMinusOne of avcC or hvcC.
+// A sample entry the index does not understand is not an error.
+static int
+mp4_box_stsd(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_track_t *track = &ctx->cur_trak->track;
+    if (len < 16 || get_u32(p + 4) == 0) {
+        return MP4_INDEX_OK;
+    }
+    const uint8_t *entry = p + 8;
+    const uint64_t entry_size = get_u32(entry);
+    memcpy(track->codec, entry + 4, 4);
+    track->codec[4] = '\0';
+    // the boxes after the 78 bytes of a VisualSampleEntry
+    if (entry_size < 8 + 78 || entry_size > len - 8) {
+        return MP4_INDEX_OK;
+    }
+    const uint8_t *end = entry + entry_size;
+    for (const uint8_t *box = entry + 8 + 78; end - box >= 8;) {
+        const uint32_t box_size = get_u32(box);
+        if (box_size < 8 || box_size > (size_t)(end - box)) {
+            break;
+        }
+        if (memcmp(box + 4, "avcC", 4) == 0 && box_size >= 8 + 5) {
+            track->nal_length_size = (box[8 + 4] & 0x03) + 1;
+        } else if (memcmp(box + 4, "hvcC", 4) == 0 && box_size >= 8 + 22) {
+            track->nal_length_size = (box[8 + 21] & 0x03) + 1;
+        }
+        box += box_size;
+    }
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_stss(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, 4)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    trak->stss_entry_data = mp4_arena_array(&ctx->arena, num, sizeof(*trak->stss_entry_data));
+    if (!trak->stss_entry_data) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    trak->stss_entry_num = num;
+    trak->has_stss = true;
+    mp4_be32_decode((uint32_t *)trak->stss_entry_data, p + 8, num);
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_stts(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, 8)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    trak->stts_entry_data = mp4_arena_array(&ctx->arena, num, sizeof(*trak->stts_entry_data));
+    if (!trak->stts_entry_data) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    trak->stts_entry_num = num;
+    // count/duration pairs decode as one run of 32-bit values
+    mp4_be32_decode((uint32_t *)trak->stts_entry_data, p + 8, (size_t)num * 2);
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_ctts(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, 8)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    trak->ctts_entry_data = mp4_arena_array(&ctx->arena, num, sizeof(*trak->ctts_entry_data));
+    if (!trak->ctts_entry_data) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    trak->ctts_entry_num = num;
+    mp4_be32_decode((uint32_t *)trak->ctts_entry_data, p + 8, (size_t)num * 2);
+    return MP4_INDEX_OK;
+}
+
+// Only the start of the presentation is needed for keyframe times: the empty
+// edits at the beginning and the media time of the first real edit
+static int
+mp4_box_elst(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    const uint8_t version = p[0];
+    const size_t esize = version == 1 ? 20 : 12;
+    uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, esize)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    trak->has_elst = false;
+    trak->elst_empty_duration = 0;
+    for (uint32_t i = 0; i < num; i++) {
+        const uint8_t *entry = p + 8 + i * esize;
+        uint64_t segment_duration = version == 1 ? get_u64(entry) : get_u32(entry);
+        int64_t media_time = version == 1 ? (int64_t)get_u64(entry + 8) : (int32_t)get_u32(entry + 4);
+        if (media_time == -1) {
+            trak->elst_empty_duration += segment_duration;
+            continue;
+        }
+        trak->has_elst = true;
+        trak->elst_media_time = media_time;
+        break;
+    }
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_stsc(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, 12)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    trak->stsc_entry_data = mp4_arena_array(&ctx->arena, num, sizeof(*trak->stsc_entry_data));
+    if (!trak->stsc_entry_data) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    trak->stsc_entry_num = num;
+    for (uint32_t i = 0; i < num; i++) {
+        trak->stsc_entry_data[i].first_chunk = get_u32(p + 8 + 12 * i);
+        trak->stsc_entry_data[i].samples_per_chunk = get_u32(p + 8 + 12 * i + 4);
+    }
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_stsz(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 12) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint32_t sample_size = get_u32(p + 4);
+    uint32_t num = get_u32(p + 8);
+    trak->stsz_sample_size = sample_size;
+    trak->stsz_entry_num = num;
+    if (sample_size != 0) {
+        return MP4_INDEX_OK;
+    }
+    if (!mp4_table_fits(len, 12, num, 4)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    uint64_t *prefix = mp4_arena_array(&ctx->arena, (size_t)num + 1, sizeof(*prefix));
+    if (!prefix) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    // decoded a block at a time, then summed
+    uint32_t block[MP4_TABLE_BLOCK];
+    uint64_t total = 0;
+    prefix[0] = 0;
+    for (uint32_t i = 0; i < num; i += MP4_TABLE_BLOCK) {
+        const uint32_t n = num - i < MP4_TABLE_BLOCK ? num - i : MP4_TABLE_BLOCK;
+        mp4_be32_decode(block, p + 12 + (size_t)i * 4, n);
+        for (uint32_t j = 0; j < n; j++) {
+            total += block[j];
+            prefix[i + j + 1] = total;
+        }
+    }
+    trak->stsz_size_prefix = prefix;
+    return MP4_INDEX_OK;
+}
+
+// Compact sample sizes: 4, 8 or 16 bits per entry
+static int
+mp4_box_stz2(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 12) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint8_t field_size = p[7];
+    uint32_t num = get_u32(p + 8);
+    if ((field_size != 4 && field_size != 8 && field_size != 16)
+        || (len - 12) * 8 / field_size < num) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    uint64_t *prefix = mp4_arena_array(&ctx->arena, (size_t)num + 1, sizeof(*prefix));
+    if (!prefix) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    const uint8_t *table = p + 12;
+    prefix[0] = 0;
+    for (uint32_t i = 0; i < num; i++) {
+        uint32_t size;
+        if (field_size == 4) {
+            size = (i & 1) ? (table[i / 2] & 0x0f) : (table[i / 2] >> 4);
+        } else if (field_size == 8) {
+            size = table[i];
+        } else {
+            size = get_u16(table + i * 2);
+        }
+        prefix[i + 1] = prefix[i] + size;
+    }
+    trak->stsz_sample_size = 0;
+    trak->stsz_entry_num = num;
+    trak->stsz_size_prefix = prefix;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_stco(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, 4)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    trak->stco_entry_data = mp4_arena_array(&ctx->arena, num, sizeof(*trak->stco_entry_data));
+    if (!trak->stco_entry_data) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    trak->stco_entry_num = num;
+    mp4_be32_decode_u64((uint64_t *)trak->stco_entry_data, p + 8, num);
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_co64(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, 8)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    trak->stco_entry_data = mp4_arena_array(&ctx->arena, num, sizeof(*trak->stco_entry_data));
+    if (!trak->stco_entry_data) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    trak->stco_entry_num = num;
+    mp4_be64_decode((uint64_t *)trak->stco_entry_data, p + 8, num);
+    return MP4_INDEX_OK;
+}
+
+static mp4_trak_t *
+mp4_trak_by_id(mp4_index_t *ctx, uint32_t track_id)
+{
+    for (size_t i = 0; i < ctx->trak_num; i++) {
+        if (ctx->traks[i].track.track_id == track_id) {
+            return &ctx->traks[i];
+        }
+    }
+    return NULL;
+}
+
+// Presentation time in seconds of a sample decoded at decode_time (track time
+// scale): decode + composition offset - first edit media time, after the empty edits
+static double
+mp4_trak_pts(const mp4_index_t *ctx, const mp4_trak_t *trak, uint64_t decode_time, int64_t composition_offset)
+{
+    if (!trak->track.time_scale) {
+        return 0;
+    }
+    const int64_t media_time = trak->has_elst ? trak->elst_media_time : 0;
+    double pts = (double)((int64_t)decode_time + composition_offset - media_time) / trak->track.time_scale;
+    if (trak->elst_empty_duration && ctx->movie_time_scale) {
+        pts += (double)trak->elst_empty_duration / ctx->movie_time_scale;
+    }
+    return pts;
+}
+
+static double
+mp4_trak_dts(const mp4_trak_t *trak, uint64_t decode_time)
+{
+    return trak->track.time_scale ? (double)decode_time / trak->track.time_scale : 0;
+}
+
+// Make room for num keyframes, keeping the ones already found
+static int
+mp4_keyframes_reserve(mp4_index_t *ctx, mp4_trak_t *trak, size_t num)
+{
+    if (num <= trak->keyframes_cap) {
+        return MP4_INDEX_OK;
+    }
+    size_t cap = trak->keyframes_cap * 2;
+    if (cap < num) {
+        cap = num;
+    }
+
+    double *dts = mp4_arena_array(&ctx->arena, cap, sizeof(*dts));
+    double *pts = mp4_arena_array(&ctx->arena, cap, sizeof(*pts));
+    uint64_t *offset = mp4_arena_array(&ctx->arena, cap, sizeof(*offset));
+    uint32_t *sample = mp4_arena_array(&ctx->arena, cap, sizeof(*sample));
+    if (!dts || !pts || !offset || !sample) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    const size_t old_num = trak->track.keyframes.num;
+    if (old_num) {
+        memcpy(dts, trak->keyframes_dts, old_num * sizeof(*dts));
+        memcpy(pts, trak->keyframes_pts, old_num * sizeof(*pts));
+        memcpy(offset, trak->keyframes_offset, old_num * sizeof(*offset));
+        memcpy(sample, trak->keyframes_sample, old_num * sizeof(*sample));
+    }
+
+    trak->keyframes_cap = cap;
+    trak->track.keyframes.dts = trak->keyframes_dts = dts;
+    trak->track.keyframes.pts = trak->keyframes_pts = pts;
+    trak->track.keyframes.offset = trak->keyframes_offset = offset;
+    trak->track.keyframes.sample = trak->keyframes_sample = sample;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_keyframes_append(mp4_index_t *ctx, mp4_trak_t *trak, double dts, double pts, uint64_t offset, uint32_t sample)
+{
+    const size_t i = trak->track.keyframes.num;
+    int err = mp4_keyframes_reserve(ctx, trak, i + 1);
+    if (err != MP4_INDEX_OK) {
+        return err;
+    }
+    trak->keyframes_dts[i] = dts;
+    trak->keyframes_pts[i] = pts;
+    trak->keyframes_offset[i] = offset;
+    trak->keyframes_sample[i] = sample;
+    trak->track.keyframes.num = i + 1;
+    return MP4_INDEX_OK;
+}
+
+// A column of cap entries of esize bytes in the arena, starting with the num
+// entries of old
+static void *
+mp4_column_grow(mp4_index_t *ctx, const void *old, size_t num, size_t cap, size_t esize)
+{
+    void *column = mp4_arena_array(&ctx->arena, cap, esize);
+    if (column && num) {
+        memcpy(column, old, num * esize);
+    }
+    return column;
+}
+
+// Make room for num samples, keeping the ones already recorded
+static int
+mp4_samples_reserve(mp4_index_t *ctx, mp4_trak_t *trak, size_t num)
+{
+    if (num <= trak->samples_cap) {
+        return MP4_INDEX_OK;
+    }
+    size_t cap = trak->samples_cap * 2;
+    if (cap < num) {
+        cap = num;
+    }
+
+    const size_t old_num = trak->track.samples.num;
+    uint64_t *offset = mp4_column_grow(ctx, trak->samples_offset, old_num, cap, sizeof(*offset));
+    uint32_t *size = mp4_column_grow(ctx, trak->samples_size, old_num, cap, sizeof(*size));
+    uint64_t *dts = mp4_column_grow(ctx, trak->samples_dts, old_num, cap, sizeof(*dts));
+    int32_t *cts_offset = mp4_column_grow(ctx, trak->samples_cts_offset, old_num, cap, sizeof(*cts_offset));
+    uint32_t *chunk = mp4_column_grow(ctx, trak->samples_chunk, old_num, cap, sizeof(*chunk));
+    uint8_t *sync = mp4_column_grow(ctx, trak->samples_sync, old_num, cap, sizeof(*sync));
+    if (!offset || !size || !dts || !cts_offset || !chunk || !sync) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+
+    trak->samples_cap = cap;
+    trak->track.samples.offset = trak->samples_offset = offset;
+    trak->track.samples.size = trak->samples_size = size;
+    trak->track.samples.dts = trak->samples_dts = dts;
+    trak->track.samples.cts_offset = trak->samples_cts_offset = cts_offset;
+    trak->track.samples.chunk = trak->samples_chunk = chunk;
+    trak->track.samples.sync = trak->samples_sync = sync;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_trex(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    if (len < 24) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    mp4_trak_t *trak = mp4_trak_by_id(ctx, get_u32(p + 4));
+    if (!trak) {
+        return MP4_INDEX_OK;
+    }
+    trak->has_trex = true;
+    trak->trex_sample_duration = get_u32(p + 12);
+    trak->trex_sample_size = get_u32(p + 16);
+    trak->trex_sample_flags = get_u32(p + 20);
+    return MP4_INDEX_OK;
+}
+
+#define MP4_TFHD_BASE_DATA_OFFSET 0x000001
+#define MP4_TFHD_SAMPLE_DESCRIPTION_INDEX 0x000002
+#define MP4_TFHD_DEFAULT_SAMPLE_DURATION 0x000008
+#define MP4_TFHD_DEFAULT_SAMPLE_SIZE 0x000010
+#define MP4_TFHD_DEFAULT_SAMPLE_FLAGS 0x000020
+#define MP4_TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+
+#define MP4_TRUN_DATA_OFFSET 0x000001
+#define MP4_TRUN_FIRST_SAMPLE_FLAGS 0x000004
+#define MP4_TRUN_SAMPLE_DURATION 0x000100
+#define MP4_TRUN_SAMPLE_SIZE 0x000200
+#define MP4_TRUN_SAMPLE_FLAGS 0x000400
+#define MP4_TRUN_SAMPLE_COMPOSITION_TIME_OFFSET 0x000800
+
+#define MP4_SAMPLE_IS_NON_SYNC 0x00010000
+
+// tfhd comes first in a traf and names its track; the defaults it does not
+// carry come from trex
+static int
+mp4_box_traf(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    if (ctx->cur_trak) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    if (len < 16 || memcmp(p + 4, "tfhd", 4) != 0) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint32_t tfhd_size = get_u32(p);
+    if (tfhd_size < 16 || tfhd_size > len) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint8_t *tfhd = p + 8;
+    const uint32_t flags = get_u24(tfhd + 1);
+    size_t tfhd_len = 8;
+    tfhd_len += flags & MP4_TFHD_BASE_DATA_OFFSET ? 8 : 0;
+    tfhd_len += flags & MP4_TFHD_SAMPLE_DESCRIPTION_INDEX ? 4 : 0;
+    tfhd_len += flags & MP4_TFHD_DEFAULT_SAMPLE_DURATION ? 4 : 0;
+    tfhd_len += flags & MP4_TFHD_DEFAULT_SAMPLE_SIZE ? 4 : 0;
+    tfhd_len += flags & MP4_TFHD_DEFAULT_SAMPLE_FLAGS ? 4 : 0;
+    if (tfhd_size - 8 < tfhd_len) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    ctx->traf_num++;
+    ctx->trun_num = 0;
+    ctx->traf_has_tfdt = false;
+    mp4_trak_t *trak = mp4_trak_by_id(ctx, get_u32(tfhd + 4));
+    const uint8_t *field = tfhd + 8;
+    if (flags & MP4_TFHD_BASE_DATA_OFFSET) {
+        ctx->traf_base_offset = get_u64(field);
+        field += 8;
+    } else if (flags & MP4_TFHD_DEFAULT_BASE_IS_MOOF) {
+        ctx->traf_base_offset = ctx->moof_offset;
+    } else {
+        // the moof for the first traf, else the end of the previous traf data
+        ctx->traf_base_offset = ctx->traf_data_offset;
+    }
+    ctx->traf_data_offset = ctx->traf_base_offset;
+    if (!trak) {
+        return MP4_INDEX_OK;
+    }
+    if (flags & MP4_TFHD_SAMPLE_DESCRIPTION_INDEX) {
+        field += 4;
+    }
+    ctx->traf_sample_duration = trak->trex_sample_duration;
+    if (flags & MP4_TFHD_DEFAULT_SAMPLE_DURATION) {
+        ctx->traf_sample_duration = get_u32(field);
+        field += 4;
+    }
+    ctx->traf_sample_size = trak->trex_sample_size;
+    if (flags & MP4_TFHD_DEFAULT_SAMPLE_SIZE) {
+        ctx->traf_sample_size = get_u32(field);
+        field += 4;
+    }
+    ctx->traf_sample_flags = trak->trex_sample_flags;
+    if (flags & MP4_TFHD_DEFAULT_SAMPLE_FLAGS) {
+        ctx->traf_sample_flags = get_u32(field);
+    }
+
+    // the boxes after tfhd are walked next, mp4_box_leave() clears it
+    ctx->cur_trak = trak;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_box_tfdt(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    const size_t need = p[0] == 1 ? 12 : 8;
+    if (len < need) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    ctx->cur_trak->frag_decode_time = p[0] == 1 ? get_u64(p + 4) : get_u32(p + 4);
+    ctx->traf_has_tfdt = true;
+    return MP4_INDEX_OK;
+}
+
+// Resolve the pending tfra entries of trak that name the given 1-based
+// sample of the current trun to that sample: its file offset and, when the
+// traf gave its decode time, its decode and presentation times
+static void
+mp4_tfra_resolve(mp4_index_t *ctx, mp4_trak_t *trak, uint32_t sample, uint64_t offset, int64_t composition_offset)
+{
+    while (trak->tfra_next < trak->tfra_num) {
+        const size_t k = trak->tfra_first + trak->tfra_next;
+        if (trak->keyframes_offset[k] != ctx->moof_offset || trak->tfra_entry_data[trak->tfra_next].traf_number != ctx->traf_num
+            || trak->tfra_entry_data[trak->tfra_next].trun_number != ctx->trun_num || trak->tfra_entry_data[trak->tfra_next].sample_number != sample) {
+            return;
+        }
+        trak->keyframes_offset[k] = offset;
+        if (ctx->traf_has_tfdt) {
+            trak->keyframes_dts[k] = mp4_trak_dts(trak, trak->frag_decode_time);
+            trak->keyframes_pts[k] = mp4_trak_pts(ctx, trak, trak->frag_decode_time, composition_offset);
+        }
+        trak->tfra_next++;
+    }
+}
+
+// Most samples of a track from truns without per-sample fields whose bytes
+// cannot be checked against the file
+#define MP4_TRUN_SIZELESS_MAX (1 << 20)
+
+static int
+mp4_box_trun(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    mp4_trak_t *trak = ctx->cur_trak;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    const uint32_t flags = get_u24(p + 1);
+    const uint32_t num = get_u32(p + 4);
+    size_t entry_offset = 8;
+    uint64_t data_offset = ctx->traf_data_offset;
+    if (flags & MP4_TRUN_DATA_OFFSET) {
+        if (len < entry_offset + 4) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        data_offset = ctx->traf_base_offset + (int32_t)get_u32(p + entry_offset);
+        entry_offset += 4;
+    }
+    uint32_t first_sample_flags = ctx->traf_sample_flags;
+    if (flags & MP4_TRUN_FIRST_SAMPLE_FLAGS) {
+        if (len < entry_offset + 4) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        first_sample_flags = get_u32(p + entry_offset);
+        entry_offset += 4;
+    }
+    size_t esize = 0;
+    esize += flags & MP4_TRUN_SAMPLE_DURATION ? 4 : 0;
+    esize += flags & MP4_TRUN_SAMPLE_SIZE ? 4 : 0;
+    esize += flags & MP4_TRUN_SAMPLE_FLAGS ? 4 : 0;
+    esize += flags & MP4_TRUN_SAMPLE_COMPOSITION_TIME_OFFSET ? 4 : 0;
+    if (esize && !mp4_table_fits(len, entry_offset, num, esize)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    // a trun without per-sample fields costs 8 bytes for any count: the
+    // samples of all such truns of a track must fit in the file when their
+    // size and the file size are known, else stay under a limit in total
+    if (esize == 0 && ctx->file_size && ctx->traf_sample_size) {
+        const uint64_t bytes = (uint64_t)num * ctx->traf_sample_size;
+        if (data_offset > ctx->file_size || bytes > ctx->file_size - data_offset || bytes > ctx->file_size - trak->frag_default_bytes) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        trak->frag_default_bytes += bytes;
+    } else if (esize == 0) {
+        if (num > MP4_TRUN_SIZELESS_MAX - trak->frag_sizeless_num) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        trak->frag_sizeless_num += num;
+    }
+    ctx->trun_num++;
+    if (ctx->samples) {
+        int err = mp4_samples_reserve(ctx, trak, trak->track.samples.num + num);
+        if (err != MP4_INDEX_OK) {
+            return err;
+        }
+    }
+    const uint32_t chunk = trak->stco_entry_num + ++trak->frag_trun_num;
+
+    const uint8_t *entry = p + entry_offset;
+    for (uint32_t i = 0; i < num; i++) {
+        uint32_t sample_duration = ctx->traf_sample_duration;
+        uint32_t sample_size = ctx->traf_sample_size;
+        uint32_t sample_flags = i == 0 ? first_sample_flags : ctx->traf_sample_flags;
+        int64_t composition_offset = 0;
+        if (flags & MP4_TRUN_SAMPLE_DURATION) {
+            sample_duration = get_u32(entry);
+            entry += 4;
+        }
+        if (flags & MP4_TRUN_SAMPLE_SIZE) {
+            sample_size = get_u32(entry);
+            entry += 4;
+        }
+        if (flags & MP4_TRUN_SAMPLE_FLAGS) {
+            sample_flags = get_u32(entry);
+            entry += 4;
+        }
+        if (flags & MP4_TRUN_SAMPLE_COMPOSITION_TIME_OFFSET) {
+            // signed in version 1, and in version 0 as written in practice
+            composition_offset = (int32_t)get_u32(entry);
+            entry += 4;
+        }
+
+        if (ctx->samples) {
+            const size_t n = trak->track.samples.num++;
+            trak->samples_offset[n] = data_offset;
+            trak->samples_size[n] = sample_size;
+            trak->samples_dts[n] = trak->frag_decode_time;
+            trak->samples_cts_offset[n] = composition_offset;
+            trak->samples_chunk[n] = chunk;
+            trak->samples_sync[n] = !(sample_flags & MP4_SAMPLE_IS_NON_SYNC);
+        }
+        trak->frag_sample_num++;
+        if (trak->has_tfra) {
+            mp4_tfra_resolve(ctx, trak, i + 1, data_offset, composition_offset);
+        } else if (!(sample_flags & MP4_SAMPLE_IS_NON_SYNC)) {
+            int err = mp4_keyframes_append(ctx, trak, mp4_trak_dts(trak, trak->frag_decode_time),
+                mp4_trak_pts(ctx, trak, trak->frag_decode_time, composition_offset), data_offset, trak->frag_sample_num);
+            if (err != MP4_INDEX_OK) {
+                return err;
+            }
+        }
+        trak->frag_decode_time += sample_duration;
+        data_offset += sample_size;
+    }
+    ctx->traf_data_offset = data_offset;
+    return MP4_INDEX_OK;
+}
+
+// Big-endian field of 1 to 4 bytes
+static uint32_t
+mp4_get_un(const uint8_t *p, int n)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+// tfra lists the sync samples of a track by time and moof offset, and by
+// their traf, trun and sample number in that moof. The keyframes start out at
+// the moof offset with the tfra time as dts and pts, and sample 0; the walk of
+// the moof by mp4_index_add_fragment() then resolves them to their sample.
+static int
+mp4_box_tfra(mp4_index_t *ctx, const uint8_t *p, size_t len)
+{
+    if (len < 16) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint8_t version = p[0];
+    const uint32_t lengths = get_u32(p + 8);
+    const uint32_t num = get_u32(p + 12);
+    const int traf_size = ((lengths >> 4) & 3) + 1;
+    const int trun_size = ((lengths >> 2) & 3) + 1;
+    const int sample_size = (lengths & 3) + 1;
+    const size_t esize = (version == 1 ? 16 : 8) + traf_size + trun_size + sample_size;
+    if (!mp4_table_fits(len, 16, num, esize)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    mp4_trak_t *trak = mp4_trak_by_id(ctx, get_u32(p + 4));
+    if (!trak || trak->has_tfra) {
+        return MP4_INDEX_OK;
+    }
+
+    trak->tfra_entry_data = mp4_arena_array(&ctx->arena, num ? num : 1, sizeof(*trak->tfra_entry_data));
+    if (!trak->tfra_entry_data) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    trak->tfra_first = trak->track.keyframes.num;
+    trak->tfra_num = num;
+    trak->tfra_next = 0;
+    int err = mp4_keyframes_reserve(ctx, trak, trak->track.keyframes.num + num);
+    for (uint32_t i = 0; err == MP4_INDEX_OK && i < num; i++) {
+        const uint8_t *entry = p + 16 + (size_t)i * esize;
+        const uint64_t time = version == 1 ? get_u64(entry) : get_u32(entry);
+        const uint64_t moof_offset = version == 1 ? get_u64(entry + 8) : get_u32(entry + 4);
+        entry += version == 1 ? 16 : 8;
+        trak->tfra_entry_data[i].traf_number = mp4_get_un(entry, traf_size);
+        trak->tfra_entry_data[i].trun_number = mp4_get_un(entry + traf_size, trun_size);
+        trak->tfra_entry_data[i].sample_number = mp4_get_un(entry + traf_size + trun_size, sample_size);
+        err = mp4_keyframes_append(ctx, trak, mp4_trak_dts(trak, time), mp4_trak_pts(ctx, trak, time, 0), moof_offset, 0);
+    }
+    trak->has_tfra = true;
+    return err;
+}
+
+// O(1) with the stsz prefix sums
+uint64_t
+mp4_samples_size(const mp4_trak_t *trak, uint32_t first, uint32_t last)
+{
+    if (last <= first) {
+        return 0;
+    }
+    if (trak->stsz_sample_size) {
+        return (uint64_t)trak->stsz_sample_size * (last - first);
+    }
+    if (!trak->stsz_size_prefix || last - 1 > trak->stsz_entry_num) {
+        return 0;
+    }
+    return trak->stsz_size_prefix[last - 1] - trak->stsz_size_prefix[first - 1];
+}
+
+static int
+mp4_keyframes_resolve(mp4_index_t *ctx, mp4_trak_t *trak)
+{
+    const size_t num = trak->has_stss ? trak->stss_entry_num : trak->stsz_entry_num;
+    int err = mp4_keyframes_reserve(ctx, trak, num);
+    if (err != MP4_INDEX_OK) {
+        return err;
+    }
+    double *dts = trak->keyframes_dts;
+    double *pts = trak->keyframes_pts;
+    uint64_t *offset = trak->keyframes_offset;
+    uint32_t *sample = trak->keyframes_sample;
+
+    // stss is sorted, so stts (time-to-sample), ctts (composition offset),
+    // stsc (sample-to-chunk) and stco (chunk offset) are walked forward together
+    // with it, and stsz (sample size) is answered from prefix sums:
+    // O(keyframes + entries)
+    uint32_t stts_idx = 0;
+    uint32_t stts_count = 0;     // samples before stts_entry_data[stts_idx]
+    uint64_t stts_duration = 0;  // duration before stts_entry_data[stts_idx]
+    uint32_t ctts_idx = 0;
+    uint32_t ctts_count = 0;  // samples before ctts_entry_data[ctts_idx]
+    uint32_t stsc_idx = 0;
+    uint32_t stsc_sample = 0;  // samples before stsc_entry_data[stsc_idx]
+    for (size_t i = 0; i < num; i++) {
+        const uint32_t sync_sample = trak->has_stss ? trak->stss_entry_data[i].sync_sample : i + 1;
+        sample[i] = sync_sample;
+        dts[i] = 0;
+        pts[i] = 0;
+        offset[i] = 0;
+        if (sync_sample == 0) {
+            continue;
+        }
+
+        while (stts_idx < trak->stts_entry_num && stts_count + trak->stts_entry_data[stts_idx].sample_count < sync_sample) {
+            stts_count += trak->stts_entry_data[stts_idx].sample_count;
+            stts_duration += (uint64_t)trak->stts_entry_data[stts_idx].sample_count * trak->stts_entry_data[stts_idx].sample_duration;
+            stts_idx++;
+        }
+        uint64_t sync_sample_duration = stts_duration;
+        if (stts_idx < trak->stts_entry_num) {
+            sync_sample_duration += (uint64_t)(sync_sample - 1 - stts_count) * trak->stts_entry_data[stts_idx].sample_duration;
+        }
+
+        while (ctts_idx < trak->ctts_entry_num && ctts_count + trak->ctts_entry_data[ctts_idx].sample_count < sync_sample) {
+            ctts_count += trak->ctts_entry_data[ctts_idx].sample_count;
+            ctts_idx++;
+        }
+        int64_t composition_offset = 0;
+        if (ctts_idx < trak->ctts_entry_num) {
+            composition_offset = trak->ctts_entry_data[ctts_idx].sample_offset;
+        }
+
+        dts[i] = mp4_trak_dts(trak, sync_sample_duration);
+        pts[i] = mp4_trak_pts(ctx, trak, sync_sample_duration, composition_offset);
+
+        uint32_t sync_chunk = 0;
+        uint32_t chunk_first_sample = 0;
+        for (; stsc_idx < trak->stsc_entry_num; stsc_idx++) {
+            uint32_t next_stsc_first_chunk = trak->stco_entry_num + 1;
+            if (stsc_idx < trak->stsc_entry_num - 1) {
+                next_stsc_first_chunk = trak->stsc_entry_data[stsc_idx + 1].first_chunk;
+            }
+
+            uint32_t cur_sample = trak->stsc_entry_data[stsc_idx].samples_per_chunk * (next_stsc_first_chunk - trak->stsc_entry_data[stsc_idx].first_chunk);
+            if (stsc_sample + cur_sample >= sync_sample) {
+                const uint32_t chunk_idx = (sync_sample - stsc_sample - 1) / trak->stsc_entry_data[stsc_idx].samples_per_chunk;
+                sync_chunk = trak->stsc_entry_data[stsc_idx].first_chunk + chunk_idx;
+                chunk_first_sample = stsc_sample + chunk_idx * trak->stsc_entry_data[stsc_idx].samples_per_chunk + 1;
+                break;
+            }
+            stsc_sample += cur_sample;
+        }
+
+        if (sync_chunk > 0 && sync_chunk <= trak->stco_entry_num) {
+            // the sync sample follows the samples before it in its chunk
+            offset[i] = trak->stco_entry_data[sync_chunk - 1].chunk_offset + mp4_samples_size(trak, chunk_first_sample, sync_sample);
+        }
+    }
+    trak->track.keyframes.num = num;
+
+    // movie fragments continue after the samples of the moov
+    for (; stts_idx < trak->stts_entry_num; stts_idx++) {
+        stts_count += trak->stts_entry_data[stts_idx].sample_count;
+        stts_duration += (uint64_t)trak->stts_entry_data[stts_idx].sample_count * trak->stts_entry_data[stts_idx].sample_duration;
+    }
+    trak->frag_sample_num = stts_count;
+    trak->frag_decode_time = stts_duration;
+    return MP4_INDEX_OK;
+}
+
+// Every sample of the stbl tables: the chunks of each stsc run in turn, and
+// the samples of a chunk one after the other from its stco offset. The stts
+// and ctts runs and the sorted stss entries are stepped through alongside,
+// so each table is read once. Samples the chunk tables do not reach are left
+// out.
+static int
+mp4_samples_resolve(mp4_index_t *ctx, mp4_trak_t *trak)
+{
+    const uint32_t num = trak->stsz_entry_num;
+    if (trak->stsz_sample_size == 0 && !trak->stsz_size_prefix) {
+        return MP4_INDEX_OK;
+    }
+    int err = mp4_samples_reserve(ctx, trak, num);
+    if (err != MP4_INDEX_OK) {
+        return err;
+    }
+    uint64_t *offset = trak->samples_offset;
+    uint32_t *size = trak->samples_size;
+    uint64_t *dts = trak->samples_dts;
+    int32_t *cts_offset = trak->samples_cts_offset;
+    uint32_t *chunks = trak->samples_chunk;
+    uint8_t *sync = trak->samples_sync;
+
+    uint32_t stts_idx = 0;
+    uint32_t stts_left = 0;  // samples left in stts_entry_data[stts_idx]
+    uint64_t decode_time = 0;
+    uint32_t ctts_idx = 0;
+    uint32_t ctts_left = 0;  // samples left in ctts_entry_data[ctts_idx]
+    uint32_t stss_idx = 0;
+
+    uint32_t sample = 0;
+    for (uint32_t i = 0; i < trak->stsc_entry_num && sample < num; i++) {
+        const uint32_t samples_per_chunk = trak->stsc_entry_data[i].samples_per_chunk;
+        uint32_t last_chunk = trak->stco_entry_num;
+        if (i + 1 < trak->stsc_entry_num && trak->stsc_entry_data[i + 1].first_chunk - 1 < last_chunk) {
+            last_chunk = trak->stsc_entry_data[i + 1].first_chunk - 1;
+        }
+        for (uint32_t chunk = trak->stsc_entry_data[i].first_chunk; chunk >= 1 && chunk <= last_chunk && sample < num; chunk++) {
+            uint64_t chunk_offset = trak->stco_entry_data[chunk - 1].chunk_offset;
+            for (uint32_t j = 0; j < samples_per_chunk && sample < num; j++, sample++) {
+                const uint32_t sample_size = trak->stsz_sample_size ? trak->stsz_sample_size
+                                                                    : trak->stsz_size_prefix[sample + 1] - trak->stsz_size_prefix[sample];
+                offset[sample] = chunk_offset;
+                size[sample] = sample_size;
+                chunks[sample] = chunk;
+                chunk_offset += sample_size;
+
+                while (stts_left == 0 && stts_idx < trak->stts_entry_num) {
+                    stts_left = trak->stts_entry_data[stts_idx++].sample_count;
+                }
+                dts[sample] = decode_time;
+                if (stts_left) {
+                    decode_time += trak->stts_entry_data[stts_idx - 1].sample_duration;
+                    stts_left--;
+                }
+
+                while (ctts_left == 0 && ctts_idx < trak->ctts_entry_num) {
+                    ctts_left = trak->ctts_entry_data[ctts_idx++].sample_count;
+                }
+                cts_offset[sample] = 0;
+                if (ctts_left) {
+                    cts_offset[sample] = trak->ctts_entry_data[ctts_idx - 1].sample_offset;
+                    ctts_left--;
+                }
+
+                // stss numbers samples from 1
+                sync[sample] = !trak->has_stss;
+                while (stss_idx < trak->stss_entry_num && trak->stss_entry_data[stss_idx].sync_sample <= sample + 1) {
+                    sync[sample] |= trak->stss_entry_data[stss_idx++].sync_sample == sample + 1;
+                }
+            }
+        }
+    }
+    trak->track.samples.num = sample;
+    return MP4_INDEX_OK;
+}
+
+int
+mp4_index_build(const uint8_t *moov, size_t len, mp4_index_t *ctx)
+{
+    mp4_index_reset(ctx);
+
+    int err = mp4_box(ctx, moov, len);
+    for (size_t i = 0; err == MP4_INDEX_OK && i < ctx->trak_num; i++) {
+        err = mp4_keyframes_resolve(ctx, &ctx->traks[i]);
+        if (err == MP4_INDEX_OK) {
+            err = mp4_lookup_resolve(ctx, &ctx->traks[i]);
+        }
+        if (err == MP4_INDEX_OK && ctx->samples) {
+            err = mp4_samples_resolve(ctx, &ctx->traks[i]);
+        }
+    }
+    return err;
+}
+
+int
+mp4_index_add_fragment(mp4_index_t *ctx, const uint8_t *moof, size_t len, uint64_t moof_offset)
+{
+    ctx->moof_offset = moof_offset;
+    ctx->traf_data_offset = moof_offset;
+    ctx->traf_num = 0;
+    return mp4_box(ctx, moof, len);
+}
+
+void
+mp4_index_set_file_size(mp4_index_t *ctx, uint64_t file_size)
+{
+    ctx->file_size = file_size;
+}
+
+int
+mp4_index_add_mfra(mp4_index_t *ctx, const uint8_t *mfra, size_t len)
+{
+    return mp4_box(ctx, mfra, len);
+}
+
+static bool
+pread_full(int fd, uint8_t *buf, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Read the 8/16-byte header of the top-level box at offset: its type, and its
+// size with the header included
+static int
+mp4_top_box(int fd, uint64_t file_size, uint64_t offset, uint8_t type[4], uint64_t *box_size)
+{
+    uint8_t header[16];
+    if (!pread_full(fd, header, 8, offset)) {
+        return MP4_INDEX_ERR_IO;
+    }
+
+    uint64_t size = get_u32(header);
+    uint64_t header_size = 8;
+    if (size == 1) {
+        if (offset + 16 > file_size) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        if (!pread_full(fd, header + 8, 8, offset + 8)) {
+            return MP4_INDEX_ERR_IO;
+        }
+        size = get_u64(header + 8);
+        header_size = 16;
+    } else if (size == 0) {
+        // box extends to the end of the file
+        size = file_size - offset;
+    }
+    if (size < header_size || size > file_size - offset) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    memcpy(type, header + 4, 4);
+    *box_size = size;
+    return MP4_INDEX_OK;
+}
+
+// Read a whole top-level box into a malloc'ed buffer
+static int
+mp4_top_box_load(int fd, uint64_t offset, uint64_t box_size, uint8_t **buf)
+{
+    if (box_size > SIZE_MAX) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    *buf = malloc(box_size);
+    if (!*buf) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    if (!pread_full(fd, *buf, box_size, offset)) {
+        free(*buf);
+        *buf = NULL;
+        return MP4_INDEX_ERR_IO;
+    }
+    return MP4_INDEX_OK;
+}
+
+// Walk the top-level boxes by their 8/16-byte headers only and load the moov
+// box. mdat, free, skip and everything else is stepped over by size, so memory
+// tracks the moov size instead of the file size, wherever moov is placed.
+static int
+mp4_moov_load(int fd, uint64_t file_size, uint8_t **moov, size_t *moov_len, uint64_t *moov_offset)
+{
+    uint64_t offset = 0;
+
+    while (offset + 8 <= file_size) {
+        uint8_t type[4];
+        uint64_t box_size = 0;
+        int err = mp4_top_box(fd, file_size, offset, type, &box_size);
+        if (err != MP4_INDEX_OK) {
+            return err;
+        }
+
+        if (memcmp(type, "moov", 4) == 0) {
+            err = mp4_top_box_load(fd, offset, box_size, moov);
+            if (err == MP4_INDEX_OK) {
+                *moov_len = box_size;
+                *moov_offset = offset;
+            }
+            return err;
+        }
+
+        offset += box_size;
+    }
+
+    return MP4_INDEX_ERR_NO_MOOV;
+}
+
+// The mfra box ends the file and its last box, mfro, records its size
+static int
+mp4_mfra_load(int fd, uint64_t file_size, mp4_index_t *ctx)
+{
+    uint8_t mfro[16];
+    if (file_size < sizeof(mfro) || !pread_full(fd, mfro, sizeof(mfro), file_size - sizeof(mfro))) {
+        return MP4_INDEX_ERR_IO;
+    }
+    const uint64_t mfra_size = get_u32(mfro + 12);
+    if (get_u32(mfro) != sizeof(mfro) || memcmp(mfro + 4, "mfro", 4) != 0 || mfra_size < 8 + sizeof(mfro) || mfra_size > file_size) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+
+    uint8_t type[4];
+    uint64_t box_size = 0;
+    int err = mp4_top_box(fd, file_size, file_size - mfra_size, type, &box_size);
+    if (err != MP4_INDEX_OK) {
+        return err;
+    }
+    if (memcmp(type, "mfra", 4) != 0 || box_size != mfra_size) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    uint8_t *mfra = NULL;
+    err = mp4_top_box_load(fd, file_size - mfra_size, mfra_size, &mfra);
+    if (err == MP4_INDEX_OK) {
+        err = mp4_index_add_mfra(ctx, mfra, mfra_size);
+        free(mfra);
+    }
+    return err;
+}
+
+// Read into *moof, grown as needed, the moof box at offset and add it
+static int
+mp4_moof_load(int fd, uint64_t offset, uint64_t box_size, uint8_t **moof, uint64_t *moof_cap, mp4_index_t *ctx)
+{
+    if (box_size > *moof_cap) {
+        uint8_t *buf = box_size <= SIZE_MAX ? realloc(*moof, box_size) : NULL;
+        if (!buf) {
+            return MP4_INDEX_ERR_NOMEM;
+        }
+        *moof = buf;
+        *moof_cap = box_size;
+    }
+    if (!pread_full(fd, *moof, box_size, offset)) {
+        return MP4_INDEX_ERR_IO;
+    }
+    return mp4_index_add_fragment(ctx, *moof, box_size, offset);
+}
+
+// Read only the moof boxes named by the tfra tables, in file order, which
+// resolves their keyframes to the samples. MP4_INDEX_ERR_FORMAT when a tfra
+// entry does not name a moof box or a sample in it.
+static int
+mp4_tfra_moofs_load(int fd, uint64_t file_size, mp4_index_t *ctx)
+{
+    uint8_t *moof = NULL;
+    uint64_t moof_cap = 0;
+    int err = MP4_INDEX_OK;
+    while (err == MP4_INDEX_OK) {
+        // the lowest moof offset among the keyframes not resolved yet
+        uint64_t offset = UINT64_MAX;
+        for (size_t i = 0; i < ctx->trak_num; i++) {
+            const mp4_trak_t *trak = &ctx->traks[i];
+            if (trak->has_tfra && trak->tfra_next < trak->tfra_num && trak->keyframes_offset[trak->tfra_first + trak->tfra_next] < offset) {
+                offset = trak->keyframes_offset[trak->tfra_first + trak->tfra_next];
+            }
+        }
+        if (offset == UINT64_MAX) {
+            break;
+        }
+
+        uint8_t type[4];
+        uint64_t box_size = 0;
+        if (offset + 8 > file_size) {
+            err = MP4_INDEX_ERR_FORMAT;
+            break;
+        }
+        err = mp4_top_box(fd, file_size, offset, type, &box_size);
+        if (err == MP4_INDEX_OK && memcmp(type, "moof", 4) != 0) {
+            err = MP4_INDEX_ERR_FORMAT;
+        }
+        if (err == MP4_INDEX_OK) {
+            err = mp4_moof_load(fd, offset, box_size, &moof, &moof_cap, ctx);
+        }
+        // whatever this moof left pending names no sample of it
+        for (size_t i = 0; err == MP4_INDEX_OK && i < ctx->trak_num; i++) {
+            const mp4_trak_t *trak = &ctx->traks[i];
+            if (trak->has_tfra && trak->tfra_next < trak->tfra_num && trak->keyframes_offset[trak->tfra_first + trak->tfra_next] <= offset) {
+                err = MP4_INDEX_ERR_FORMAT;
+            }
+        }
+    }
+    free(moof);
+    return err;
+}
+
+// Movie fragments after the moov: the tracks listed in an mfra box take their
+// keyframes from its tfra tables, and only the moof boxes those name are read.
+// Otherwise, or when the tfra tables do not match the moof boxes, every moof
+// is read, one at a time into a reused buffer, up to the first box whose
+// header is invalid or whose size runs past the end of the file.
+static int
+mp4_fragments_load(int fd, uint64_t file_size, uint64_t offset, mp4_index_t *ctx)
+{
+    bool walk = false;
+    for (size_t i = 0; i < ctx->trak_num; i++) {
+        walk |= ctx->traks[i].has_trex;
+    }
+    if (!walk) {
+        return MP4_INDEX_OK;
+    }
+
+    // without a usable mfra every moof is walked, and always for the samples
+    if (!ctx->samples) {
+        mp4_mfra_load(fd, file_size, ctx);
+    }
+    walk = false;
+    for (size_t i = 0; i < ctx->trak_num; i++) {
+        walk |= ctx->traks[i].has_trex && !ctx->traks[i].has_tfra;
+    }
+    if (!walk) {
+        // the walk of the named moof boxes moves on the fragment state
+        // that a full walk starts from
+        struct {
+            uint32_t sample_num;
+            uint64_t decode_time;
+            uint32_t trun_num;
+            uint64_t default_bytes;
+            uint64_t sizeless_num;
+            size_t keyframes_num;
+        } *frag = calloc(ctx->trak_num ? ctx->trak_num : 1, sizeof(*frag));
+        if (!frag) {
+            return MP4_INDEX_ERR_NOMEM;
+        }
+        for (size_t i = 0; i < ctx->trak_num; i++) {
+            frag[i].sample_num = ctx->traks[i].frag_sample_num;
+            frag[i].decode_time = ctx->traks[i].frag_decode_time;
+            frag[i].trun_num = ctx->traks[i].frag_trun_num;
+            frag[i].default_bytes = ctx->traks[i].frag_default_bytes;
+            frag[i].sizeless_num = ctx->traks[i].frag_sizeless_num;
+            frag[i].keyframes_num = ctx->traks[i].track.keyframes.num;
+        }
+        int err = mp4_tfra_moofs_load(fd, file_size, ctx);
+        for (size_t i = 0; err == MP4_INDEX_ERR_FORMAT && i < ctx->trak_num; i++) {
+            ctx->traks[i].frag_sample_num = frag[i].sample_num;
+            ctx->traks[i].frag_decode_time = frag[i].decode_time;
+            ctx->traks[i].frag_trun_num = frag[i].trun_num;
+            ctx->traks[i].frag_default_bytes = frag[i].default_bytes;
+            ctx->traks[i].frag_sizeless_num = frag[i].sizeless_num;
+            ctx->traks[i].track.keyframes.num = frag[i].keyframes_num;
+        }
+        free(frag);
+        if (err != MP4_INDEX_ERR_FORMAT) {
+            return err;
+        }
+    }
+    // the full walk finds the sync samples itself: drop the tfra keyframes
+    for (size_t i = 0; i < ctx->trak_num; i++) {
+        mp4_trak_t *trak = &ctx->traks[i];
+        if (trak->has_tfra) {
+            trak->track.keyframes.num = trak->tfra_first;
+            trak->has_tfra = false;
+            trak->tfra_num = 0;
+            trak->tfra_next = 0;
+        }
+    }
+
+    uint8_t *moof = NULL;
+    uint64_t moof_cap = 0;
+    int err = MP4_INDEX_OK;
+    while (err == MP4_INDEX_OK && offset + 8 <= file_size) {
+        uint8_t type[4];
+        uint64_t box_size = 0;
+        err = mp4_top_box(fd, file_size, offset, type, &box_size);
+        if (err == MP4_INDEX_ERR_FORMAT) {
+            // a file cut short or with trailing garbage: keep the fragments
+            // before it
+            err = MP4_INDEX_OK;
+            break;
+        }
+        if (err != MP4_INDEX_OK || memcmp(type, "moof", 4) != 0) {
+            offset += box_size;
+            continue;
+        }
+
+        err = mp4_moof_load(fd, offset, box_size, &moof, &moof_cap, ctx);
+        offset += box_size;
+    }
+    free(moof);
+    return err;
+}
+
+int
+mp4_index_build_fd(int fd, mp4_index_t *ctx)
+{
+    struct stat sb = {0};
+    if (fstat(fd, &sb) < 0) {
+        return MP4_INDEX_ERR_IO;
+    }
+
+    uint8_t *moov = NULL;
+    size_t moov_len = 0;
+    uint64_t moov_offset = 0;
+    int err = mp4_moov_load(fd, sb.st_size, &moov, &moov_len, &moov_offset);
+    if (err != MP4_INDEX_OK) {
+        mp4_index_reset(ctx);
+        return err;
+    }
+    err = mp4_index_build(moov, moov_len, ctx);
+    free(moov);
+    if (err == MP4_INDEX_OK) {
+        ctx->file_size = sb.st_size;
+        err = mp4_fragments_load(fd, sb.st_size, moov_offset + moov_len, ctx);
+    }
+    return err;
+}
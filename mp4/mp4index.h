@@ -0,0 +1,145 @@
+#ifndef _MP4_INDEX_H_2018
+#define _MP4_INDEX_H_2018
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Keyframe index of a progressive or fragmented mp4 file.
+//
+// Every call works on its own context and nothing is global, so contexts can
+// be used from different threads at the same time. All tables are owned by
+// an arena inside the context and stay valid until the next build, reset or
+// destroy of that context.
+
+enum {
+    MP4_INDEX_OK = 0,
+    MP4_INDEX_ERR_NOMEM = -1,
+    MP4_INDEX_ERR_IO = -2,
+    MP4_INDEX_ERR_FORMAT = -3,
+    MP4_INDEX_ERR_NO_MOOV = -4,
+    MP4_INDEX_ERR_STALE = -5,
+    MP4_INDEX_ERR_DEPTH = -6,
+};
+
+typedef struct mp4_index mp4_index_t;
+
+// Keyframes in sample order, one entry per stss sync sample (every sample
+// of a track without stss), followed by the sync samples of the movie
+// fragments. Keyframes taken from an mfra box have the offset of their sample
+// and, when its traf has a tfdt box, its dts and pts; otherwise the tfra time
+// stands for both. Their sample is 0, the moof boxes before are not read.
+typedef struct {
+    size_t num;
+    const double *dts;        // decode time in seconds
+    const double *pts;        // presentation time in seconds, after ctts and the edit list
+    const uint64_t *offset;   // file offset of the sync sample
+    const uint32_t *sample;   // 1-based sync sample number
+} mp4_keyframes_t;
+
+// Every sample in decode order, the samples of the stbl tables followed by
+// the trun samples of the movie fragments, one array per column. The stts,
+// ctts, stsc, stsz, stco and stss runs are expanded in a single pass. Times
+// are in track time scale units, before the edit list. Only filled in by
+// builds of a context set up with mp4_index_set_samples().
+typedef struct {
+    size_t num;
+    const uint64_t *offset;     // file offset
+    const uint32_t *size;
+    const uint64_t *dts;        // decode time
+    const int32_t *cts_offset;  // composition time minus decode time
+    const uint32_t *chunk;      // 1-based stco chunk; each trun counts as one more chunk
+    const uint8_t *sync;        // 1 for a sync sample, 0 otherwise
+} mp4_samples_t;
+
+// One trak box, identified by its tkhd track ID and its hdlr handler type.
+// codec and nal_length_size are only filled in by builds, not cache loads.
+typedef struct {
+    uint32_t track_id;
+    char handler[5];          // "vide", "soun", ...
+    char codec[5];            // type of the first stsd entry, e.g. "avc1"
+    uint8_t nal_length_size;  // NAL unit length field bytes from avcC/hvcC, 0 without
+    uint32_t time_scale;
+    mp4_keyframes_t keyframes;
+    mp4_samples_t samples;
+} mp4_track_t;
+
+mp4_index_t *mp4_index_create(void);
+void mp4_index_destroy(mp4_index_t *ctx);
+void mp4_index_reset(mp4_index_t *ctx);
+// Deepest box nesting accepted by the builds of ctx, MP4_WALK_MAX_DEPTH by
+// default; deeper files fail with MP4_INDEX_ERR_DEPTH
+void mp4_index_set_max_depth(mp4_index_t *ctx, int max_depth);
+// Also record the per-sample columns of mp4_samples_t in the builds of ctx.
+// They cost 29 bytes a sample, and fragmented files have their moof boxes
+// walked even when an mfra box lists the keyframes. Caches hold keyframes
+// only: tracks loaded from one have no samples.
+void mp4_index_set_samples(mp4_index_t *ctx, bool samples);
+
+// Build the index from a complete moov box (header included)
+int mp4_index_build(const uint8_t *moov, size_t len, mp4_index_t *ctx);
+// Add the keyframes of one moof box (header included) at file offset
+// moof_offset; moof boxes must be added in file order after the build
+int mp4_index_add_fragment(mp4_index_t *ctx, const uint8_t *moof, size_t len, uint64_t moof_offset);
+// Size of the file the moof boxes come from, set after the build: the trun
+// boxes without per-sample fields are then checked against it instead of a
+// fixed limit of 2^20 samples a track. mp4_index_build_fd() sets it itself.
+void mp4_index_set_file_size(mp4_index_t *ctx, uint64_t file_size);
+// Add the keyframes listed by the tfra boxes of an mfra box (header included);
+// mp4_index_add_fragment then skips the sync samples of those tracks. Their
+// offset is the moof offset until that moof box is added, which resolves
+// them to their sample.
+int mp4_index_add_mfra(mp4_index_t *ctx, const uint8_t *mfra, size_t len);
+// Locate and read only the moov box of an open file, then build the index.
+// For a fragmented file the mfra box at the end is used when it covers every
+// fragmented track, reading only the moof boxes it names; otherwise every
+// moof box is read, stepping over mdat.
+int mp4_index_build_fd(int fd, mp4_index_t *ctx);
+
+// Sidecar cache: the keyframe tables packed behind a header that records the
+// size, mtime and inode of the source file (sb). Loading maps the cache file
+// read-only, so worker processes share one page-cache copy; it fails with
+// MP4_INDEX_ERR_STALE when the cache does not describe sb any more.
+int mp4_index_cache_load(const char *path, const struct stat *sb, mp4_index_t *ctx);
+int mp4_index_cache_save(const char *path, const struct stat *sb, const mp4_index_t *ctx);
+
+size_t mp4_index_track_num(const mp4_index_t *ctx);
+const mp4_track_t *mp4_index_track(const mp4_index_t *ctx, size_t i);
+// NULL when there is no such track
+const mp4_track_t *mp4_index_track_by_id(const mp4_index_t *ctx, uint32_t track_id);
+const mp4_track_t *mp4_index_track_by_handler(const mp4_index_t *ctx, const char *handler);
+// The first video track, else the first track with an stss box, else the
+// first track; NULL for a file without tracks
+const mp4_track_t *mp4_index_default_track(const mp4_index_t *ctx);
+// Keyframes of the default track (empty without tracks)
+const mp4_keyframes_t *mp4_index_keyframes(const mp4_index_t *ctx);
+// One sample of the stbl tables of a track, with times in track time scale
+// units before the edit list
+typedef struct {
+    uint32_t sample;     // 1-based sample number
+    uint32_t chunk;      // 1-based stco chunk
+    uint64_t offset;     // file offset
+    uint32_t size;
+    uint64_t dts;        // decode time
+    int32_t cts_offset;  // composition time minus decode time
+    bool sync;
+} mp4_sample_t;
+
+// Random access to any sample of a track built from a moov box, not only
+// the keyframes, through prefix sums over the stts, ctts and stsc runs:
+// O(log entries) a query. Samples of movie fragments are taken from the
+// sample columns, so only builds with mp4_index_set_samples() cover them;
+// tracks loaded from a cache have no samples. False when there is no such
+// sample.
+bool mp4_track_sample(const mp4_track_t *track, uint32_t sample, mp4_sample_t *out);
+// Number of the sample being decoded at decode time dts (track time scale
+// units): the last one starting at or before dts, 0 without samples. Covers
+// the same samples as mp4_track_sample().
+uint32_t mp4_track_sample_at(const mp4_track_t *track, uint64_t dts);
+// Index of the last keyframe presented at or before time (the first one if
+// time is before every keyframe), -1 if there are no keyframes. O(log n).
+long mp4_keyframes_seek(const mp4_keyframes_t *keyframes, double time);
+const char *mp4_index_strerror(int err);
+
+#endif  //_MP4_INDEX_H_2018
@@ -0,0 +1,218 @@
+#include "mp4index.h"
+#include "mp4indexpriv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Cache file layout, host byte order (the cache never leaves the host):
+//   header
+//   track descriptor[track_num]
+//   for each track, 8-byte aligned:
+//     double   dts[keyframes_num]
+//     double   pts[keyframes_num]
+//     uint64_t offset[keyframes_num]
+//     uint32_t sample[keyframes_num]
+#define MP4_INDEX_CACHE_MAGIC "MP4KIDX"
+#define MP4_INDEX_CACHE_VERSION 7
+#define MP4_INDEX_CACHE_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t inode;
+    uint64_t dev;
+    uint64_t track_num;
+} mp4_index_cache_header_t;
+
+typedef struct {
+    uint32_t track_id;
+    char handler[4];
+    uint32_t time_scale;
+    uint32_t has_stss;
+    uint64_t keyframes_num;
+} mp4_index_cache_track_t;
+
+static void
+mp4_index_cache_header_init(mp4_index_cache_header_t *header, const struct stat *sb, uint64_t track_num)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, MP4_INDEX_CACHE_MAGIC, sizeof(MP4_INDEX_CACHE_MAGIC));
+    header->version = MP4_INDEX_CACHE_VERSION;
+    header->byte_order = MP4_INDEX_CACHE_BYTE_ORDER;
+    header->file_size = sb->st_size;
+    header->mtime_sec = sb->st_mtim.tv_sec;
+    header->mtime_nsec = sb->st_mtim.tv_nsec;
+    header->inode = sb->st_ino;
+    header->dev = sb->st_dev;
+    header->track_num = track_num;
+}
+
+// Bytes of the keyframe arrays of one track, padded to keep the next track aligned
+static uint64_t
+mp4_index_cache_track_size(uint64_t keyframes_num)
+{
+    uint64_t size = keyframes_num * (2 * sizeof(double) + sizeof(uint64_t) + sizeof(uint32_t));
+    return (size + 7) & ~(uint64_t)7;
+}
+
+int
+mp4_index_cache_load(const char *path, const struct stat *sb, mp4_index_t *ctx)
+{
+    mp4_index_reset(ctx);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? MP4_INDEX_ERR_STALE : MP4_INDEX_ERR_IO;
+    }
+    struct stat cache_sb = {0};
+    if (fstat(fd, &cache_sb) < 0) {
+        close(fd);
+        return MP4_INDEX_ERR_IO;
+    }
+    const uint64_t map_len = cache_sb.st_size;
+    if (map_len < sizeof(mp4_index_cache_header_t)) {
+        close(fd);
+        return MP4_INDEX_ERR_STALE;
+    }
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return MP4_INDEX_ERR_IO;
+    }
+
+    mp4_index_cache_header_t expected;
+    const mp4_index_cache_header_t *header = map;
+    mp4_index_cache_header_init(&expected, sb, header->track_num);
+    if (memcmp(header, &expected, sizeof(expected)) != 0
+        || header->track_num > (map_len - sizeof(*header)) / sizeof(mp4_index_cache_track_t)) {
+        munmap(map, map_len);
+        return MP4_INDEX_ERR_STALE;
+    }
+
+    const size_t track_num = header->track_num;
+    const mp4_index_cache_track_t *tracks = (const mp4_index_cache_track_t *)(header + 1);
+    ctx->traks = mp4_arena_calloc(&ctx->arena, track_num, sizeof(*ctx->traks));
+    if (!ctx->traks && track_num) {
+        munmap(map, map_len);
+        return MP4_INDEX_ERR_NOMEM;
+    }
+
+    uint64_t offset = sizeof(*header) + track_num * sizeof(*tracks);
+    for (size_t i = 0; i < track_num; i++) {
+        const uint64_t num = tracks[i].keyframes_num;
+        if (num > map_len || mp4_index_cache_track_size(num) > map_len - offset) {
+            munmap(map, map_len);
+            mp4_index_reset(ctx);
+            return MP4_INDEX_ERR_STALE;
+        }
+        const uint8_t *p = (const uint8_t *)map + offset;
+        mp4_trak_t *trak = &ctx->traks[i];
+        trak->has_stss = tracks[i].has_stss;
+        trak->track.track_id = tracks[i].track_id;
+        memcpy(trak->track.handler, tracks[i].handler, 4);
+        trak->track.time_scale = tracks[i].time_scale;
+        trak->track.keyframes.num = num;
+        trak->track.keyframes.dts = (const double *)p;
+        trak->track.keyframes.pts = (const double *)(p + num * sizeof(double));
+        trak->track.keyframes.offset = (const uint64_t *)(p + num * 2 * sizeof(double));
+        trak->track.keyframes.sample = (const uint32_t *)(p + num * (2 * sizeof(double) + sizeof(uint64_t)));
+        offset += mp4_index_cache_track_size(num);
+    }
+    if (offset != map_len) {
+        munmap(map, map_len);
+        mp4_index_reset(ctx);
+        return MP4_INDEX_ERR_STALE;
+    }
+
+    ctx->trak_num = track_num;
+    ctx->trak_cap = track_num;
+    ctx->cache_map = map;
+    ctx->cache_map_len = map_len;
+    return MP4_INDEX_OK;
+}
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return MP4_INDEX_ERR_IO;
+        }
+        p += n;
+        len -= n;
+    }
+    return MP4_INDEX_OK;
+}
+
+int
+mp4_index_cache_save(const char *path, const struct stat *sb, const mp4_index_t *ctx)
+{
+    mp4_index_cache_header_t header;
+    mp4_index_cache_header_init(&header, sb, ctx->trak_num);
+
+    // Write a private temporary file and rename it into place, so concurrent
+    // readers only ever map a complete cache
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(tmp_path)) {
+        return MP4_INDEX_ERR_IO;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return MP4_INDEX_ERR_IO;
+    }
+
+    int err = write_full(fd, &header, sizeof(header));
+    for (size_t i = 0; err == MP4_INDEX_OK && i < ctx->trak_num; i++) {
+        const mp4_trak_t *trak = &ctx->traks[i];
+        mp4_index_cache_track_t track = {0};
+        track.track_id = trak->track.track_id;
+        memcpy(track.handler, trak->track.handler, 4);
+        track.time_scale = trak->track.time_scale;
+        track.has_stss = trak->has_stss;
+        track.keyframes_num = trak->track.keyframes.num;
+        err = write_full(fd, &track, sizeof(track));
+    }
+    for (size_t i = 0; err == MP4_INDEX_OK && i < ctx->trak_num; i++) {
+        const mp4_keyframes_t *keyframes = &ctx->traks[i].track.keyframes;
+        static const uint8_t pad[8] = {0};
+        err = write_full(fd, keyframes->dts, keyframes->num * sizeof(*keyframes->dts));
+        if (err == MP4_INDEX_OK) {
+            err = write_full(fd, keyframes->pts, keyframes->num * sizeof(*keyframes->pts));
+        }
+        if (err == MP4_INDEX_OK) {
+            err = write_full(fd, keyframes->offset, keyframes->num * sizeof(*keyframes->offset));
+        }
+        if (err == MP4_INDEX_OK) {
+            err = write_full(fd, keyframes->sample, keyframes->num * sizeof(*keyframes->sample));
+        }
+        if (err == MP4_INDEX_OK) {
+            err = write_full(fd, pad, mp4_index_cache_track_size(keyframes->num) - keyframes->num * (2 * sizeof(double) + sizeof(uint64_t) + sizeof(uint32_t)));
+        }
+    }
+    if (close(fd) < 0 && err == MP4_INDEX_OK) {
+        err = MP4_INDEX_ERR_IO;
+    }
+    if (err == MP4_INDEX_OK && rename(tmp_path, path) < 0) {
+        err = MP4_INDEX_ERR_IO;
+    }
+    if (err != MP4_INDEX_OK) {
+        unlink(tmp_path);
+    }
+    return err;
+}
@@ -0,0 +1,213 @@
+#include "mp4index.h"
+#include "mp4indexpriv.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Samples before each of num runs, num + 1 entries in the arena; NULL
+// without memory
+static uint64_t *
+mp4_prefix_alloc(mp4_index_t *ctx, uint32_t num)
+{
+    uint64_t *prefix = mp4_arena_array(&ctx->arena, (size_t)num + 1, sizeof(*prefix));
+    if (prefix) {
+        prefix[0] = 0;
+    }
+    return prefix;
+}
+
+int
+mp4_lookup_resolve(mp4_index_t *ctx, mp4_trak_t *trak)
+{
+    trak->stts_sample_prefix = mp4_prefix_alloc(ctx, trak->stts_entry_num);
+    trak->stts_time_prefix = mp4_prefix_alloc(ctx, trak->stts_entry_num);
+    trak->ctts_sample_prefix = mp4_prefix_alloc(ctx, trak->ctts_entry_num);
+    trak->stsc_sample_prefix = mp4_prefix_alloc(ctx, trak->stsc_entry_num);
+    if (!trak->stts_sample_prefix || !trak->stts_time_prefix || !trak->ctts_sample_prefix || !trak->stsc_sample_prefix) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+
+    for (uint32_t i = 0; i < trak->stts_entry_num; i++) {
+        const uint32_t count = trak->stts_entry_data[i].sample_count;
+        trak->stts_sample_prefix[i + 1] = trak->stts_sample_prefix[i] + count;
+        trak->stts_time_prefix[i + 1] = trak->stts_time_prefix[i] + (uint64_t)count * trak->stts_entry_data[i].sample_duration;
+    }
+    for (uint32_t i = 0; i < trak->ctts_entry_num; i++) {
+        trak->ctts_sample_prefix[i + 1] = trak->ctts_sample_prefix[i] + trak->ctts_entry_data[i].sample_count;
+    }
+    // a run covers the chunks up to the first chunk of the next one, the last
+    // run the chunks up to the end of stco
+    for (uint32_t i = 0; i < trak->stsc_entry_num; i++) {
+        const uint32_t first_chunk = trak->stsc_entry_data[i].first_chunk;
+        uint32_t next_first_chunk = trak->stco_entry_num + 1;
+        if (i + 1 < trak->stsc_entry_num) {
+            next_first_chunk = trak->stsc_entry_data[i + 1].first_chunk;
+        }
+        const uint64_t chunks = next_first_chunk > first_chunk ? next_first_chunk - first_chunk : 0;
+        trak->stsc_sample_prefix[i + 1] = trak->stsc_sample_prefix[i] + chunks * trak->stsc_entry_data[i].samples_per_chunk;
+    }
+    return MP4_INDEX_OK;
+}
+
+// The run of prefix (num runs) holding the 0-based index, -1 if none
+static long
+mp4_prefix_find(const uint64_t *prefix, uint32_t num, uint64_t index)
+{
+    if (!prefix || num == 0 || index >= prefix[num]) {
+        return -1;
+    }
+    // the last run starting at or before index; runs of no samples start
+    // where the next one does and are skipped by taking the last
+    uint32_t lo = 0;
+    uint32_t hi = num;
+    while (hi - lo > 1) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (prefix[mid] <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Fragment samples come after the stbl ones in the sample columns, when the
+// build recorded them
+static bool
+mp4_track_sample_column(const mp4_track_t *track, uint32_t sample, mp4_sample_t *out)
+{
+    const mp4_samples_t *samples = &track->samples;
+    if (sample == 0 || sample > samples->num) {
+        return false;
+    }
+    const size_t i = sample - 1;
+    out->sample = sample;
+    out->chunk = samples->chunk[i];
+    out->offset = samples->offset[i];
+    out->size = samples->size[i];
+    out->dts = samples->dts[i];
+    out->cts_offset = samples->cts_offset[i];
+    out->sync = samples->sync[i];
+    return true;
+}
+
+bool
+mp4_track_sample(const mp4_track_t *track, uint32_t sample, mp4_sample_t *out)
+{
+    // the public track is the first member of its mp4_trak_t
+    const mp4_trak_t *trak = (const mp4_trak_t *)track;
+    if (sample > trak->stsz_entry_num) {
+        return mp4_track_sample_column(track, sample, out);
+    }
+    if (sample == 0) {
+        return false;
+    }
+    const uint64_t index = sample - 1;
+
+    const long stsc_idx = mp4_prefix_find(trak->stsc_sample_prefix, trak->stsc_entry_num, index);
+    if (stsc_idx < 0) {
+        return false;
+    }
+    const uint32_t samples_per_chunk = trak->stsc_entry_data[stsc_idx].samples_per_chunk;
+    const uint64_t chunk_idx = (index - trak->stsc_sample_prefix[stsc_idx]) / samples_per_chunk;
+    const uint64_t chunk = trak->stsc_entry_data[stsc_idx].first_chunk + chunk_idx;
+    if (chunk == 0 || chunk > trak->stco_entry_num) {
+        return false;
+    }
+    const uint32_t chunk_first_sample = trak->stsc_sample_prefix[stsc_idx] + chunk_idx * samples_per_chunk + 1;
+
+    out->sample = sample;
+    out->chunk = chunk;
+    // the sample follows the samples before it in its chunk
+    out->offset = trak->stco_entry_data[chunk - 1].chunk_offset + mp4_samples_size(trak, chunk_first_sample, sample);
+    out->size = mp4_samples_size(trak, sample, sample + 1);
+
+    // past the end of stts the samples take no time
+    const long stts_idx = mp4_prefix_find(trak->stts_sample_prefix, trak->stts_entry_num, index);
+    out->dts = trak->stts_time_prefix ? trak->stts_time_prefix[trak->stts_entry_num] : 0;
+    if (stts_idx >= 0) {
+        out->dts = trak->stts_time_prefix[stts_idx] + (index - trak->stts_sample_prefix[stts_idx]) * trak->stts_entry_data[stts_idx].sample_duration;
+    }
+
+    const long ctts_idx = mp4_prefix_find(trak->ctts_sample_prefix, trak->ctts_entry_num, index);
+    out->cts_offset = ctts_idx >= 0 ? trak->ctts_entry_data[ctts_idx].sample_offset : 0;
+
+    // stss is sorted
+    out->sync = !trak->has_stss;
+    uint32_t lo = 0;
+    uint32_t hi = trak->stss_entry_num;
+    while (lo < hi && !out->sync) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (trak->stss_entry_data[mid].sync_sample < sample) {
+            lo = mid + 1;
+        } else {
+            out->sync = trak->stss_entry_data[mid].sync_sample == sample;
+            hi = mid;
+        }
+    }
+    return true;
+}
+
+// The last fragment sample of the sample columns starting at or before dts,
+// 0 if there is none
+static uint32_t
+mp4_track_sample_at_column(const mp4_trak_t *trak, uint64_t dts)
+{
+    const mp4_samples_t *samples = &trak->track.samples;
+    size_t lo = trak->stsz_entry_num;
+    size_t hi = samples->num;
+    if (lo >= hi || samples->dts[lo] > dts) {
+        return 0;
+    }
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (samples->dts[mid] <= dts) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo + 1 > UINT32_MAX ? UINT32_MAX : lo + 1;
+}
+
+uint32_t
+mp4_track_sample_at(const mp4_track_t *track, uint64_t dts)
+{
+    const mp4_trak_t *trak = (const mp4_trak_t *)track;
+    const uint32_t fragment_sample = mp4_track_sample_at_column(trak, dts);
+    if (fragment_sample) {
+        return fragment_sample;
+    }
+    const uint32_t num = trak->stts_entry_num;
+    if (!trak->stts_time_prefix || num == 0 || trak->stts_sample_prefix[num] == 0) {
+        return 0;
+    }
+    if (dts >= trak->stts_time_prefix[num]) {
+        return trak->stts_sample_prefix[num] > UINT32_MAX ? UINT32_MAX : trak->stts_sample_prefix[num];
+    }
+
+    // the last run starting at or before dts that has samples
+    uint32_t lo = 0;
+    uint32_t hi = num;
+    while (hi - lo > 1) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (trak->stts_time_prefix[mid] <= dts) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo > 0 && trak->stts_entry_data[lo].sample_count == 0) {
+        lo--;
+    }
+
+    const uint32_t count = trak->stts_entry_data[lo].sample_count;
+    const uint32_t duration = trak->stts_entry_data[lo].sample_duration;
+    uint64_t k = duration ? (dts - trak->stts_time_prefix[lo]) / duration : count - 1;
+    if (count && k > count - 1) {
+        k = count - 1;
+    }
+    const uint64_t sample = trak->stts_sample_prefix[lo] + k + 1;
+    return sample > UINT32_MAX ? UINT32_MAX : sample;
+}
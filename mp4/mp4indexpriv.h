@@ -0,0 +1,137 @@
+#ifndef _MP4_INDEX_PRIV_H_2018
+#define _MP4_INDEX_PRIV_H_2018
+
+// Internals of mp4_index_t shared by the files of the mp4index library
+
+#include "mp4arena.h"
+#include "mp4index.h"
+
+#include <stdbool.h>
+
+// Sample tables of one trak box; the public mp4_track_t comes first. The
+// stss, stts, ctts and stco entries are laid out as 32 or 64-bit values in
+// box order, so mp4_be32_decode() and friends fill them in one run.
+typedef struct {
+    mp4_track_t track;
+    bool has_stss;  // without stss every sample is a sync sample
+    uint32_t stss_entry_num;
+    struct {
+        uint32_t sync_sample;
+    } * stss_entry_data;
+    uint32_t stts_entry_num;
+    struct {
+        uint32_t sample_count;
+        uint32_t sample_duration;
+    } * stts_entry_data;
+    // ctts composition offsets; version 0 offsets are read as signed too, as
+    // writers put negative offsets in them in practice
+    uint32_t ctts_entry_num;
+    struct {
+        uint32_t sample_count;
+        int32_t sample_offset;
+    } * ctts_entry_data;
+    // elst: media time of the first edit, and the empty edits in movie time
+    // scale that delay it
+    bool has_elst;
+    int64_t elst_media_time;
+    uint64_t elst_empty_duration;
+    uint32_t stsc_entry_num;
+    struct {
+        uint32_t first_chunk;
+        uint32_t samples_per_chunk;
+    } * stsc_entry_data;
+    // prefix sums for mp4_track_sample() and mp4_track_sample_at(), num + 1
+    // entries each: the samples before stts, ctts and stsc entry i, and the
+    // duration before stts entry i
+    uint64_t *stts_sample_prefix;
+    uint64_t *stts_time_prefix;
+    uint64_t *ctts_sample_prefix;
+    uint64_t *stsc_sample_prefix;
+    // stsz/stz2: constant sample size, or the running total of the sample
+    // sizes, stsz_size_prefix[n] being the bytes taken by samples 1..n
+    uint32_t stsz_sample_size;
+    uint32_t stsz_entry_num;
+    uint64_t *stsz_size_prefix;
+    // stco or co64, widened to 64 bits
+    uint32_t stco_entry_num;
+    struct {
+        uint64_t chunk_offset;
+    } * stco_entry_data;
+    // trex defaults for the movie fragments of this track
+    bool has_trex;
+    uint32_t trex_sample_duration;
+    uint32_t trex_sample_size;
+    uint32_t trex_sample_flags;
+    // keyframes came from a tfra table, so the moof walk only resolves them
+    bool has_tfra;
+    // the tfra entries behind the keyframes from tfra_first on: the traf,
+    // trun and sample number of each in the moof at its keyframe offset, until
+    // a walk of that moof resolves the keyframe to its sample
+    size_t tfra_first;
+    uint32_t tfra_num;
+    uint32_t tfra_next;  // first entry not resolved yet
+    struct {
+        uint32_t traf_number;
+        uint32_t trun_number;
+        uint32_t sample_number;
+    } * tfra_entry_data;
+    // samples and decode time so far, where the next fragment continues
+    uint32_t frag_sample_num;
+    uint64_t frag_decode_time;
+    // keyframe arrays behind track.keyframes; fragments append to them,
+    // doubling keyframes_cap in the arena
+    size_t keyframes_cap;
+    double *keyframes_dts;
+    double *keyframes_pts;
+    uint64_t *keyframes_offset;
+    uint32_t *keyframes_sample;
+    // sample columns behind track.samples with mp4_index_set_samples(), grown
+    // the same way
+    size_t samples_cap;
+    uint64_t *samples_offset;
+    uint32_t *samples_size;
+    uint64_t *samples_dts;
+    int32_t *samples_cts_offset;
+    uint32_t *samples_chunk;
+    uint8_t *samples_sync;
+    // trun boxes so far, numbered as chunks after the stco ones
+    uint32_t frag_trun_num;
+    // samples of truns without per-sample fields so far: the bytes of those
+    // with a default size, and the count of those without one
+    uint64_t frag_default_bytes;
+    uint64_t frag_sizeless_num;
+} mp4_trak_t;
+
+// Bytes taken by the samples first..last-1 (1-based), from stsz
+uint64_t mp4_samples_size(const mp4_trak_t *trak, uint32_t first, uint32_t last);
+// Build the prefix sums of the stts, ctts and stsc runs of trak
+int mp4_lookup_resolve(mp4_index_t *ctx, mp4_trak_t *trak);
+
+struct mp4_index {
+    mp4_arena_t arena;
+    int max_depth;              // mp4_index_set_max_depth, kept across resets
+    bool samples;               // mp4_index_set_samples, kept across resets
+    uint32_t movie_time_scale;  // mvhd
+    size_t trak_num;
+    size_t trak_cap;  // trak boxes counted in moov
+    mp4_trak_t *traks;
+    mp4_trak_t *cur_trak;  // track of the trak, traf or tfra box being parsed, NULL outside of one
+    int trak_depth;        // walker depth of the trak boxes of the open moov, 0 outside of one
+    // moof box being parsed: its file offset, the base offset of the current
+    // traf and the file offset where the next trun data starts
+    uint64_t moof_offset;
+    uint64_t traf_base_offset;
+    uint64_t traf_data_offset;
+    uint32_t traf_sample_duration;
+    uint32_t traf_sample_size;
+    uint32_t traf_sample_flags;
+    uint32_t traf_num;   // traf boxes of the moof so far, counting the current one
+    uint32_t trun_num;   // trun boxes of the traf so far, counting the current one
+    bool traf_has_tfdt;  // the current traf gave its decode time
+    uint64_t file_size;  // of the file being built, 0 when not known
+    // keyframes point into this mapping when loaded from a cache file
+    void *cache_map;
+    size_t cache_map_len;
+};
+
+#endif  //_MP4_INDEX_PRIV_H_2018
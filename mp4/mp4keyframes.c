@@ -1,276 +1,333 @@
-#include <ctype.h>
+#include "mp4index.h"
+#include "mp4walk.h"
+
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdbool.h>
-#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <sys/types.h>
 #include <unistd.h>
 
-static struct {
-    uint32_t mdhd_time_scale;
-    uint32_t stss_entry_num;
-    struct {
-        uint32_t sync_sample;
-    } * stss_entry_data;
-    uint32_t stts_entry_num;
-    struct {
-        uint32_t sample_count;
-        uint32_t sample_duration;
-    } * stts_entry_data;
-    uint32_t stsc_entry_num;
-    struct {
-        uint32_t first_chunk;
-        uint32_t samples_per_chunk;
-    } * stsc_entry_data;
-    uint32_t stco_entry_num;
-    struct {
-        uint32_t chunk_offset;
-    } * stco_entry_data;
-    uint32_t keyframes_num;
-    struct {
-        double sync_sample_time;
-        uint32_t chunk_offset;
-        uint32_t sync_sample;
-        uint32_t sync_sample_duration;
-        uint32_t sync_chunk;
-    } * keyframes_data;
-    bool need_parse;
-    uint8_t *content_buf;
-    FILE *fp;
-} g_keyframe;
-
-static void mp4_box(const uint8_t *p, size_t len, int depth);
-static void free_keyframe_data(void);
-
-int main(int argc, char **argv)
+static void
+usage(const char *prog)
 {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-    atexit(free_keyframe_data);
-
-    const char *filename = argv[1];
-
-    struct stat sb = {0};
-    if (stat(filename, &sb) < 0) {
-        fprintf(stderr, "%s:%d %s stat(\"%s\", &sb) error: %s", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
+    fprintf(stderr, "Usage: %s [--track video|audio|<handler>|all|--track-id <id>] [--cache|--cache-dir <dir>] [--seek <seconds>|-|--samples|--sample N|--sample-at <seconds>] <filename>\n", prog);
+    fprintf(stderr, "  --track T        index the first track with handler T (default: video)\n");
+    fprintf(stderr, "  --track all      index every track, lines start with the track ID\n");
+    fprintf(stderr, "  --track-id N     index the track with tkhd track ID N\n");
+    fprintf(stderr, "  --cache          reuse or write the index cache <filename>.kfidx\n");
+    fprintf(stderr, "  --cache-dir DIR  reuse or write the index cache in DIR instead\n");
+    fprintf(stderr, "  --seek T  print the keyframe shown at or before T seconds: pts offset sample dts\n");
+    fprintf(stderr, "  --seek -  answer one query per line read from stdin\n");
+    fprintf(stderr, "  --samples        print every sample instead of the keyframes:\n");
+    fprintf(stderr, "                   sample dts cts size offset sync chunk, times in time scale units\n");
+    fprintf(stderr, "  --sample N       print sample N (1-based) the same way\n");
+    fprintf(stderr, "  --sample-at T    print the sample being decoded at T seconds\n");
+    fprintf(stderr, "  --max-depth N    reject files with boxes nested deeper than N levels (default %d)\n", MP4_WALK_MAX_DEPTH);
+}
 
-    g_keyframe.fp = fopen(filename, "rb");
-    if (!g_keyframe.fp) {
-        fprintf(stderr, "%s:%d %s fopen(\"%s\", \"rb\") error: %s", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    g_keyframe.need_parse = true;
-    g_keyframe.content_buf = malloc(sb.st_size);
-    if (!g_keyframe.content_buf) {
-        fprintf(stderr, "%s:%d %s calloc(%ld) error: %s", __FILE__, __LINE__, __FUNCTION__, (long)sb.st_size, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    if (fread(g_keyframe.content_buf, 1, sb.st_size, g_keyframe.fp) != sb.st_size) {
-        fprintf(stderr, "%s:%d %s fread error: %s", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    mp4_box(g_keyframe.content_buf, sb.st_size, 0);
-    // stss sync sample table (keyframs table)
-    g_keyframe.keyframes_num = g_keyframe.stss_entry_num;
-    g_keyframe.keyframes_data = calloc(g_keyframe.keyframes_num, sizeof(*g_keyframe.keyframes_data));
-    for (int i = 0; i < g_keyframe.keyframes_num; i++) {
-        g_keyframe.keyframes_data[i].sync_sample = g_keyframe.stss_entry_data[i].sync_sample;
-    }
-    // stts time-to-sample
-    for (int i = 0; i < g_keyframe.keyframes_num; i++) {
-        int total_count = 0;
-        int total_duration = 0;
-        for (int j = 0; j < g_keyframe.stts_entry_num; j++) {
-            if (total_count + g_keyframe.stts_entry_data[j].sample_count >= g_keyframe.keyframes_data[i].sync_sample - 1) {
-                int extra_count = g_keyframe.keyframes_data[i].sync_sample - 1 - total_count;
-                if (extra_count < 0) {
-                    extra_count = 0;
-                }
-                g_keyframe.keyframes_data[i].sync_sample_duration = total_duration + extra_count * g_keyframe.stts_entry_data[j].sample_duration;
-                break;
-            }
-            total_count += g_keyframe.stts_entry_data[j].sample_count;
-            total_duration += g_keyframe.stts_entry_data[j].sample_count * g_keyframe.stts_entry_data[j].sample_duration;
-        }
-        g_keyframe.keyframes_data[i].sync_sample_time = (double)g_keyframe.keyframes_data[i].sync_sample_duration / g_keyframe.mdhd_time_scale;
+static void
+print_track_id(const mp4_track_t *track, bool all_tracks)
+{
+    if (all_tracks) {
+        printf("%u ", track->track_id);
     }
-    // stsc sample-to-chunk
-    for (int i = 0; i < g_keyframe.keyframes_num; i++) {
-        int total_sample = 0;
-        for (int j = 0; j < g_keyframe.stsc_entry_num; j++) {
-            uint32_t next_stsc_first_chunk = g_keyframe.stco_entry_num + 1;
-            if (j < g_keyframe.stsc_entry_num - 1) {
-                next_stsc_first_chunk = g_keyframe.stsc_entry_data[j + 1].first_chunk;
-            }
+}
 
-            int cur_sample = g_keyframe.stsc_entry_data[j].samples_per_chunk * (next_stsc_first_chunk - g_keyframe.stsc_entry_data[j].first_chunk);
-            if (total_sample + cur_sample >= g_keyframe.keyframes_data[i].sync_sample) {
-                g_keyframe.keyframes_data[i].sync_chunk = g_keyframe.stsc_entry_data[j].first_chunk + (g_keyframe.keyframes_data[i].sync_sample - total_sample - 1) / g_keyframe.stsc_entry_data[j].samples_per_chunk;
-                break;
-            }
-            total_sample += cur_sample;
-        }
-    }
-    // stco chunk offsete
-    for (int i = 0; i < g_keyframe.keyframes_num; i++) {
-        g_keyframe.keyframes_data[i].chunk_offset = g_keyframe.stco_entry_data[g_keyframe.keyframes_data[i].sync_chunk - 1].chunk_offset;
+static void
+print_keyframes(const mp4_track_t *track, bool all_tracks)
+{
+    const mp4_keyframes_t *keyframes = &track->keyframes;
+    for (size_t i = 0; i < keyframes->num; i++) {
+        print_track_id(track, all_tracks);
+        printf("%-7g %llu %g\n", keyframes->pts[i], (unsigned long long)keyframes->offset[i], keyframes->dts[i]);
     }
+}
 
-    for (int i = 0; i < g_keyframe.keyframes_num; i++) {
-        printf("%-7g %u\n", g_keyframe.keyframes_data[i].sync_sample_time, g_keyframe.keyframes_data[i].chunk_offset);
+static void
+print_samples(const mp4_track_t *track, bool all_tracks)
+{
+    const mp4_samples_t *samples = &track->samples;
+    for (size_t i = 0; i < samples->num; i++) {
+        print_track_id(track, all_tracks);
+        printf("%zu %llu %lld %u %llu %u %u\n", i + 1, (unsigned long long)samples->dts[i], (long long)samples->dts[i] + samples->cts_offset[i],
+            samples->size[i], (unsigned long long)samples->offset[i], samples->sync[i], samples->chunk[i]);
     }
-    exit(EXIT_SUCCESS);
 }
 
-static inline uint32_t
-get_u32(const uint8_t *p)
+// One sample by number, or the one decoded at time seconds when sample is 0
+static void
+print_sample(const mp4_track_t *track, bool all_tracks, uint32_t sample, double time)
 {
-    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    if (sample == 0) {
+        sample = mp4_track_sample_at(track, time > 0 ? (uint64_t)(time * track->time_scale) : 0);
+    }
+    mp4_sample_t s;
+    print_track_id(track, all_tracks);
+    if (!mp4_track_sample(track, sample, &s)) {
+        printf("-1\n");
+        return;
+    }
+    printf("%u %llu %lld %u %llu %d %u\n", s.sample, (unsigned long long)s.dts, (long long)s.dts + s.cts_offset, s.size, (unsigned long long)s.offset, s.sync,
+        s.chunk);
 }
 
-static inline uint64_t
-get_u64(const uint8_t *p)
+static void
+print_seek(const mp4_track_t *track, bool all_tracks, double time)
 {
-    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+    const mp4_keyframes_t *keyframes = &track->keyframes;
+    long i = mp4_keyframes_seek(keyframes, time);
+    print_track_id(track, all_tracks);
+    if (i < 0) {
+        printf("-1\n");
+        return;
+    }
+    printf("%-7g %llu %u %g\n", keyframes->pts[i], (unsigned long long)keyframes->offset[i], keyframes->sample[i], keyframes->dts[i]);
 }
 
-typedef void (*mp4_box_func)(const uint8_t *p, size_t len, int depth);
-static void mp4_box_mdhd(const uint8_t *p, size_t len, int depth);
-static void mp4_box_stss(const uint8_t *p, size_t len, int depth);
-static void mp4_box_stts(const uint8_t *p, size_t len, int depth);
-static void mp4_box_stsc(const uint8_t *p, size_t len, int depth);
-static void mp4_box_stco(const uint8_t *p, size_t len, int depth);
-
+// Batch mode: one time per line, one answer per line (per track) in the same order
 static void
-mp4_box(const uint8_t *buf, size_t len, int depth)
+seek_stdin(const mp4_index_t *index, const mp4_track_t *track)
 {
-    const uint8_t *p = buf;
-    const uint8_t *end = buf + len;
-
-    while (p < end) {
-        uint64_t box_size = get_u32(p);
-        char box_type[5] = {0};
-        strncpy(box_type, (const char *)p + 4, 4);
-        const uint8_t *box_data = p + 8;
-
-        if (box_size == 1) {
-            box_size = get_u64(box_data);
-            box_data = p + 16;
+    char line[256];
+    while (fgets(line, sizeof(line), stdin)) {
+        char *end = NULL;
+        double time = strtod(line, &end);
+        if (end == line) {
+            if (line[strspn(line, " \t\r\n")] != '\0') {
+                fprintf(stderr, "%s:%d %s invalid seek time: %s", __FILE__, __LINE__, __FUNCTION__, line);
+                printf("-1\n");
+            }
+            continue;
         }
-
-        mp4_box_func func = NULL;
-        if (strncmp(box_type, "moov", 4) == 0
-            || strncmp(box_type, "trak", 4) == 0
-            || strncmp(box_type, "mdia", 4) == 0
-            || strncmp(box_type, "minf", 4) == 0
-            || strncmp(box_type, "stbl", 4) == 0) {
-            func = mp4_box;
-        } else if (strncmp(box_type, "mdhd", 4) == 0) {
-            func = mp4_box_mdhd;
-        } else if (strncmp(box_type, "stss", 4) == 0) {
-            func = mp4_box_stss;
-        } else if (strncmp(box_type, "stts", 4) == 0) {
-            func = mp4_box_stts;
-        } else if (strncmp(box_type, "stsc", 4) == 0) {
-            func = mp4_box_stsc;
-        } else if (strncmp(box_type, "stco", 4) == 0) {
-            func = mp4_box_stco;
+        if (track) {
+            print_seek(track, false, time);
+            continue;
         }
-        if (func) {
-            func(box_data, box_size - (box_data - p), depth + 1);
+        for (size_t i = 0; i < mp4_index_track_num(index); i++) {
+            print_seek(mp4_index_track(index, i), true, time);
         }
-        p += box_size;
     }
 }
 
-static void
-mp4_box_mdhd(const uint8_t *p, size_t len, int depth)
+int main(int argc, char **argv)
 {
-    if (g_keyframe.stss_entry_num > 0) {
-        g_keyframe.need_parse = false;
+    static const struct option options[] = {
+        {"cache", no_argument, NULL, 'c'},
+        {"cache-dir", required_argument, NULL, 'C'},
+        {"seek", required_argument, NULL, 's'},
+        {"samples", no_argument, NULL, 'S'},
+        {"sample", required_argument, NULL, 'n'},
+        {"sample-at", required_argument, NULL, 'a'},
+        {"track", required_argument, NULL, 't'},
+        {"track-id", required_argument, NULL, 'i'},
+        {"max-depth", required_argument, NULL, 'd'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    const char *seek = NULL;
+    const char *cache_dir = NULL;
+    bool cache = false;
+    bool samples = false;
+    long sample = -1;
+    double sample_time = -1;
+    const char *handler = NULL;
+    bool all_tracks = false;
+    long track_id = -1;
+    long max_depth = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "cC:s:t:i:d:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            if (strcmp(optarg, "all") == 0) {
+                all_tracks = true;
+            } else if (strcmp(optarg, "video") == 0) {
+                handler = "vide";
+            } else if (strcmp(optarg, "audio") == 0) {
+                handler = "soun";
+            } else if (strlen(optarg) == 4) {
+                handler = optarg;
+            } else {
+                fprintf(stderr, "%s:%d %s invalid track: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i': {
+            char *end = NULL;
+            track_id = strtol(optarg, &end, 0);
+            if (end == optarg || *end != '\0' || track_id < 0 || track_id > UINT32_MAX) {
+                fprintf(stderr, "%s:%d %s invalid track ID: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'd': {
+            char *end = NULL;
+            max_depth = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || max_depth < 1 || max_depth > 1024) {
+                fprintf(stderr, "%s:%d %s invalid max depth: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'c':
+            cache = true;
+            break;
+        case 'C':
+            cache = true;
+            cache_dir = optarg;
+            break;
+        case 's':
+            seek = optarg;
+            break;
+        case 'S':
+            samples = true;
+            break;
+        case 'n': {
+            char *end = NULL;
+            sample = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || sample < 1 || sample > UINT32_MAX) {
+                fprintf(stderr, "%s:%d %s invalid sample: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'a': {
+            char *end = NULL;
+            sample_time = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || sample_time < 0) {
+                fprintf(stderr, "%s:%d %s invalid sample time: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
     }
-
-    if (g_keyframe.need_parse) {
-        g_keyframe.mdhd_time_scale = get_u32(p + 12);
+    if (optind >= argc || (seek != NULL) + samples + (sample >= 0) + (sample_time >= 0) > 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
     }
-}
 
-static void
-mp4_box_stss(const uint8_t *p, size_t len, int depth)
-{
-    if (!g_keyframe.need_parse) {
-        return;
+    double seek_time = 0;
+    if (seek && strcmp(seek, "-") != 0) {
+        char *end = NULL;
+        seek_time = strtod(seek, &end);
+        if (end == seek || *end != '\0') {
+            fprintf(stderr, "%s:%d %s invalid seek time: %s\n", __FILE__, __LINE__, __FUNCTION__, seek);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    g_keyframe.stss_entry_num = get_u32(p + 4);
-    g_keyframe.stss_entry_data = calloc(g_keyframe.stss_entry_num, sizeof(*g_keyframe.stss_entry_data));
-    for (uint32_t i = 0; i < g_keyframe.stss_entry_num; i++) {
-        g_keyframe.stss_entry_data[i].sync_sample = get_u32(p + 8 + i * 4);
-    }
-}
+    const char *filename = argv[optind];
 
-static void
-mp4_box_stts(const uint8_t *p, size_t len, int depth)
-{
-    if (!g_keyframe.need_parse) {
-        return;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s:%d %s open(\"%s\", O_RDONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    g_keyframe.stts_entry_num = get_u32(p + 4);
-    g_keyframe.stts_entry_data = calloc(g_keyframe.stts_entry_num, sizeof(*g_keyframe.stts_entry_data));
-    for (uint32_t i = 0; i < g_keyframe.stts_entry_num; i++) {
-        g_keyframe.stts_entry_data[i].sample_count = get_u32(p + 8 + i * 8);
-        g_keyframe.stts_entry_data[i].sample_duration = get_u32(p + 8 + i * 8 + 4);
+    mp4_index_t *index = mp4_index_create();
+    if (!index) {
+        fprintf(stderr, "%s:%d %s mp4_index_create error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        close(fd);
+        exit(EXIT_FAILURE);
     }
-}
+    mp4_index_set_max_depth(index, max_depth);
+    mp4_index_set_samples(index, samples);
 
-static void
-mp4_box_stsc(const uint8_t *p, size_t len, int depth)
-{
-    if (!g_keyframe.need_parse) {
-        return;
+    struct stat sb = {0};
+    if (fstat(fd, &sb) < 0) {
+        fprintf(stderr, "%s:%d %s fstat(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+        mp4_index_destroy(index);
+        close(fd);
+        exit(EXIT_FAILURE);
     }
 
-    g_keyframe.stsc_entry_num = get_u32(p + 4);
-    g_keyframe.stsc_entry_data = calloc(g_keyframe.stsc_entry_num, sizeof(*g_keyframe.stsc_entry_data));
-    for (uint32_t i = 0; i < g_keyframe.stsc_entry_num; i++) {
-        g_keyframe.stsc_entry_data[i].first_chunk = get_u32(p + 8 + 12 * i);
-        g_keyframe.stsc_entry_data[i].samples_per_chunk = get_u32(p + 8 + 12 * i + 4);
+    char cache_path[4096] = {0};
+    int n = 0;
+    if (cache_dir) {
+        n = snprintf(cache_path, sizeof(cache_path), "%s/%llx-%llx.kfidx", cache_dir, (unsigned long long)sb.st_dev, (unsigned long long)sb.st_ino);
+    } else if (cache) {
+        n = snprintf(cache_path, sizeof(cache_path), "%s.kfidx", filename);
+    }
+    // a truncated path would name some other file
+    if (n < 0 || (size_t)n >= sizeof(cache_path)) {
+        fprintf(stderr, "%s:%d %s cache path for \"%s\" too long\n", __FILE__, __LINE__, __FUNCTION__, filename);
+        mp4_index_destroy(index);
+        close(fd);
+        exit(EXIT_FAILURE);
     }
-}
 
-static void
-mp4_box_stco(const uint8_t *p, size_t len, int depth)
-{
-    if (!g_keyframe.need_parse) {
-        return;
+    // the cache has neither the samples nor the sample tables, it is only
+    // written then
+    const bool tables = samples || sample >= 0 || sample_time >= 0;
+    int err = MP4_INDEX_ERR_STALE;
+    if (cache && !tables) {
+        err = mp4_index_cache_load(cache_path, &sb, index);
+    }
+    if (err != MP4_INDEX_OK) {
+        err = mp4_index_build_fd(fd, index);
+        if (err == MP4_INDEX_OK && cache) {
+            int cache_err = mp4_index_cache_save(cache_path, &sb, index);
+            if (cache_err != MP4_INDEX_OK) {
+                fprintf(stderr, "%s:%d %s mp4_index_cache_save(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, cache_path, mp4_index_strerror(cache_err));
+            }
+        }
+    }
+    close(fd);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_index_build_fd(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, mp4_index_strerror(err));
+        mp4_index_destroy(index);
+        exit(EXIT_FAILURE);
     }
 
-    g_keyframe.stco_entry_num = get_u32(p + 4);
-    g_keyframe.stco_entry_data = calloc(g_keyframe.stco_entry_num, sizeof(*g_keyframe.stco_entry_data));
-    for (uint32_t i = 0; i < g_keyframe.stco_entry_num; i++) {
-        g_keyframe.stco_entry_data[i].chunk_offset = get_u32(p + 8 + i * 4);
+    // NULL with --track all
+    const mp4_track_t *track = NULL;
+    if (track_id >= 0) {
+        track = mp4_index_track_by_id(index, track_id);
+    } else if (handler) {
+        track = mp4_index_track_by_handler(index, handler);
+    } else if (!all_tracks) {
+        track = mp4_index_default_track(index);
+    }
+    if (!track && !all_tracks) {
+        fprintf(stderr, "%s:%d %s no such track in \"%s\"\n", __FILE__, __LINE__, __FUNCTION__, filename);
+        mp4_index_destroy(index);
+        exit(EXIT_FAILURE);
     }
-}
 
-static void
-free_keyframe_data(void)
-{
-    free(g_keyframe.stss_entry_data);
-    free(g_keyframe.stts_entry_data);
-    free(g_keyframe.stsc_entry_data);
-    free(g_keyframe.stco_entry_data);
-    free(g_keyframe.keyframes_data);
-    free(g_keyframe.content_buf);
-    if (g_keyframe.fp) {
-        fclose(g_keyframe.fp);
+    if (seek && strcmp(seek, "-") == 0) {
+        seek_stdin(index, track);
+    } else if (track) {
+        if (seek) {
+            print_seek(track, false, seek_time);
+        } else if (samples) {
+            print_samples(track, false);
+        } else if (sample >= 0 || sample_time >= 0) {
+            print_sample(track, false, sample > 0 ? sample : 0, sample_time);
+        } else {
+            print_keyframes(track, false);
+        }
+    } else {
+        for (size_t i = 0; i < mp4_index_track_num(index); i++) {
+            if (seek) {
+                print_seek(mp4_index_track(index, i), true, seek_time);
+            } else if (samples) {
+                print_samples(mp4_index_track(index, i), true);
+            } else if (sample >= 0 || sample_time >= 0) {
+                print_sample(mp4_index_track(index, i), true, sample > 0 ? sample : 0, sample_time);
+            } else {
+                print_keyframes(mp4_index_track(index, i), true);
+            }
+        }
     }
-    memset(&g_keyframe, 0, sizeof(g_keyframe));
+
+    mp4_index_destroy(index);
+    return EXIT_SUCCESS;
 }
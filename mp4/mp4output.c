@@ -0,0 +1,880 @@
+#include "mp4output.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MP4_OUTPUT_BUF_SIZE (256 * 1024)
+#define MP4_INDENT_DEPTH 32
+#define MP4_OUTPUT_KEYS 64
+
+// All output state is per thread, see mp4_output_capture_begin()
+static _Thread_local struct {
+    int fd;
+    mp4_output_format_t format;
+    size_t len;
+    char buf[MP4_OUTPUT_BUF_SIZE];
+    // full buffers go here instead of fd while capturing
+    bool capture;
+    char *capture_buf;
+    size_t capture_len;
+    size_t capture_cap;
+} g_output = {.fd = STDOUT_FILENO};
+
+// JSON: fields of the innermost open box not written yet, and their keys.
+// Binary: the record being built.
+static _Thread_local struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t key_num;
+    struct {
+        const char *key;
+        size_t len;
+    } keys[MP4_OUTPUT_KEYS];
+} g_fields;
+
+// Open boxes, outermost first
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    int depth;
+    bool emitted;  // JSON: its first object is written
+    char type[16];
+} mp4_output_box_t;
+
+static _Thread_local struct {
+    mp4_output_box_t *boxes;
+    size_t num;
+    size_t cap;
+} g_boxes;
+
+// Table being printed
+static _Thread_local struct {
+    int depth;
+    int cols;
+    uint32_t rows;
+    size_t rows_offset;  // binary: where the row count goes in the record
+} g_table;
+
+// "|  " repeated MP4_INDENT_DEPTH times, deeper levels copy it again
+static const char g_indent[] = "|  |  |  |  |  |  |  |  |  |  |  |  |  |  |  |  "
+                               "|  |  |  |  |  |  |  |  |  |  |  |  |  |  |  |  ";
+
+static const char g_digits[] = "00010203040506070809"
+                               "10111213141516171819"
+                               "20212223242526272829"
+                               "30313233343536373839"
+                               "40414243444546474849"
+                               "50515253545556575859"
+                               "60616263646566676869"
+                               "70717273747576777879"
+                               "80818283848586878889"
+                               "90919293949596979899";
+
+void
+mp4_output_open(int fd, mp4_output_format_t format)
+{
+    mp4_output_flush();
+    g_output.fd = fd;
+    g_output.format = format;
+}
+
+mp4_output_format_t
+mp4_output_format(void)
+{
+    return g_output.format;
+}
+
+static bool
+write_full(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Written output: to the file descriptor, or to the capture buffer
+static bool
+mp4_output_sink(const char *p, size_t len)
+{
+    if (!g_output.capture) {
+        return write_full(g_output.fd, p, len);
+    }
+    if (len > g_output.capture_cap - g_output.capture_len) {
+        size_t cap = g_output.capture_cap ? g_output.capture_cap * 2 : MP4_OUTPUT_BUF_SIZE;
+        while (cap - g_output.capture_len < len) {
+            cap *= 2;
+        }
+        char *buf = realloc(g_output.capture_buf, cap);
+        if (!buf) {
+            errno = ENOMEM;
+            return false;
+        }
+        g_output.capture_buf = buf;
+        g_output.capture_cap = cap;
+    }
+    memcpy(g_output.capture_buf + g_output.capture_len, p, len);
+    g_output.capture_len += len;
+    return true;
+}
+
+int
+mp4_output_flush(void)
+{
+    const size_t len = g_output.len;
+    g_output.len = 0;
+    return mp4_output_sink(g_output.buf, len) ? 0 : -1;
+}
+
+void
+mp4_output_capture_begin(mp4_output_format_t format)
+{
+    mp4_output_flush();
+    g_output.format = format;
+    g_output.capture = true;
+    g_output.capture_len = 0;
+}
+
+char *
+mp4_output_capture_end(size_t *len)
+{
+    mp4_output_flush();
+    char *buf = g_output.capture_buf;
+    *len = g_output.capture_len;
+    g_output.capture = false;
+    g_output.capture_buf = NULL;
+    g_output.capture_len = 0;
+    g_output.capture_cap = 0;
+
+    free(g_fields.buf);
+    memset(&g_fields, 0, sizeof(g_fields));
+    free(g_boxes.boxes);
+    memset(&g_boxes, 0, sizeof(g_boxes));
+    return buf;
+}
+
+static void
+mp4_output_write(const void *p, size_t len)
+{
+    if (len > sizeof(g_output.buf) - g_output.len) {
+        mp4_output_flush();
+        if (len > sizeof(g_output.buf)) {
+            mp4_output_sink(p, len);
+            return;
+        }
+    }
+    memcpy(g_output.buf + g_output.len, p, len);
+    g_output.len += len;
+}
+
+static void
+mp4_output_char(char c)
+{
+    if (g_output.len == sizeof(g_output.buf)) {
+        mp4_output_flush();
+    }
+    g_output.buf[g_output.len++] = c;
+}
+
+// Decimal digits of v at the end of buf[20], two at a time; returns the first
+static char *
+mp4_format_u64(char *end, uint64_t v)
+{
+    char *p = end;
+    while (v >= 100) {
+        const unsigned i = (v % 100) * 2;
+        v /= 100;
+        *--p = g_digits[i + 1];
+        *--p = g_digits[i];
+    }
+    if (v >= 10) {
+        *--p = g_digits[v * 2 + 1];
+        *--p = g_digits[v * 2];
+    } else {
+        *--p = '0' + v;
+    }
+    return p;
+}
+
+static void
+mp4_fields_write(const void *p, size_t len)
+{
+    if (len > g_fields.cap - g_fields.len) {
+        size_t cap = g_fields.cap ? g_fields.cap * 2 : 4096;
+        while (cap - g_fields.len < len) {
+            cap *= 2;
+        }
+        char *buf = realloc(g_fields.buf, cap);
+        if (!buf) {
+            return;
+        }
+        g_fields.buf = buf;
+        g_fields.cap = cap;
+    }
+    memcpy(g_fields.buf + g_fields.len, p, len);
+    g_fields.len += len;
+}
+
+static void
+mp4_fields_char(char c)
+{
+    mp4_fields_write(&c, 1);
+}
+
+static void
+mp4_fields_u64(uint64_t v)
+{
+    char buf[20];
+    char *p = mp4_format_u64(buf + sizeof(buf), v);
+    mp4_fields_write(p, buf + sizeof(buf) - p);
+}
+
+static void
+mp4_fields_le(uint64_t v, int bytes)
+{
+    uint8_t buf[8];
+    for (int i = 0; i < bytes; i++) {
+        buf[i] = v >> (i * 8);
+    }
+    mp4_fields_write(buf, bytes);
+}
+
+// JSON string, bytes outside printable ASCII as \u00XX
+static void
+mp4_fields_json_str(const char *s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    mp4_fields_char('"');
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t c = s[i];
+        if (c == '"' || c == '\\') {
+            mp4_fields_char('\\');
+            mp4_fields_char(c);
+        } else if (c >= 0x20 && c < 0x7f) {
+            mp4_fields_char(c);
+        } else {
+            const char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            mp4_fields_write(esc, sizeof(esc));
+        }
+    }
+    mp4_fields_char('"');
+}
+
+// Key of a field: the label without the padding, "0x" prefix and colon that
+// only serve the text layout
+static size_t
+mp4_label_key(const char *label)
+{
+    size_t len = strlen(label);
+    while (len > 0 && label[len - 1] == ' ') {
+        len--;
+    }
+    if (len >= 2 && label[len - 2] == '0' && label[len - 1] == 'x') {
+        len -= 2;
+        while (len > 0 && label[len - 1] == ' ') {
+            len--;
+        }
+    }
+    if (len > 0 && label[len - 1] == ':') {
+        len--;
+    }
+    while (len > 0 && label[len - 1] == ' ') {
+        len--;
+    }
+    return len;
+}
+
+// Binary record: the kind byte goes first, the length is prepended on write
+static void
+mp4_record_begin(char kind)
+{
+    g_fields.len = 0;
+    mp4_fields_char(kind);
+}
+
+static void
+mp4_record_end(void)
+{
+    uint8_t len[4];
+    for (int i = 0; i < 4; i++) {
+        len[i] = g_fields.len >> (i * 8);
+    }
+    mp4_output_write(len, sizeof(len));
+    mp4_output_write(g_fields.buf, g_fields.len);
+    g_fields.len = 0;
+}
+
+static void
+mp4_record_key(const char *label)
+{
+    size_t len = mp4_label_key(label);
+    if (len > UINT8_MAX) {
+        len = UINT8_MAX;
+    }
+    mp4_fields_char(len);
+    mp4_fields_write(label, len);
+}
+
+// Start a JSON field, "key": after a comma if needed
+static void
+mp4_json_key(const char *label)
+{
+    const size_t len = mp4_label_key(label);
+    int seen = 1;
+    for (size_t i = 0; i < g_fields.key_num; i++) {
+        if (g_fields.keys[i].len == len && memcmp(g_fields.keys[i].key, label, len) == 0) {
+            seen++;
+        }
+    }
+    if (g_fields.key_num < MP4_OUTPUT_KEYS) {
+        g_fields.keys[g_fields.key_num].key = label;
+        g_fields.keys[g_fields.key_num].len = len;
+        g_fields.key_num++;
+    }
+
+    if (g_fields.len > 0) {
+        mp4_fields_char(',');
+    }
+    if (seen == 1) {
+        mp4_fields_json_str(label, len);
+    } else {
+        char key[512];
+        int n = snprintf(key, sizeof(key), "%.*s#%d", (int)len, label, seen);
+        mp4_fields_json_str(key, n < (int)sizeof(key) ? n : (int)sizeof(key) - 1);
+    }
+    mp4_fields_char(':');
+}
+
+// The object of the innermost open box with the fields collected so far
+static void
+mp4_json_box_emit(mp4_output_box_t *box)
+{
+    char buf[20];
+    char *p;
+
+    mp4_output_write("{\"offset\":", 10);
+    p = mp4_format_u64(buf + sizeof(buf), box->offset);
+    mp4_output_write(p, buf + sizeof(buf) - p);
+    mp4_output_write(",\"size\":", 8);
+    p = mp4_format_u64(buf + sizeof(buf), box->size);
+    mp4_output_write(p, buf + sizeof(buf) - p);
+    mp4_output_write(",\"type\":", 8);
+    // the type goes through the field buffer for escaping, after the fields
+    const size_t fields_len = g_fields.len;
+    mp4_fields_json_str(box->type, strlen(box->type));
+    mp4_output_write(g_fields.buf + fields_len, g_fields.len - fields_len);
+    g_fields.len = fields_len;
+    mp4_output_write(",\"depth\":", 9);
+    p = mp4_format_u64(buf + sizeof(buf), box->depth);
+    mp4_output_write(p, buf + sizeof(buf) - p);
+    if (box->emitted) {
+        mp4_output_write(",\"continued\":true", 17);
+    }
+    mp4_output_write(",\"fields\":{", 11);
+    mp4_output_write(g_fields.buf, g_fields.len);
+    mp4_output_write("}}\n", 3);
+
+    box->emitted = true;
+    g_fields.len = 0;
+    g_fields.key_num = 0;
+}
+
+void
+mp4_box_begin(int depth, uint64_t offset, uint64_t size, const char *type)
+{
+    if (g_output.format == MP4_OUTPUT_TEXT) {
+        return;
+    }
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        const size_t type_len = strnlen(type, UINT8_MAX);
+        mp4_record_begin('B');
+        mp4_fields_le(offset, 8);
+        mp4_fields_le(size, 8);
+        mp4_fields_le(depth, 4);
+        mp4_fields_char(type_len);
+        mp4_fields_write(type, type_len);
+        mp4_record_end();
+        return;
+    }
+
+    if (g_boxes.num > 0) {
+        mp4_output_box_t *parent = &g_boxes.boxes[g_boxes.num - 1];
+        if (!parent->emitted || g_fields.len > 0) {
+            mp4_json_box_emit(parent);
+        }
+    }
+    if (g_boxes.num == g_boxes.cap) {
+        const size_t cap = g_boxes.cap ? g_boxes.cap * 2 : 32;
+        mp4_output_box_t *boxes = realloc(g_boxes.boxes, cap * sizeof(*boxes));
+        if (!boxes) {
+            return;
+        }
+        g_boxes.boxes = boxes;
+        g_boxes.cap = cap;
+    }
+    mp4_output_box_t *box = &g_boxes.boxes[g_boxes.num++];
+    box->offset = offset;
+    box->size = size;
+    box->depth = depth;
+    box->emitted = false;
+    snprintf(box->type, sizeof(box->type), "%s", type);
+    g_fields.len = 0;
+    g_fields.key_num = 0;
+}
+
+void
+mp4_box_end(void)
+{
+    if (g_output.format == MP4_OUTPUT_TEXT) {
+        return;
+    }
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        mp4_record_begin('E');
+        mp4_record_end();
+        return;
+    }
+
+    if (g_boxes.num == 0) {
+        return;
+    }
+    mp4_output_box_t *box = &g_boxes.boxes[g_boxes.num - 1];
+    if (!box->emitted || g_fields.len > 0) {
+        mp4_json_box_emit(box);
+    }
+    g_boxes.num--;
+    g_fields.len = 0;
+    g_fields.key_num = 0;
+}
+
+void
+mp4_output_append(const void *p, size_t len)
+{
+    if (g_output.format == MP4_OUTPUT_JSON && g_boxes.num > 0) {
+        // the open box goes first, as before a child of its own
+        mp4_output_box_t *parent = &g_boxes.boxes[g_boxes.num - 1];
+        if (!parent->emitted || g_fields.len > 0) {
+            mp4_json_box_emit(parent);
+        }
+    }
+    mp4_output_write(p, len);
+}
+
+void
+mp4_out_write(const void *p, size_t len)
+{
+    if (g_output.format == MP4_OUTPUT_TEXT) {
+        mp4_output_write(p, len);
+    }
+}
+
+void
+mp4_out_str(const char *s)
+{
+    if (g_output.format == MP4_OUTPUT_TEXT) {
+        mp4_output_write(s, strlen(s));
+    }
+}
+
+void
+mp4_out_char(char c)
+{
+    if (g_output.format == MP4_OUTPUT_TEXT) {
+        mp4_output_char(c);
+    }
+}
+
+void
+mp4_out_indent(int depth, int header)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        return;
+    }
+    for (; depth > MP4_INDENT_DEPTH; depth -= MP4_INDENT_DEPTH) {
+        mp4_output_write(g_indent, MP4_INDENT_DEPTH * 3);
+    }
+    if (depth > 0) {
+        mp4_output_write(g_indent, depth * 3);
+    }
+    if (header) {
+        mp4_output_char('+');
+    }
+}
+
+static void
+mp4_out_padded(const char *p, size_t len, char pad, int width)
+{
+    for (int i = len; i < width; i++) {
+        mp4_output_char(pad);
+    }
+    mp4_output_write(p, len);
+}
+
+void
+mp4_out_u64(uint64_t v)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        return;
+    }
+    char buf[20];
+    char *p = mp4_format_u64(buf + sizeof(buf), v);
+    mp4_output_write(p, buf + sizeof(buf) - p);
+}
+
+void
+mp4_out_i64(int64_t v)
+{
+    if (v < 0) {
+        mp4_out_char('-');
+        mp4_out_u64(-(uint64_t)v);
+        return;
+    }
+    mp4_out_u64(v);
+}
+
+void
+mp4_out_u64_width(uint64_t v, int width)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        return;
+    }
+    char buf[20];
+    char *p = mp4_format_u64(buf + sizeof(buf), v);
+    mp4_out_padded(p, buf + sizeof(buf) - p, ' ', width);
+}
+
+void
+mp4_out_u64_zero(uint64_t v, int digits)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        return;
+    }
+    char buf[20];
+    char *p = mp4_format_u64(buf + sizeof(buf), v);
+    mp4_out_padded(p, buf + sizeof(buf) - p, '0', digits);
+}
+
+void
+mp4_out_hex(uint64_t v, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        return;
+    }
+    char buf[16];
+    char *p = buf + sizeof(buf);
+    do {
+        *--p = hex[v & 0xf];
+        v >>= 4;
+    } while (v);
+    mp4_out_padded(p, buf + sizeof(buf) - p, '0', digits);
+}
+
+void
+mp4_out_printf(const char *fmt, ...)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        return;
+    }
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < sizeof(buf)) {
+        mp4_output_write(buf, n);
+        return;
+    }
+
+    // longer than the stack buffer: format straight into the output buffer
+    mp4_output_flush();
+    va_start(ap, fmt);
+    if ((size_t)n < sizeof(g_output.buf)) {
+        vsnprintf(g_output.buf, sizeof(g_output.buf), fmt, ap);
+        g_output.len = n;
+    } else if (!g_output.capture) {
+        vdprintf(g_output.fd, fmt, ap);
+    } else {
+        char *text = malloc(n + 1);
+        if (text) {
+            vsnprintf(text, n + 1, fmt, ap);
+            mp4_output_sink(text, n);
+            free(text);
+        }
+    }
+    va_end(ap);
+}
+
+static void
+mp4_field_label(int depth, const char *label)
+{
+    mp4_out_indent(depth, 0);
+    mp4_output_write("  ", 2);
+    mp4_output_write(label, strlen(label));
+}
+
+// Structured value of a field: JSON "key":value into the fields of the box,
+// or a complete binary record
+static void
+mp4_field_number(const char *label, uint64_t v, bool is_signed)
+{
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        mp4_record_begin('F');
+        mp4_record_key(label);
+        mp4_fields_char(is_signed ? 1 : 0);
+        mp4_fields_le(v, 8);
+        mp4_record_end();
+        return;
+    }
+    mp4_json_key(label);
+    if (is_signed && (int64_t)v < 0) {
+        mp4_fields_char('-');
+        v = -v;
+    }
+    mp4_fields_u64(v);
+}
+
+static void
+mp4_field_string(const char *label, const char *s, size_t len)
+{
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        mp4_record_begin('F');
+        mp4_record_key(label);
+        mp4_fields_char(2);
+        mp4_fields_le(len, 4);
+        mp4_fields_write(s, len);
+        mp4_record_end();
+        return;
+    }
+    mp4_json_key(label);
+    mp4_fields_json_str(s, len);
+}
+
+void
+mp4_field_u(int depth, const char *label, uint64_t v)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        mp4_field_number(label, v, false);
+        return;
+    }
+    mp4_field_label(depth, label);
+    mp4_out_u64(v);
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_i(int depth, const char *label, int64_t v)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        mp4_field_number(label, v, true);
+        return;
+    }
+    mp4_field_label(depth, label);
+    mp4_out_i64(v);
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_f(int depth, const char *label, double v, int decimals)
+{
+    char text[64];
+    int len = snprintf(text, sizeof(text), "%.*f", decimals, v);
+    if (len < 0 || (size_t)len >= sizeof(text)) {
+        len = snprintf(text, sizeof(text), "%g", v);
+    }
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        mp4_record_begin('F');
+        mp4_record_key(label);
+        mp4_fields_char(3);
+        mp4_fields_le(bits, 8);
+        mp4_record_end();
+        return;
+    }
+    if (g_output.format == MP4_OUTPUT_JSON) {
+        mp4_json_key(label);
+        mp4_fields_write(text, len);
+        return;
+    }
+    mp4_field_label(depth, label);
+    mp4_output_write(text, len);
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_hex(int depth, const char *label, uint64_t v, int digits)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        mp4_field_number(label, v, false);
+        return;
+    }
+    mp4_field_label(depth, label);
+    mp4_out_hex(v, digits);
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_str(int depth, const char *label, const char *s)
+{
+    mp4_field_strn(depth, label, s, strlen(s));
+}
+
+void
+mp4_field_strn(int depth, const char *label, const char *s, size_t len)
+{
+    len = strnlen(s, len);
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        mp4_field_string(label, s, len);
+        return;
+    }
+    mp4_field_label(depth, label);
+    mp4_output_write(s, len);
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_hexbytes(int depth, const char *label, const uint8_t *p, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    if (g_output.format == MP4_OUTPUT_TEXT) {
+        mp4_field_label(depth, label);
+        for (size_t i = 0; i < len; i++) {
+            mp4_out_hex(p[i], 2);
+        }
+        mp4_output_char('\n');
+        return;
+    }
+
+    // the same digits as a string value
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        mp4_record_begin('F');
+        mp4_record_key(label);
+        mp4_fields_char(2);
+        mp4_fields_le(len * 2, 4);
+    } else {
+        mp4_json_key(label);
+        mp4_fields_char('"');
+    }
+    for (size_t i = 0; i < len; i++) {
+        const char digits[2] = {hex[p[i] >> 4], hex[p[i] & 0xf]};
+        mp4_fields_write(digits, sizeof(digits));
+    }
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        mp4_record_end();
+    } else {
+        mp4_fields_char('"');
+    }
+}
+
+void
+mp4_field_bytes(int depth, const char *label, const uint8_t *p, size_t len)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        mp4_field_string(label, (const char *)p, len);
+        return;
+    }
+    mp4_field_label(depth, label);
+    mp4_output_write(p, len);
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_text(int depth, const char *text)
+{
+    if (g_output.format != MP4_OUTPUT_TEXT) {
+        return;
+    }
+    mp4_field_label(depth, text);
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_table_begin(int depth, const char *label, const char *header, int cols)
+{
+    g_table.depth = depth;
+    g_table.cols = cols;
+    g_table.rows = 0;
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        mp4_record_begin('T');
+        mp4_record_key(label);
+        mp4_fields_le(cols, 4);
+        g_table.rows_offset = g_fields.len;
+        mp4_fields_le(0, 4);
+        return;
+    }
+    if (g_output.format == MP4_OUTPUT_JSON) {
+        mp4_json_key(label);
+        mp4_fields_char('[');
+        return;
+    }
+    mp4_field_label(depth, label);
+    mp4_output_write(":\n", 2);
+    mp4_field_label(depth, "           ");
+    mp4_output_write(header, strlen(header));
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_table_row(const uint64_t *v)
+{
+    g_table.rows++;
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        for (int i = 0; i < g_table.cols; i++) {
+            mp4_fields_le(v[i], 8);
+        }
+        return;
+    }
+    if (g_output.format == MP4_OUTPUT_JSON) {
+        if (g_table.rows > 1) {
+            mp4_fields_char(',');
+        }
+        mp4_fields_char('[');
+        for (int i = 0; i < g_table.cols; i++) {
+            if (i > 0) {
+                mp4_fields_char(',');
+            }
+            mp4_fields_u64(v[i]);
+        }
+        mp4_fields_char(']');
+        return;
+    }
+    mp4_out_indent(g_table.depth, 0);
+    mp4_output_write("      ", 6);
+    mp4_out_u64_width(g_table.rows, 3);
+    mp4_output_char(':');
+    for (int i = 0; i < g_table.cols; i++) {
+        mp4_output_write("   ", 3);
+        mp4_out_u64_width(v[i], 6);
+    }
+    mp4_output_char('\n');
+}
+
+void
+mp4_field_table_end(void)
+{
+    if (g_output.format == MP4_OUTPUT_BINARY) {
+        for (int i = 0; i < 4; i++) {
+            g_fields.buf[g_table.rows_offset + i] = g_table.rows >> (i * 8);
+        }
+        mp4_record_end();
+    } else if (g_output.format == MP4_OUTPUT_JSON) {
+        mp4_fields_char(']');
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef _MP4_OUTPUT_H_2018
+#define _MP4_OUTPUT_H_2018
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Buffered output of mp4parse. Everything is appended to one reusable
+// buffer that is written to the file descriptor when it fills up and on
+// mp4_output_flush(), so a dump costs a few large write() calls. Indent
+// prefixes are copied from a precomputed string and integers are formatted
+// without going through printf.
+//
+// The box printers describe a box with mp4_box_begin/end and the field calls
+// below, and the output format decides what that becomes:
+//
+// MP4_OUTPUT_TEXT: the indented tree. mp4_out_* calls write text as is.
+//
+// MP4_OUTPUT_JSON: one JSON object per line and per box,
+//   {"offset":N,"size":N,"type":"moov","depth":N,"fields":{"Version":0,...}}
+//   written before the objects of its children. Fields printed after the
+//   children come in a second object of the same box with "continued":true.
+//   Keys are the labels without their colon and padding, a repeated key gets
+//   "#2", "#3"... appended. Tables are arrays of rows. mp4_out_* text is
+//   dropped.
+//
+// MP4_OUTPUT_BINARY: a stream of records, each a little-endian uint32 length
+//   of the rest of the record, one kind byte and its payload; integers are
+//   little-endian and strings are a length then the bytes:
+//   'B' box begin: u64 offset, u64 size, u32 depth, u8 type length, type
+//   'E' box end
+//   'F' field: u8 key length, key, u8 value kind, then
+//       0 u64 | 1 i64 | 2 u32 length and bytes | 3 f64
+//   'T' table: u8 key length, key, u32 columns, u32 rows, u64 values row by row
+//   mp4_out_* text is dropped.
+
+typedef enum {
+    MP4_OUTPUT_TEXT,
+    MP4_OUTPUT_JSON,
+    MP4_OUTPUT_BINARY,
+} mp4_output_format_t;
+
+void mp4_output_open(int fd, mp4_output_format_t format);
+mp4_output_format_t mp4_output_format(void);
+// Write out the buffered output; 0 or -1 with errno set
+int mp4_output_flush(void);
+
+// The output state is per thread. A worker thread captures what it prints,
+// in the given format, instead of writing it out; mp4_output_capture_end()
+// hands the bytes over (malloc'ed, freed by the caller) and releases the
+// thread's state. Another thread then writes the captures in order with
+// mp4_output_append(), after the boxes it has open.
+void mp4_output_capture_begin(mp4_output_format_t format);
+char *mp4_output_capture_end(size_t *len);
+void mp4_output_append(const void *p, size_t len);
+
+// A box or any other record with children, e.g. a NAL unit in mdat. Nothing
+// in text mode, where the printer writes its own header line.
+void mp4_box_begin(int depth, uint64_t offset, uint64_t size, const char *type);
+void mp4_box_end(void);
+
+void mp4_out_write(const void *p, size_t len);
+void mp4_out_str(const char *s);
+void mp4_out_char(char c);
+// "|  " per depth level, then "+" for a box or sample header line
+void mp4_out_indent(int depth, int header);
+// %u / %d
+void mp4_out_u64(uint64_t v);
+void mp4_out_i64(int64_t v);
+// %*u: right aligned in width columns
+void mp4_out_u64_width(uint64_t v, int width);
+// %.*u: zero padded to at least digits digits
+void mp4_out_u64_zero(uint64_t v, int digits);
+// %.*x: lower-case hex zero padded to at least digits digits
+void mp4_out_hex(uint64_t v, int digits);
+// Anything the calls above do not cover
+void mp4_out_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// One "<indent>  <label><value>\n" line. The label carries its colon and the
+// padding that aligns the values of a box, e.g. "Version:     ".
+void mp4_field_u(int depth, const char *label, uint64_t v);
+void mp4_field_i(int depth, const char *label, int64_t v);
+void mp4_field_hex(int depth, const char *label, uint64_t v, int digits);
+// %.*f: decimals digits after the point, a JSON number too
+void mp4_field_f(int depth, const char *label, double v, int decimals);
+void mp4_field_str(int depth, const char *label, const char *s);
+// At most len bytes of s, up to its first NUL, like %.*s
+void mp4_field_strn(int depth, const char *label, const char *s, size_t len);
+// len bytes as two hex digits each, like a run of %.2x
+void mp4_field_hexbytes(int depth, const char *label, const uint8_t *p, size_t len);
+// len raw bytes, like a run of %c
+void mp4_field_bytes(int depth, const char *label, const uint8_t *p, size_t len);
+// "<indent>  <text>\n", text only
+void mp4_field_text(int depth, const char *text);
+
+// A table of cols unsigned columns: "<indent>  <label>:", the column header
+// line, then one "<indent>      <row>:   <v>   <v>..." line per row
+void mp4_field_table_begin(int depth, const char *label, const char *header, int cols);
+void mp4_field_table_row(const uint64_t *v);
+void mp4_field_table_end(void);
+
+#endif  //_MP4_OUTPUT_H_2018
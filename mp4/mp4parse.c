@@ -1,5 +1,17 @@
-#include <ctype.h>
+#include "mp4be.h"
+#include "mp4boxtree.h"
+#include "mp4bytes.h"
+#include "mp4index.h"
+#include "mp4output.h"
+#include "mp4samplepack.h"
+#include "mp4summary.h"
+#include "mp4walk.h"
+
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,19 +21,276 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+// The buffer being printed and the file offset of its first byte: the whole
+// file, or the current window of a stream
 static uint8_t *g_content_buf = NULL;
+static uint64_t g_content_offset = 0;
+
+#define MP4_PATH_MAX 32
+
+// --path query: one segment per box depth, e.g. moov/trak[*]/mdia/hdlr
+typedef struct {
+    bool any;     // "*": any box type
+    uint32_t type;
+    int index;    // [n]: only the n-th matching sibling, -1 for all
+} mp4_path_segment_t;
+
+static struct {
+    mp4_path_segment_t segments[MP4_PATH_MAX];
+    int num;
+    bool matched;  // inside a box that matched the whole path
+} g_path;
+
+typedef enum {
+    MP4_PATH_SKIP,     // not on the path, skipped by its size
+    MP4_PATH_DESCEND,  // on the path, only matching children are printed
+    MP4_PATH_ALL,      // the whole path matched or there is none
+} mp4_path_match_t;
+
+// Deepest box nesting walked, --max-depth
+static int g_max_depth = MP4_WALK_MAX_DEPTH;
+
+// Bytes of a box or NAL unit shown by mp4_hexdump(), --hexdump-limit
+#define MP4_HEXDUMP_LIMIT 128
+static size_t g_hexdump_limit = MP4_HEXDUMP_LIMIT;
+
+#define MP4_JOBS_MAX 256
+// fewest samples of an mdat worth a thread of their own
+#define MP4_JOB_SAMPLES_MIN 64
+
+typedef struct {
+    uint64_t offset;
+    uint32_t size;
+    uint8_t codec;        // index in g_nal_codecs
+    uint8_t length_size;  // NAL unit length field bytes
+} mp4_sample_loc_t;
+
+// Video samples of the file sorted by offset; mdat is printed as their NAL
+// units, on --jobs threads
+static struct {
+    int jobs;         // 1 without --jobs
+    size_t file_len;  // the whole file is in g_content_buf, 0 for streams
+    bool loaded;      // mp4_samples_load() was tried
+    bool found;       // the file has sample tables
+    size_t num;
+    mp4_sample_loc_t *samples;
+} g_samples = {.jobs = 1};
+
+static bool mp4_print(const uint8_t *p, size_t len, int depth);
+static bool mp4_path_parse(const char *path);
+static bool mp4_stream_print_fd(int fd);
+static bool mp4_boxes_print(const char *filename, const char *type, const char *index_path);
+static bool mp4_summary_print_fd(int fd);
+static bool mp4_samples_print_fd(int fd, bool packed);
+static bool mp4_mdat_samples_print(const uint8_t *p, size_t len, int depth);
 
-static void mp4_print(const uint8_t *p, size_t len, int depth);
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--format text|json|binary] [--path P | --boxes[=TYPE] [--box-index FILE] | --summary | --samples[=packed]] <filename>|-\n", prog);
+    fprintf(stderr, "  -                read from stdin; pipes and FIFOs are parsed as they arrive\n");
+    fprintf(stderr, "  --path P         print only the boxes at box path P and their parents,\n");
+    fprintf(stderr, "                   e.g. moov/trak[*]/mdia/hdlr or moof/traf/trun; a type\n");
+    fprintf(stderr, "                   of * matches any box and [n] the n-th match only\n");
+    fprintf(stderr, "  --boxes          list the header of every box, reading nothing else\n");
+    fprintf(stderr, "  --boxes=TYPE     print every box of type TYPE, e.g. --boxes=trun\n");
+    fprintf(stderr, "  --box-index FILE reuse or write the box index of --boxes in FILE\n");
+    fprintf(stderr, "  --summary        per-track codec, duration, sample count and sizes,\n");
+    fprintf(stderr, "                   keyframe interval and bitrate from the sample tables,\n");
+    fprintf(stderr, "                   reading only moov and moof\n");
+    fprintf(stderr, "  --samples        per-track table of every sample: decode and composition\n");
+    fprintf(stderr, "                   time, size, offset, sync flag and chunk; needs a file,\n");
+    fprintf(stderr, "                   not - (stdin)\n");
+    fprintf(stderr, "  --samples=packed the bytes of each table column once delta and varint\n");
+    fprintf(stderr, "                   packed, instead of the table\n");
+    fprintf(stderr, "  --hexdump-limit N|all\n");
+    fprintf(stderr, "                   hex dump at most N bytes of a box or NAL unit\n");
+    fprintf(stderr, "                   (default %d), all for no limit\n", MP4_HEXDUMP_LIMIT);
+    fprintf(stderr, "  --jobs N         print the NAL units of the mdat samples on N threads\n");
+    fprintf(stderr, "                   (default 1)\n");
+    fprintf(stderr, "  --max-depth N    stop at boxes nested deeper than N levels (default %d)\n", MP4_WALK_MAX_DEPTH);
+    fprintf(stderr, "  --format text    indented box tree (default)\n");
+    fprintf(stderr, "  --format json    one JSON object per box and line\n");
+    fprintf(stderr, "  --format binary  length-prefixed box, field and table records\n");
+}
 
 int main(int argc, char **argv)
 {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+    static const struct option options[] = {
+        {"format", required_argument, NULL, 'f'},
+        {"path", required_argument, NULL, 'p'},
+        {"boxes", optional_argument, NULL, 'b'},
+        {"box-index", required_argument, NULL, 'B'},
+        {"max-depth", required_argument, NULL, 'd'},
+        {"summary", no_argument, NULL, 's'},
+        {"samples", optional_argument, NULL, 'S'},
+        {"hexdump-limit", required_argument, NULL, 'x'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    mp4_output_format_t format = MP4_OUTPUT_TEXT;
+    bool boxes = false;
+    const char *boxes_type = NULL;
+    const char *box_index = NULL;
+    bool summary = false;
+    bool samples = false;
+    bool samples_packed = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:p:d:j:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                format = MP4_OUTPUT_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                format = MP4_OUTPUT_JSON;
+            } else if (strcmp(optarg, "binary") == 0) {
+                format = MP4_OUTPUT_BINARY;
+            } else {
+                fprintf(stderr, "%s:%d %s invalid format: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            if (!mp4_path_parse(optarg)) {
+                fprintf(stderr, "%s:%d %s invalid path: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            boxes = true;
+            if (optarg && strlen(optarg) != 4) {
+                fprintf(stderr, "%s:%d %s invalid box type: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            boxes_type = optarg;
+            break;
+        case 'B':
+            box_index = optarg;
+            break;
+        case 's':
+            summary = true;
+            break;
+        case 'S':
+            samples = true;
+            if (optarg && strcmp(optarg, "packed") != 0) {
+                fprintf(stderr, "%s:%d %s invalid samples mode: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            samples_packed = optarg != NULL;
+            break;
+        case 'x': {
+            if (strcmp(optarg, "all") == 0) {
+                g_hexdump_limit = SIZE_MAX;
+                break;
+            }
+            char *end = NULL;
+            errno = 0;
+            unsigned long long limit = strtoull(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || optarg[0] == '-' || errno == ERANGE || limit > SIZE_MAX) {
+                fprintf(stderr, "%s:%d %s invalid hexdump limit: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            g_hexdump_limit = limit;
+            break;
+        }
+        case 'j': {
+            char *end = NULL;
+            long jobs = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || jobs < 1 || jobs > MP4_JOBS_MAX) {
+                fprintf(stderr, "%s:%d %s invalid job count: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            g_samples.jobs = jobs;
+            break;
+        }
+        case 'd': {
+            char *end = NULL;
+            long max_depth = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || max_depth < 1 || max_depth > 1024) {
+                fprintf(stderr, "%s:%d %s invalid max depth: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            g_max_depth = max_depth;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc || (box_index && !boxes) || (boxes && g_path.num > 0) || (summary && (boxes || g_path.num > 0)) || (g_samples.jobs > 1 && (boxes || summary)) || (samples && (boxes || summary || g_path.num > 0 || g_samples.jobs > 1))) {
+        usage(argv[0]);
         exit(EXIT_FAILURE);
     }
+    mp4_output_open(STDOUT_FILENO, format);
+
+    const char *filename = argv[optind];
+    mp4_out_str("Reading file ");
+    mp4_out_str(filename);
+    mp4_out_char('\n');
+
+    if (summary) {
+        int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "%s:%d %s open(\"%s\", O_RDONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        mp4_out_str("Summary:\n");
+        bool ok = mp4_summary_print_fd(fd);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        if (mp4_output_flush() < 0) {
+            fprintf(stderr, "%s:%d %s write error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (samples && strcmp(filename, "-") == 0) {
+        fprintf(stderr, "%s:%d %s --samples needs a regular file, not stdin\n", __FILE__, __LINE__, __FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    if (samples) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "%s:%d %s open(\"%s\", O_RDONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        mp4_out_str("Samples:\n");
+        bool ok = mp4_samples_print_fd(fd, samples_packed);
+        close(fd);
+        if (mp4_output_flush() < 0) {
+            fprintf(stderr, "%s:%d %s write error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    const char *filename = argv[1];
-    printf("Reading file %s\n", filename);
+    if (boxes) {
+        mp4_out_str("File Content:\n");
+        bool ok = mp4_boxes_print(filename, boxes_type, box_index);
+        if (mp4_output_flush() < 0) {
+            fprintf(stderr, "%s:%d %s write error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (g_samples.jobs > 1 && strcmp(filename, "-") == 0) {
+        fprintf(stderr, "%s:%d %s --jobs needs a regular file\n", __FILE__, __LINE__, __FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(filename, "-") == 0) {
+        mp4_out_str("File Content:\n");
+        bool ok = mp4_stream_print_fd(STDIN_FILENO);
+        if (mp4_output_flush() < 0) {
+            fprintf(stderr, "%s:%d %s write error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     struct stat sb = {0};
     if (stat(filename, &sb) < 0) {
@@ -29,6 +298,26 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    if (!S_ISREG(sb.st_mode)) {
+        if (g_samples.jobs > 1) {
+            fprintf(stderr, "%s:%d %s --jobs needs a regular file\n", __FILE__, __LINE__, __FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "%s:%d %s open(\"%s\", O_RDONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        mp4_out_str("File Content:\n");
+        bool ok = mp4_stream_print_fd(fd);
+        close(fd);
+        if (mp4_output_flush() < 0) {
+            fprintf(stderr, "%s:%d %s write error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     FILE *fp = fopen(filename, "rb");
     if (!fp) {
         fprintf(stderr, "%s:%d %s fopen(\"%s\", \"rb\") error: %s", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
@@ -45,55 +334,92 @@ int main(int argc, char **argv)
         fclose(fp);
         exit(EXIT_FAILURE);
     }
-    printf("File Content:\n");
-    mp4_print(g_content_buf, sb.st_size, 0);
+    g_samples.file_len = sb.st_size;
+    mp4_out_str("File Content:\n");
+    bool ok = mp4_print(g_content_buf, sb.st_size, 0);
+    free(g_samples.samples);
     free(g_content_buf);
     g_content_buf = 0;
     fclose(fp);
-    return EXIT_SUCCESS;
+    if (mp4_output_flush() < 0) {
+        fprintf(stderr, "%s:%d %s write error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-static inline uint16_t
-get_u16(const uint8_t *p)
+// The FourCC of a box as a big-endian 32-bit key, compared against the first
+// member of a table entry, its type string: key order is type byte order
+static int
+mp4_fourcc_cmp(const void *key, const void *entry)
 {
-    return (p[0] << 8) | p[1];
+    const uint32_t a = *(const uint32_t *)key;
+    const uint32_t b = get_u32(*(const uint8_t *const *)entry);
+    return a < b ? -1 : a > b;
 }
 
-static inline uint32_t
-get_u24(const uint8_t *p)
+// File offset of p, a pointer into g_content_buf
+static uint64_t
+mp4_offset(const uint8_t *p)
 {
-    return (p[0] << 16) | (p[1] << 8) | p[2];
+    return g_content_offset + (p - g_content_buf);
 }
 
-static inline uint32_t
-get_u32(const uint8_t *p)
+// "+--- Offset: <offset><length_label><length> Type: <type>" line that opens
+// a box or a NAL unit, closed with mp4_box_end()
+static void
+mp4_header_print(int depth, uint64_t offset, const char *length_label, uint64_t length, const char *type)
 {
-    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    mp4_box_begin(depth, offset, length, type);
+    mp4_out_indent(depth, 1);
+    mp4_out_str("--- Offset: ");
+    mp4_out_u64(offset);
+    mp4_out_str(length_label);
+    mp4_out_u64(length);
+    mp4_out_str(" Type: ");
+    mp4_out_str(type);
+    mp4_out_char('\n');
 }
 
-static inline uint64_t
-get_u64(const uint8_t *p)
+// "+<label><v>" line that opens a sample or entry of a table, v right
+// aligned in width columns
+static void
+mp4_header_field_print(int depth, const char *label, uint64_t v, int width)
 {
-    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+    mp4_out_indent(depth, 1);
+    mp4_out_str(label);
+    mp4_out_u64_width(v, width);
+    mp4_out_char('\n');
 }
 
-static const char *
-indent(int depth, int header)
+// "  <i><separator><v>" table row, i right aligned in 3 columns and v zero
+// padded to digits digits
+static void
+mp4_row_print(int depth, int i, const char *separator, uint64_t v, int digits)
 {
-    static char buf[64];
-    memset(buf, 0, sizeof(buf));
-
-    for (int i = 0; i < depth; i++) {
-        strcat(buf, "|  ");
-    }
+    mp4_out_indent(depth, 0);
+    mp4_out_str("  ");
+    mp4_out_u64_width(i, 3);
+    mp4_out_str(separator);
+    mp4_out_u64_zero(v, digits);
+    mp4_out_char('\n');
+}
 
-    if (header) {
-        strcat(buf, "+");
-    } else {
-        strcat(buf, "");
+static void
+mp4_nal_type_print(int depth, const char *label, uint64_t type, const char *typestr)
+{
+    if (mp4_output_format() != MP4_OUTPUT_TEXT) {
+        mp4_field_u(depth, label, type);
+        mp4_field_str(depth, "nal_unit_type_name", typestr);
+        return;
     }
-
-    return buf;
+    mp4_out_indent(depth, 0);
+    mp4_out_str("  ");
+    mp4_out_str(label);
+    mp4_out_u64(type);
+    mp4_out_str(" (");
+    mp4_out_str(typestr);
+    mp4_out_str(")\n");
 }
 
 const char *
@@ -102,11 +428,14 @@ get_box_desc(const uint8_t *name)
     if (!name) {
         return "";
     }
-    static const struct {
+    static const struct mp4_atom {
         const char *name;
         const char *desc;
         const char *source;
     } atoms[] = {
+        // sorted by type bytes, for the binary search below
+        {"ID32", "ID3 version 2 container", "id3v2"},
+        {"UITS", "Unique Identifier Technology Solution", "Universal Music Group"},
         {"ainf", "Asset information to identify, license and play", "DECE"},
         {"avcn", "AVC NAL Unit Storage Box", "DECE"},
         {"bloc", "Base location and purchase location for license acquisition", "DECE"},
@@ -148,7 +477,6 @@ get_box_desc(const uint8_t *name)
         {"hmhd", "hint media header, overall information (hint track only)", "ISO"},
         {"hpix", "Hipix Rich Picture (user-data or meta-data)", "Hipix"},
         {"icnu", "OMA DRM Icon URI", "OMA DRM 2.0"},
-        {"ID32", "ID3 version 2 container", "id3v2"},
         {"idat", "Item data", "ISO"},
         {"ihdr", "Image Header", "JPEG2000"},
         {"iinf", "item information", "ISO"},
@@ -269,7 +597,6 @@ get_box_desc(const uint8_t *name)
         {"trun", "track fragment run", "ISO"},
         {"udta", "user-data", "ISO"},
         {"uinf", "a tool by which a vendor may provide access to additional information associated with a UUID", "JPEG2000"},
-        {"UITS", "Unique Identifier Technology Solution", "Universal Music Group"},
         {"ulst", "a list of UUID’s", "JPEG2000"},
         {"url ", "a URL", "JPEG2000"},
         {"uuid", "user-extension box", "ISO"},
@@ -278,13 +605,9 @@ get_box_desc(const uint8_t *name)
         {"xml ", "XML container", "ISO"},
     };
 
-    for (int i = 0; i < sizeof(atoms) / sizeof(atoms[0]); i++) {
-        if (memcmp(name, atoms[i].name, 4) == 0) {
-            return atoms[i].desc;
-        }
-    }
-
-    return "";
+    const uint32_t type = get_u32(name);
+    const struct mp4_atom *atom = bsearch(&type, atoms, sizeof(atoms) / sizeof(atoms[0]), sizeof(atoms[0]), mp4_fourcc_cmp);
+    return atom ? atom->desc : "";
 }
 
 typedef void (*mp4_box_func)(const uint8_t *p, size_t len, int depth);
@@ -321,6 +644,7 @@ static void mp4_box_subs_print(const uint8_t *p, size_t len, int depth);
 static void mp4_box_tenc_print(const uint8_t *p, size_t len, int depth);
 static void mp4_box_uuid_print(const uint8_t *p, size_t len, int depth);
 static void mp4_box_vmhd_print(const uint8_t *p, size_t len, int depth);
+static void mp4_box_container_print(const uint8_t *p, size_t len, int depth);
 static void mp4_box_mdat_print(const uint8_t *p, size_t len, int depth);
 static void mp4_box_trex_print(const uint8_t *p, size_t len, int depth);
 static void mp4_hexdump(const uint8_t *p, size_t len, int depth);
@@ -328,111 +652,275 @@ static void mp4_hexdump(const uint8_t *p, size_t len, int depth);
 static mp4_box_func
 mp4_box_printer_get(const uint8_t *p)
 {
-    static struct {
+    static const struct mp4_box_printer {
         const char *type;
         mp4_box_func func;
     } box_map[] = {
+        // sorted by type bytes, for the binary search below
+        {"avc1", mp4_box_stsd_sample_video_print},
+        {"avcC", mp4_box_stsd_avcC_print},
         {"btrt", mp4_box_btrt_print},
-        {"ctab", mp4_print},
+        {"ctab", mp4_box_ctab_print},
+        {"ctts", mp4_box_ctts_print},
         {"enca", mp4_box_stsd_sample_audio_print},
         {"encv", mp4_box_stsd_sample_video_print},
         {"frma", mp4_box_frma_print},
         {"ftyp", mp4_box_ftyp_print},
-        {"styp", mp4_box_ftyp_print},
+        {"hdlr", mp4_box_hdlr_print},
+        {"hev1", mp4_box_stsd_sample_video_print},
+        {"hvcC", mp4_box_stsd_hvcC_print},
+        {"iods", mp4_box_iods_print},
+        {"mdat", mp4_box_mdat_print},
+        {"mdhd", mp4_box_mdhd_print},
+        {"mdia", mp4_box_container_print},
         {"mfhd", mp4_box_mfhd_print},
-        {"moof", mp4_print},
-        {"moov", mp4_print},
+        {"mime", mp4_box_mime_print},
+        {"minf", mp4_box_container_print},
+        {"moof", mp4_box_container_print},
+        {"moov", mp4_box_container_print},
         {"mp4a", mp4_box_stsd_sample_audio_print},
+        {"mvex", mp4_box_container_print},
         {"mvhd", mp4_box_mvhd_print},
-        {"iods", mp4_box_iods_print},
-        {"mdhd", mp4_box_mdhd_print},
-        {"hdlr", mp4_box_hdlr_print},
-        {"tfhd", mp4_box_tfhd_print},
-        {"trak", mp4_print},
-        {"tkhd", mp4_box_tkhd_print},
-        {"trun", mp4_box_trun_print},
-        {"ctab", mp4_box_ctab_print},
-        {"mdia", mp4_print},
-        {"minf", mp4_print},
-        {"stbl", mp4_print},
-        {"traf", mp4_print},
-        {"schi", mp4_print},
+        {"saio", mp4_box_saio_print},
+        {"saiz", mp4_box_saiz_print},
+        {"schi", mp4_box_container_print},
         {"schm", mp4_box_schm_print},
         {"senc", mp4_box_senc_print},
-        {"stsd", mp4_box_stsd_print},
+        {"sinf", mp4_box_container_print},
+        {"stbl", mp4_box_container_print},
+        {"stco", mp4_box_stco_print},
         {"stpp", mp4_box_stpp_print},
-        {"mime", mp4_box_mime_print},
-        {"avc1", mp4_box_stsd_sample_video_print},
-        {"avcC", mp4_box_stsd_avcC_print},
-        {"hev1", mp4_box_stsd_sample_video_print},
-        {"hvcC", mp4_box_stsd_hvcC_print},
-        {"stts", mp4_box_stts_print},
-        {"ctts", mp4_box_ctts_print},
-        {"sinf", mp4_print},
-        {"saio", mp4_box_saio_print},
-        {"saiz", mp4_box_saiz_print},
         {"stsc", mp4_box_stsc_print},
-        {"stsz", mp4_box_stsz_print},
-        {"stco", mp4_box_stco_print},
+        {"stsd", mp4_box_stsd_print},
         {"stss", mp4_box_stss_print},
+        {"stsz", mp4_box_stsz_print},
+        {"stts", mp4_box_stts_print},
+        {"styp", mp4_box_ftyp_print},
         {"subs", mp4_box_subs_print},
         {"tenc", mp4_box_tenc_print},
+        {"tfhd", mp4_box_tfhd_print},
+        {"tkhd", mp4_box_tkhd_print},
+        {"traf", mp4_box_container_print},
+        {"trak", mp4_box_container_print},
+        {"trex", mp4_box_trex_print},
+        {"trun", mp4_box_trun_print},
         {"uuid", mp4_box_uuid_print},
         {"vmhd", mp4_box_vmhd_print},
-        {"mdat", mp4_box_mdat_print},
-        {"mvex", mp4_print},
-        {"trex", mp4_box_trex_print},
     };
 
-    for (int i = 0; i < sizeof(box_map) / sizeof(box_map[0]); i++) {
-        if (memcmp(p, box_map[i].type, 4) == 0) {
-            return box_map[i].func;
+    const uint32_t type = get_u32(p);
+    const struct mp4_box_printer *box = bsearch(&type, box_map, sizeof(box_map) / sizeof(box_map[0]), sizeof(box_map[0]), mp4_fourcc_cmp);
+    return box ? box->func : mp4_hexdump;
+}
+
+// Segments of "/"-separated box types, each "*" or four characters and an
+// optional "[n]" or "[*]"
+static bool
+mp4_path_parse(const char *path)
+{
+    g_path.num = 0;
+    while (*path) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+        if (g_path.num == MP4_PATH_MAX) {
+            return false;
+        }
+        mp4_path_segment_t *segment = &g_path.segments[g_path.num++];
+        const size_t len = strcspn(path, "/[");
+        segment->any = len == 1 && path[0] == '*';
+        segment->index = -1;
+        if (!segment->any) {
+            if (len != 4) {
+                return false;
+            }
+            segment->type = get_u32((const uint8_t *)path);
+        }
+        path += len;
+        if (*path != '[') {
+            continue;
+        }
+        if (strncmp(path, "[*]", 3) == 0) {
+            path += 3;
+        } else {
+            char *end = NULL;
+            long index = strtol(path + 1, &end, 10);
+            if (end == path + 1 || *end != ']' || index < 0 || index > INT32_MAX) {
+                return false;
+            }
+            segment->index = index;
+            path = end + 1;
+        }
+        if (*path != '\0' && *path != '/') {
+            return false;
         }
     }
+    return g_path.num > 0;
+}
 
-    return mp4_hexdump;
+// Whether the box of the given type at depth is on the --path query;
+// matches counts the siblings before it that matched the same segment
+static mp4_path_match_t
+mp4_path_match(int depth, const uint8_t *type, int *matches)
+{
+    if (g_path.num == 0 || g_path.matched || depth >= g_path.num) {
+        return MP4_PATH_ALL;
+    }
+    const mp4_path_segment_t *segment = &g_path.segments[depth];
+    if (!segment->any && get_u32(type) != segment->type) {
+        return MP4_PATH_SKIP;
+    }
+    if (segment->index >= 0 && (*matches)++ != segment->index) {
+        return MP4_PATH_SKIP;
+    }
+    return depth == g_path.num - 1 ? MP4_PATH_ALL : MP4_PATH_DESCEND;
 }
 
+// Boxes inside the box being printed. Printers do not recurse: they name
+// the region of their children here and mp4_print() walks it next.
+static struct {
+    const uint8_t *p;
+    size_t len;
+} g_children;
+
 static void
-mp4_print(const uint8_t *buf, size_t len, int depth)
+mp4_print_children(const uint8_t *p, size_t len)
 {
-    const uint8_t *p = buf;
-    const uint8_t *end = buf + len;
-    mp4_box_func func = NULL;
+    g_children.p = p;
+    g_children.len = len;
+}
 
-    while (p < end) {
-        uint64_t box_size = get_u32(p);
-        uint8_t box_type[5] = {0};
-        strncpy((char *)box_type, (const char *)p + 4, 4);
-        const uint8_t *box_data = p + 8;
+static void
+mp4_box_container_print(const uint8_t *p, size_t len, int depth)
+{
+    mp4_print_children(p, len);
+}
 
-        if (box_size == 1) {
-            box_size = get_u64(box_data);
-            box_data = p + 16;
-        }
+// Header line, description and fields of one box; true when its printer
+// named children to walk in g_children
+static bool
+mp4_box_fields_print(int depth, uint64_t offset, uint64_t size, const uint8_t *type, const uint8_t *data, size_t len)
+{
+    uint8_t box_type[5] = {0};
+    strncpy((char *)box_type, (const char *)type, 4);
+
+    mp4_header_print(depth, offset, " Length: ", size, (const char *)box_type);
+    mp4_field_str(depth + 1, "Description: ", get_box_desc(box_type));
+    g_children.p = NULL;
+    mp4_box_printer_get(box_type)(data, len, depth + 1);
+    return g_children.p != NULL;
+}
+
+// State of mp4_print() for each walker depth
+typedef struct {
+    int depth;  // print depth of the walked buffer
+    struct {
+        int path_matches;
+        bool path_matched;  // g_path.matched before the box
+        bool printed;
+    } * levels;
+} mp4_print_walk_t;
+
+static int
+mp4_print_enter(void *arg, const mp4_walk_box_t *box, const uint8_t **children, size_t *children_len)
+{
+    mp4_print_walk_t *walk = arg;
+    const int depth = walk->depth + box->depth;
+    const mp4_path_match_t match = mp4_path_match(depth, box->type, &walk->levels[box->depth].path_matches);
+    walk->levels[box->depth].printed = match != MP4_PATH_SKIP;
+    if (match == MP4_PATH_SKIP) {
+        return MP4_WALK_NEXT;
+    }
+    walk->levels[box->depth].path_matched = g_path.matched;
+    g_path.matched = g_path.matched || match == MP4_PATH_ALL;
 
-        printf("%s--- Offset: %zu Length: %zu Type: %s\n", indent(depth, 1), p - g_content_buf, box_size, box_type);
-        printf("%s  Description: %s\n", indent(depth + 1, 0), get_box_desc(box_type));
-        func = mp4_box_printer_get(box_type);
-        func(box_data, box_size - (box_data - p), depth + 1);
+    if (!mp4_box_fields_print(depth, mp4_offset(box->p), box->size, box->type, box->data, box->len)) {
+        return MP4_WALK_NEXT;
+    }
+    *children = g_children.p;
+    *children_len = g_children.len;
+    walk->levels[box->depth + 1].path_matches = 0;
+    return MP4_WALK_DESCEND;
+}
 
-        p += box_size;
+static int
+mp4_print_leave(void *arg, const mp4_walk_box_t *box)
+{
+    mp4_print_walk_t *walk = arg;
+    if (walk->levels[box->depth].printed) {
+        mp4_box_end();
+        g_path.matched = walk->levels[box->depth].path_matched;
     }
+    return MP4_INDEX_OK;
+}
+
+// Print the boxes of buf, depth levels deep; false when the walk stopped at
+// a malformed box or at the --max-depth limit
+static bool
+mp4_print(const uint8_t *buf, size_t len, int depth)
+{
+    if (depth >= g_max_depth) {
+        fprintf(stderr, "%s:%d %s mp4_walk error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(MP4_INDEX_ERR_DEPTH));
+        return false;
+    }
+    // the walker counts from 0 at buf
+    const int max_depth = g_max_depth - depth;
+    mp4_print_walk_t walk = {.depth = depth};
+    walk.levels = calloc(max_depth + 2, sizeof(*walk.levels));
+    if (!walk.levels) {
+        fprintf(stderr, "%s:%d %s calloc error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        return false;
+    }
+    const mp4_walker_t walker = {
+        .max_depth = max_depth,
+        .enter = mp4_print_enter,
+        .leave = mp4_print_leave,
+        .arg = &walk,
+    };
+    int err = mp4_walk(&walker, buf, len);
+    free(walk.levels);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_walk error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        return false;
+    }
+    return true;
+}
+
+// Whether the len bytes of a box payload at p are fewer than the min bytes of
+// fixed fields its printer reads, reporting the box when they are
+static bool
+mp4_box_truncated(const uint8_t *p, size_t len, size_t min)
+{
+    if (len >= min) {
+        return false;
+    }
+    fprintf(stderr, "%s:%d %s truncated box at offset %llu: %zu bytes, %zu needed\n", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)mp4_offset(p), len, min);
+    return true;
 }
 
 static void
 mp4_box_btrt_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Version:                 %u\n", indent(depth, 0), p[0]);
+    if (mp4_box_truncated(p, len, 1)) {
+        return;
+    }
+    mp4_field_u(depth, "Version:                 ", p[0]);
     mp4_hexdump(p, len, depth);
 }
 
 static void
 mp4_box_stsd_sample_audio_print(const uint8_t *p, size_t len, int depth)
 {
+    // 8 bytes of general and 20 of sound sample description
+    if (mp4_box_truncated(p, len, 28)) {
+        return;
+    }
+    const uint8_t *entry = p;
+
     // General sample decription
-    printf("%s  Reserved:             %.2x%.2x%.2x%.2x%.2x%.2x\n", indent(depth, 0), p[0], p[1], p[2], p[3], p[4], p[5]);
-    printf("%s  Data reference index: %u\n", indent(depth, 0), get_u16(p + 6));
+    mp4_field_hexbytes(depth, "Reserved:             ", p, 6);
+    mp4_field_u(depth, "Data reference index: ", get_u16(p + 6));
 
     p += 8;
 
@@ -469,78 +957,84 @@ mp4_box_stsd_sample_audio_print(const uint8_t *p, size_t len, int depth)
     //
     // Version 0 of the sound description format assumes uncompressed audio in 'raw ' or 'twos' format, 1 or 2 channels, 8 or 16 bits per sample, and a compression ID of 0.
     uint16_t version = get_u16(p);
-    printf("%s  Version:              %u\n", indent(depth, 0), version);
-    printf("%s  Revision level:       %u\n", indent(depth, 0), get_u16(p + 2));
-    printf("%s  Vendor:               %x\n", indent(depth, 0), get_u32(p + 4));
-    printf("%s  Number of Channels:   %u\n", indent(depth, 0), get_u16(p + 8));
-    printf("%s  Sample Size:          %u\n", indent(depth, 0), get_u16(p + 10));
-    printf("%s  Compression ID:       %u\n", indent(depth, 0), get_u16(p + 12));
-    printf("%s  Packet Size:          %u\n", indent(depth, 0), get_u16(p + 14));
-    printf("%s  Sample Rate:          %u\n", indent(depth, 0), get_u32(p + 16));
+    mp4_field_u(depth, "Version:              ", version);
+    mp4_field_u(depth, "Revision level:       ", get_u16(p + 2));
+    mp4_field_hex(depth, "Vendor:               ", get_u32(p + 4), 0);
+    mp4_field_u(depth, "Number of Channels:   ", get_u16(p + 8));
+    mp4_field_u(depth, "Sample Size:          ", get_u16(p + 10));
+    mp4_field_u(depth, "Compression ID:       ", get_u16(p + 12));
+    mp4_field_u(depth, "Packet Size:          ", get_u16(p + 14));
+    mp4_field_u(depth, "Sample Rate:          ", get_u32(p + 16));
 
     if (version == 0) {
-        mp4_print(p + 20, len - 28, depth);
+        mp4_print_children(entry + 28, len - 28);
     }
 }
 
 static void
 mp4_box_stsd_sample_video_print(const uint8_t *p, size_t len, int depth)
 {
+    // 8 bytes of general and 70 of video sample description
+    if (mp4_box_truncated(p, len, 78)) {
+        return;
+    }
+    const uint8_t *entry = p;
+
     // General sample decription
-    printf("%s  Reserved:             %.2x%.2x%.2x%.2x%.2x%.2x\n", indent(depth, 0), p[0], p[1], p[2], p[3], p[4], p[5]);
-    printf("%s  Data reference index: %u\n", indent(depth, 0), get_u16(p + 6));
+    mp4_field_hexbytes(depth, "Reserved:             ", p, 6);
+    mp4_field_u(depth, "Data reference index: ", get_u16(p + 6));
     p += 8;
 
     // Video sample description
     // Version
     // A 16-bit integer indicating the version number of the compressed data.
     // This is set to 0, unless a compressor has changed its data format.
-    printf("%s  Version:          %u\n", indent(depth, 0), get_u16(p));
+    mp4_field_u(depth, "Version:          ", get_u16(p));
 
     // Revision level
     // A 16-bit integer that must be set to 0.
-    printf("%s  Revision level:   %u\n", indent(depth, 0), get_u16(p + 2));
+    mp4_field_u(depth, "Revision level:   ", get_u16(p + 2));
 
     // Vendor
     // A 32-bit integer that specifies the developer of the compressor that generated the compressed data.
     // Often this field contains 'appl' to indicate Apple, Inc.
-    printf("%s  Vendor:           %x\n", indent(depth, 0), get_u32(p + 4));
+    mp4_field_hex(depth, "Vendor:           ", get_u32(p + 4), 0);
 
     // Temporal quality
     // A 32-bit integer containing a value from 0 to 1023 indicating the degree of temporal compression.
-    printf("%s  Temporal Quality: %u\n", indent(depth, 0), get_u32(p + 8));
+    mp4_field_u(depth, "Temporal Quality: ", get_u32(p + 8));
 
     // Spatial quality
     // A 32-bit integer containing a value from 0 to 1024 indicating the degree of spatial compression.
-    printf("%s  Spatial Quality:  %u\n", indent(depth, 0), get_u32(p + 12));
+    mp4_field_u(depth, "Spatial Quality:  ", get_u32(p + 12));
 
     // Width
     // A 16-bit integer that specifies the width of the source image in pixels.
-    printf("%s  Width:            %u\n", indent(depth, 0), get_u16(p + 16));
+    mp4_field_u(depth, "Width:            ", get_u16(p + 16));
 
     // Height
     // A 16-bit integer that specifies the height of the source image in pixels.
-    printf("%s  Heigth:           %u\n", indent(depth, 0), get_u16(p + 18));
+    mp4_field_u(depth, "Heigth:           ", get_u16(p + 18));
 
     // Horizontal resolution
     // A 32-bit fixed-point number containing the horizontal resolution of the image in pixels per inch.
-    printf("%s  Horizontal PPI:   %u\n", indent(depth, 0), get_u32(p + 20));
+    mp4_field_u(depth, "Horizontal PPI:   ", get_u32(p + 20));
 
     // Vertical resolution
     // A 32-bit fixed-point number containing the vertical resolution of the image in pixels per inch.
-    printf("%s  Vertical PPI:     %u\n", indent(depth, 0), get_u32(p + 24));
+    mp4_field_u(depth, "Vertical PPI:     ", get_u32(p + 24));
 
     // Data size
     // A 32-bit integer that must be set to 0.
-    printf("%s  Data Size:        %u\n", indent(depth, 0), get_u32(p + 28));
+    mp4_field_u(depth, "Data Size:        ", get_u32(p + 28));
 
     // Frame count
     // A 16-bit integer that indicates how many frames of compressed data are stored in each sample. Usually set to 1.
-    printf("%s  Frame Count:      %u\n", indent(depth, 0), get_u16(p + 32));
+    mp4_field_u(depth, "Frame Count:      ", get_u16(p + 32));
 
     // Compressor name
     // A 32-byte Pascal string containing the name of the compressor that created the image, such as "jpeg".
-    printf("%s  Compressor:       %s\n", indent(depth, 0), p + 34 + 1);
+    mp4_field_str(depth, "Compressor:       ", (const char *)p + 34 + 1);
 
     // Depth
     // A 16-bit integer that indicates the pixel depth of the compressed image.
@@ -548,7 +1042,7 @@ mp4_box_stsd_sample_video_print(const uint8_t *p, size_t len, int depth)
     // The value 32 should be used only if the image contains an alpha channel.
     // Values of 34, 36, and 40 indicate 2-, 4-, and 8-bit grayscale,
     // respectively, for grayscale images.
-    printf("%s  Depth:            %x\n", indent(depth, 0), get_u16(p + 68));
+    mp4_field_hex(depth, "Depth:            ", get_u16(p + 68), 0);
 
     // Color table ID
     // A 16-bit integer that identifies which color table to use.
@@ -558,13 +1052,42 @@ mp4_box_stsd_sample_video_print(const uint8_t *p, size_t len, int depth)
     // If the color table ID is set to 0, a color table is contained within the sample description itself.
     // The color table immediately follows the color table ID field in the sample description.
     // See Color Table Atoms for a complete description of a color table.
-    printf("%s  Color Table ID:   %x\n", indent(depth, 0), get_u16(p + 70));
+    mp4_field_hex(depth, "Color Table ID:   ", get_u16(p + 70), 0);
+
+    mp4_print_children(entry + 78, len - 78);
+    // mp4_hexdump(entry + 78, len - 78, depth);
+}
+
+// Prints the NAL units in len bytes at p, each behind a big-endian length
+// field of length_size bytes
+typedef void (*mp4_nals_func)(const uint8_t *p, size_t len, int length_size, int depth);
+
+// Codec and length field size of the last avcC or hvcC box printed, for the
+// mdat walks without sample tables to go by
+static mp4_nals_func mdat_printer = NULL;
+static int g_nal_length_size = 4;
+
+static uint32_t
+mp4_nal_length(const uint8_t *p, int length_size)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < length_size; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
 
-    mp4_print(p + 70, len - 78, depth);
-    // mp4_hexdump(p+72, len - 78, depth);
+// Whether the length field at p and the NAL unit behind it end by p_end
+static bool
+mp4_nal_fits(const uint8_t *p, const uint8_t *p_end, int length_size)
+{
+    if (p_end - p < length_size || mp4_nal_length(p, length_size) > (size_t)(p_end - p - length_size)) {
+        fprintf(stderr, "%s:%d %s invalid NAL unit length at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)mp4_offset(p));
+        return false;
+    }
+    return true;
 }
 
-static mp4_box_func mdat_printer = NULL;
 static void
 mp4_box_mdat_h264_nal_print(const uint8_t *p, size_t len, int depth)
 {
@@ -573,6 +1096,9 @@ mp4_box_mdat_h264_nal_print(const uint8_t *p, size_t len, int depth)
     //   nal_ref_idc          u(2)
     //   nal_unit_type        u(5)
 
+    if (len < 1) {
+        return;
+    }
     const uint8_t nal_ref_idc = (p[0] >> 5) & 0x03;
     const uint8_t nal_unit_type = p[0] & 0x1f;
     char *typestr = NULL;
@@ -629,23 +1155,24 @@ mp4_box_mdat_h264_nal_print(const uint8_t *p, size_t len, int depth)
         break;
     }
 
-    printf("%s  nal_ref_idc:    %u\n", indent(depth, 0), nal_ref_idc);
-    printf("%s  nal_unit_type:  %u (%s)\n", indent(depth, 0), nal_unit_type, typestr);
+    mp4_field_u(depth, "nal_ref_idc:    ", nal_ref_idc);
+    mp4_nal_type_print(depth, "nal_unit_type:  ", nal_unit_type, typestr);
     if (hexdump) {
         mp4_hexdump(p, len, depth);
     }
 }
 
 static void
-mp4_box_mdat_h264_print(const uint8_t *p, size_t len, int depth)
+mp4_mdat_h264_print(const uint8_t *p, size_t len, int length_size, int depth)
 {
     const uint8_t *p_end = p + len;
-    while (p < p_end) {
-        uint32_t nal_length = get_u32(p);
+    while (p < p_end && mp4_nal_fits(p, p_end, length_size)) {
+        uint32_t nal_length = mp4_nal_length(p, length_size);
 
-        printf("%s--- Offset: %zu Length %u Type: H264 NAL\n", indent(depth, 1), p - g_content_buf, nal_length);
-        mp4_box_mdat_h264_nal_print(p + 4, nal_length, depth + 1);
-        p += nal_length + 4;
+        mp4_header_print(depth, mp4_offset(p), " Length ", nal_length, "H264 NAL");
+        mp4_box_mdat_h264_nal_print(p + length_size, nal_length, depth + 1);
+        mp4_box_end();
+        p += nal_length + length_size;
     }
 }
 
@@ -653,86 +1180,112 @@ static void
 mp4_box_stsd_avcC_print(const uint8_t *p, size_t len, int depth)
 {
     mp4_hexdump(p, len, depth);
-    mdat_printer = mp4_box_mdat_h264_print;
+    mdat_printer = mp4_mdat_h264_print;
+    // lengthSizeMinusOne in the low bits of the fifth byte
+    if (len >= 5) {
+        g_nal_length_size = (p[4] & 0x03) + 1;
+    }
 }
 
 static void
 mp4_box_frma_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Data Format: %c%c%c%c\n", indent(depth, 0), p[0], p[1], p[2], p[3]);
+    if (mp4_box_truncated(p, len, 4)) {
+        return;
+    }
+    mp4_field_bytes(depth, "Data Format: ", p, 4);
 }
 
 static void
 mp4_box_ftyp_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Major brand:   %c%c%c%c\n", indent(depth, 0), p[0], p[1], p[2], p[3]);
-    printf("%s  Minor version: %u\n", indent(depth, 0), get_u32(p + 4));
-    for (const uint8_t *pp = p + 8; pp < p + len; pp += 4) {
-        printf("%s  Compability brand: %c%c%c%c\n", indent(depth, 0), pp[0], pp[1], pp[2], pp[3]);
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    mp4_field_bytes(depth, "Major brand:   ", p, 4);
+    mp4_field_u(depth, "Minor version: ", get_u32(p + 4));
+    for (const uint8_t *pp = p + 8; pp + 4 <= p + len; pp += 4) {
+        mp4_field_bytes(depth, "Compability brand: ", pp, 4);
     }
 }
 
 static void
 mp4_box_mfhd_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Sequence Number: %u\n", indent(depth, 0), get_u32(p + 4));
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    mp4_field_u(depth, "Sequence Number: ", get_u32(p + 4));
 }
 
 static void
 mp4_box_mvhd_print(const uint8_t *p, size_t len, int depth)
 {
-    mp4_hexdump(p, 128, depth);
+    // version 0 layout, up to the next track ID
+    if (mp4_box_truncated(p, len, 100)) {
+        return;
+    }
+    mp4_hexdump(p, len, depth);
 
-    printf("%s  Version:            %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:              0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Creation time:      %u\n", indent(depth, 0), get_u32(p + 4));
-    printf("%s  Modification time:  %u\n", indent(depth, 0), get_u32(p + 8));
-    printf("%s  Time scale:         %u\n", indent(depth, 0), get_u32(p + 12));
-    printf("%s  Duration:           %u\n", indent(depth, 0), get_u32(p + 16));
-    printf("%s  Preferred rate:     %u\n", indent(depth, 0), get_u32(p + 20));
-    printf("%s  Preferred volume:   %u\n", indent(depth, 0), get_u16(p + 24));
+    mp4_field_u(depth, "Version:            ", p[0]);
+    mp4_field_hex(depth, "Flags:              0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Creation time:      ", get_u32(p + 4));
+    mp4_field_u(depth, "Modification time:  ", get_u32(p + 8));
+    mp4_field_u(depth, "Time scale:         ", get_u32(p + 12));
+    mp4_field_u(depth, "Duration:           ", get_u32(p + 16));
+    mp4_field_u(depth, "Preferred rate:     ", get_u32(p + 20));
+    mp4_field_u(depth, "Preferred volume:   ", get_u16(p + 24));
     // printf("%s  Matrix structure:   %u\n",indent(depth, 0), get_u32(p+2));
-    printf("%s  Preview time:       %u\n", indent(depth, 0), get_u32(p + 72));
-    printf("%s  Preview duration:   %u\n", indent(depth, 0), get_u32(p + 76));
-    printf("%s  Poster time:        %u\n", indent(depth, 0), get_u32(p + 80));
-    printf("%s  Selection time:     %u\n", indent(depth, 0), get_u32(p + 84));
-    printf("%s  Selection duration: %u\n", indent(depth, 0), get_u32(p + 88));
-    printf("%s  Current Time:       %u\n", indent(depth, 0), get_u32(p + 92));
-    printf("%s  Next track ID       %u\n", indent(depth, 0), get_u32(p + 96));
+    mp4_field_u(depth, "Preview time:       ", get_u32(p + 72));
+    mp4_field_u(depth, "Preview duration:   ", get_u32(p + 76));
+    mp4_field_u(depth, "Poster time:        ", get_u32(p + 80));
+    mp4_field_u(depth, "Selection time:     ", get_u32(p + 84));
+    mp4_field_u(depth, "Selection duration: ", get_u32(p + 88));
+    mp4_field_u(depth, "Current Time:       ", get_u32(p + 92));
+    mp4_field_u(depth, "Next track ID       ", get_u32(p + 96));
 }
 
 static void
 mp4_box_iods_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Version:            %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:              0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
+    if (mp4_box_truncated(p, len, 4)) {
+        return;
+    }
+    mp4_field_u(depth, "Version:            ", p[0]);
+    mp4_field_hex(depth, "Flags:              0x", get_u24(p + 1), 6);
     mp4_hexdump(p, len, depth);
 }
 
 static void
 mp4_box_mdhd_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Version:            %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:              0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Creation time:      %u\n", indent(depth, 0), get_u32(p + 4));
-    printf("%s  Modification time:  %u\n", indent(depth, 0), get_u32(p + 8));
-    printf("%s  Time scale:         %u\n", indent(depth, 0), get_u32(p + 12));
-    printf("%s  Duration:           %u\n", indent(depth, 0), get_u32(p + 16));
-    printf("%s  Language:           %u\n", indent(depth, 0), get_u16(p + 20));
-    printf("%s  Quality:            %u\n", indent(depth, 0), get_u16(p + 22));
+    if (mp4_box_truncated(p, len, 24)) {
+        return;
+    }
+    mp4_field_u(depth, "Version:            ", p[0]);
+    mp4_field_hex(depth, "Flags:              0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Creation time:      ", get_u32(p + 4));
+    mp4_field_u(depth, "Modification time:  ", get_u32(p + 8));
+    mp4_field_u(depth, "Time scale:         ", get_u32(p + 12));
+    mp4_field_u(depth, "Duration:           ", get_u32(p + 16));
+    mp4_field_u(depth, "Language:           ", get_u16(p + 20));
+    mp4_field_u(depth, "Quality:            ", get_u16(p + 22));
 }
 
 static void
 mp4_box_hdlr_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Version:                %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:                  0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Component type:         %u\n", indent(depth, 0), get_u32(p + 4));
-    printf("%s  Component subtype:      %.*s\n", indent(depth, 0), 4, p + 8);
-    printf("%s  Component manufacturer: %.*s\n", indent(depth, 0), 4, p + 8);
-    printf("%s  Component flags:        %u\n", indent(depth, 0), get_u32(p + 12));
-    printf("%s  Component flags mask:   %u\n", indent(depth, 0), get_u32(p + 16));
-    printf("%s  Component name:         %u\n", indent(depth, 0), get_u32(p + 12));
+    if (mp4_box_truncated(p, len, 20)) {
+        return;
+    }
+    mp4_field_u(depth, "Version:                ", p[0]);
+    mp4_field_hex(depth, "Flags:                  0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Component type:         ", get_u32(p + 4));
+    mp4_field_strn(depth, "Component subtype:      ", (const char *)p + 8, 4);
+    mp4_field_strn(depth, "Component manufacturer: ", (const char *)p + 8, 4);
+    mp4_field_u(depth, "Component flags:        ", get_u32(p + 12));
+    mp4_field_u(depth, "Component flags mask:   ", get_u32(p + 16));
+    mp4_field_u(depth, "Component name:         ", get_u32(p + 12));
 }
 
 static void
@@ -742,7 +1295,7 @@ mp4_box_tfhd_optional_print(const uint8_t *p, const uint8_t *end, int depth, uin
         if (p + 8 > end) {
             return;
         }
-        printf("%s  Base Data Offset:        %lu\n", indent(depth, 0), get_u64(p));
+        mp4_field_u(depth, "Base Data Offset:        ", get_u64(p));
         p += 8;
     }
 
@@ -750,7 +1303,7 @@ mp4_box_tfhd_optional_print(const uint8_t *p, const uint8_t *end, int depth, uin
         if (p + 4 > end) {
             return;
         }
-        printf("%s  Sample Desc Index:       %d\n", indent(depth, 0), get_u32(p));
+        mp4_field_i(depth, "Sample Desc Index:       ", (int32_t)get_u32(p));
         p += 4;
     }
 
@@ -758,7 +1311,7 @@ mp4_box_tfhd_optional_print(const uint8_t *p, const uint8_t *end, int depth, uin
         if (p + 4 > end) {
             return;
         }
-        printf("%s  Default Sample Duration: %d\n", indent(depth, 0), get_u32(p));
+        mp4_field_i(depth, "Default Sample Duration: ", (int32_t)get_u32(p));
         p += 4;
     }
 
@@ -766,7 +1319,7 @@ mp4_box_tfhd_optional_print(const uint8_t *p, const uint8_t *end, int depth, uin
         if (p + 4 > end) {
             return;
         }
-        printf("%s  Default Sample Size:     %d\n", indent(depth, 0), get_u32(p));
+        mp4_field_i(depth, "Default Sample Size:     ", (int32_t)get_u32(p));
         p += 4;
     }
 
@@ -774,7 +1327,7 @@ mp4_box_tfhd_optional_print(const uint8_t *p, const uint8_t *end, int depth, uin
         if (p + 4 > end) {
             return;
         }
-        printf("%s  Default Sample Flags:    0x%x\n", indent(depth, 0), get_u32(p));
+        mp4_field_hex(depth, "Default Sample Flags:    0x", get_u32(p), 0);
         p += 4;
     }
 }
@@ -782,67 +1335,111 @@ mp4_box_tfhd_optional_print(const uint8_t *p, const uint8_t *end, int depth, uin
 static void
 mp4_box_tfhd_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
     uint32_t flags = get_u24(p + 1);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.6x\n", indent(depth, 0), flags);
-    printf("%s  Track ID:   0x%d\n", indent(depth, 0), get_u32(p + 4));
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", flags, 6);
+    mp4_field_i(depth, "Track ID:   0x", (int32_t)get_u32(p + 4));
     mp4_box_tfhd_optional_print(p + 8, p + len, depth, flags);
 }
 
 static void
 mp4_box_tkhd_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Version:            %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:              0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Creation time:      %u\n", indent(depth, 0), get_u32(p + 4));
-    printf("%s  Modification time:  %u\n", indent(depth, 0), get_u32(p + 8));
-    printf("%s  Track ID:           %u\n", indent(depth, 0), get_u32(p + 12));
+    // version 0 layout, up to the track height
+    if (mp4_box_truncated(p, len, 84)) {
+        return;
+    }
+    mp4_field_u(depth, "Version:            ", p[0]);
+    mp4_field_hex(depth, "Flags:              0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Creation time:      ", get_u32(p + 4));
+    mp4_field_u(depth, "Modification time:  ", get_u32(p + 8));
+    mp4_field_u(depth, "Track ID:           ", get_u32(p + 12));
     // Reserved 4 bytes
-    printf("%s  Duration:           %u\n", indent(depth, 0), get_u32(p + 20));
+    mp4_field_u(depth, "Duration:           ", get_u32(p + 20));
     // Reserved 8 bytes
-    printf("%s  Layer:              %u\n", indent(depth, 0), get_u16(p + 32));
-    printf("%s  Alternate groupe:   %u\n", indent(depth, 0), get_u16(p + 34));
-    printf("%s  Volume:             %u\n", indent(depth, 0), get_u16(p + 36));
+    mp4_field_u(depth, "Layer:              ", get_u16(p + 32));
+    mp4_field_u(depth, "Alternate groupe:   ", get_u16(p + 34));
+    mp4_field_u(depth, "Volume:             ", get_u16(p + 36));
     // Reserved 2 bytes
 
     // printf("%s  Matrix structure:   %u\n",indent(depth, 0), get_u32(p+2));
-    printf("%s  Track width:        %u\n", indent(depth, 0), get_u32(p + 76));
-    printf("%s  Track height:       %u\n", indent(depth, 0), get_u32(p + 80));
+    mp4_field_u(depth, "Track width:        ", get_u32(p + 76));
+    mp4_field_u(depth, "Track height:       ", get_u32(p + 80));
+}
+
+// Table rows decoded at a time
+#define MP4_TABLE_BLOCK_ROWS 256
+
+// Rows of width esize-byte columns that the count field of a table promises
+// and the len bytes left in its box hold, reporting a count that overruns
+// the box. The table decode reads whole blocks, so it must never be handed
+// more rows than this.
+static int
+mp4_table_num(const uint8_t *p, size_t len, uint32_t count, int esize, int width)
+{
+    const size_t row_size = (size_t)esize * width;
+    const size_t rows = row_size ? len / row_size : 0;
+    if (count > rows) {
+        if (row_size) {
+            fprintf(stderr, "%s:%d %s table of %u entries truncated to %zu at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, count, rows,
+                (unsigned long long)mp4_offset(p));
+        }
+        count = rows;
+    }
+    return count > INT_MAX ? INT_MAX : (int)count;
 }
 
 static void
 mp4_table_print(const char *name, const char *header, const uint8_t *p, int esize, int width, int num, int depth)
 {
-    printf("%s  %s:\n", indent(depth, 0), name);
-    printf("%s             %s\n", indent(depth, 0), header);
-    int offset = 0;
-    for (int i = 0; i < num; i++) {
-        printf("%s      %3d:", indent(depth, 0), i + 1);
-        for (int j = 0; j < width; j++) {
-            printf("   %6u", get_u32(p + offset));
-            offset += esize;
+    uint32_t block[MP4_TABLE_BLOCK_ROWS * 8];
+    uint64_t row[8];
+    mp4_field_table_begin(depth, name, header, width);
+    for (int i = 0; i < num; i += MP4_TABLE_BLOCK_ROWS) {
+        const int n = num - i < MP4_TABLE_BLOCK_ROWS ? num - i : MP4_TABLE_BLOCK_ROWS;
+        const size_t values = (size_t)n * width;
+        if (esize == 4) {
+            mp4_be32_decode(block, p, values);
+        } else {
+            for (size_t k = 0; k < values; k++) {
+                block[k] = get_u32(p + k * esize);
+            }
+        }
+        p += values * esize;
+        for (int r = 0; r < n; r++) {
+            for (int j = 0; j < width; j++) {
+                row[j] = block[r * width + j];
+            }
+            mp4_field_table_row(row);
         }
-        printf("\n");
     }
+    mp4_field_table_end();
 }
 
 static void
 mp4_box_trun_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint8_t *end = p + len;
     uint32_t flags = get_u24(p + 1);
     const uint32_t samples = get_u32(p + 4);
     char table_hdr[128] = {0};
     int table_fields = 0;
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.6x\n", indent(depth, 0), flags);
-    printf("%s  Samples:     %u\n", indent(depth, 0), samples);
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", flags, 6);
+    mp4_field_u(depth, "Samples:     ", samples);
 
     p += 8;
 
-    if (flags & 1) {
-        printf("%s  Data Offset: %u\n", indent(depth, 0), get_u32(p));
+    if ((flags & 1) && !mp4_box_truncated(p, end - p, 4)) {
+        mp4_field_u(depth, "Data Offset: ", get_u32(p));
         p += 4;
     }
 
@@ -866,30 +1463,37 @@ mp4_box_trun_print(const uint8_t *p, size_t len, int depth)
         table_fields++;
     }
 
-    mp4_table_print("Sample Table", table_hdr, p, 4, table_fields, samples, depth);
+    const int num = mp4_table_num(p, end - p, samples, 4, table_fields);
+    mp4_table_print("Sample Table", table_hdr, p, 4, table_fields, num, depth);
 }
 
 static void
 mp4_box_ctab_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Color Table Seed   %x\n", indent(depth, 0), get_u32(p));
-    printf("%s  Color Table Flags  %u\n", indent(depth, 0), get_u16(p + 4));
-    printf("%s  Color Table Size   %u\n", indent(depth, 0), get_u16(p + 6));
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    mp4_field_hex(depth, "Color Table Seed   ", get_u32(p), 0);
+    mp4_field_u(depth, "Color Table Flags  ", get_u16(p + 4));
+    mp4_field_u(depth, "Color Table Size   ", get_u16(p + 6));
 }
 
 static void
 mp4_box_schm_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 12)) {
+        return;
+    }
     uint32_t flags = get_u24(p + 1);
 
-    printf("%s  Version:       %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:         0x%.6x\n", indent(depth, 0), flags);
+    mp4_field_u(depth, "Version:       ", p[0]);
+    mp4_field_hex(depth, "Flags:         0x", flags, 6);
 
-    printf("%s  Scheme Type:    %c%c%c%c\n", indent(depth, 0), p[4], p[5], p[6], p[7]);
-    printf("%s  Scheme Version: %u\n", indent(depth, 0), get_u32(p + 8));
+    mp4_field_bytes(depth, "Scheme Type:    ", p + 4, 4);
+    mp4_field_u(depth, "Scheme Version: ", get_u32(p + 8));
 
     if (flags & 0x1) {
-        printf("%s  Scheme URI: TODO\n", indent(depth, 0));
+        mp4_field_text(depth, "Scheme URI: TODO");
     }
 }
 
@@ -909,6 +1513,10 @@ mp4_hexstr(const uint8_t *p, size_t len)
 static void
 mp4_box_senc_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint8_t *end = p + len;
     const uint32_t flags = get_u24(p + 1);
     uint32_t sample_count = get_u32(p + 4);
     uint32_t i = 0;
@@ -931,25 +1539,38 @@ mp4_box_senc_print(const uint8_t *p, size_t len, int depth)
     //    }[ sample_count ]
     //}
 
-    printf("%s  Version:      %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:        0x%.6x\n", indent(depth, 0), flags);
-    printf("%s  Sample Count: %u\n", indent(depth, 0), sample_count);
+    mp4_field_u(depth, "Version:      ", p[0]);
+    mp4_field_hex(depth, "Flags:        0x", flags, 6);
+    mp4_field_u(depth, "Sample Count: ", sample_count);
 
     p += 8;
     //  printf("%s  Sample\n", indent(depth, 0), j);
     for (i = 0; i < sample_count; i++) {
+        if (mp4_box_truncated(p, end - p, flags & 0x000002 ? 10 : 8)) {
+            return;
+        }
         // Print 8 bytes IV
-        printf("%s Sample: %3u\n", indent(depth, 1), i);
-        printf("%s  IV:     %s\n", indent(depth + 1, 0), mp4_hexstr(p, 8));
+        mp4_header_field_print(depth, " Sample: ", i, 3);
+        mp4_field_str(depth + 1, "IV:     ", mp4_hexstr(p, 8));
         p += 8;
 
         if (flags & 0x000002) {
             uint32_t sub_sample_count = get_u16(p);
-            printf("%s  Subsample Count: %u\n", indent(depth + 1, 1), sub_sample_count);
+            mp4_header_field_print(depth + 1, "  Subsample Count: ", sub_sample_count, 0);
             p += 2;
-            printf("%s  Subsample  BytesOfClear  BytesOfProtectedData\n", indent(depth + 2, 0));
+            mp4_field_text(depth + 2, "Subsample  BytesOfClear  BytesOfProtectedData");
             for (j = 0; j < sub_sample_count; j++) {
-                printf("%s  %9d  %12u  %20u\n", indent(depth + 2, 0), j, get_u16(p), get_u32(p + 2));
+                if (mp4_box_truncated(p, end - p, 6)) {
+                    return;
+                }
+                mp4_out_indent(depth + 2, 0);
+                mp4_out_str("  ");
+                mp4_out_u64_width(j, 9);
+                mp4_out_str("  ");
+                mp4_out_u64_width(get_u16(p), 12);
+                mp4_out_str("  ");
+                mp4_out_u64_width(get_u32(p + 2), 20);
+                mp4_out_char('\n');
                 p += 6;
             }
         }
@@ -959,44 +1580,50 @@ mp4_box_senc_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_stsd_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
     uint32_t flags = get_u24(p + 1);
     const uint32_t num_entries = get_u32(p + 4);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.6x\n", indent(depth, 0), flags);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num_entries);
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", flags, 6);
+    mp4_field_u(depth, "Num Entries: ", num_entries);
 
     // Print recursive boxes
-    mp4_print(p + 8, len - 8, depth);
+    mp4_print_children(p + 8, len - 8);
 }
 
 // 14496-12:2015 12.6.3.2
 static void
 mp4_box_stpp_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Reference Index: %u\n", indent(depth, 0), get_u16(p + 6));
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    mp4_field_u(depth, "Reference Index: ", get_u16(p + 6));
 
     do {
         const uint8_t *pp = p;
         const uint8_t *end = p + len;
 
         pp += 8;
-        printf("%s  Namespace:       %s\n", indent(depth, 0), (const char *)pp);
+        mp4_field_str(depth, "Namespace:       ", (const char *)pp);
         pp += strlen((const char *)pp) + 1;
         if (pp >= end) {
             break;
         }
-        printf("%s  Scheme Location: %s\n", indent(depth, 0), (const char *)pp);
+        mp4_field_str(depth, "Scheme Location: ", (const char *)pp);
         pp += strlen((const char *)pp) + 1;
         if (pp >= end) {
             break;
         }
-        printf("%s  Aux Mime Type:   %s\n", indent(depth, 0), (const char *)pp);
+        mp4_field_str(depth, "Aux Mime Type:   ", (const char *)pp);
         pp += strlen((const char *)pp) + 1;
         if (pp >= end) {
             break;
         }
-        mp4_print(pp, end - pp, depth);
+        mp4_print_children(pp, end - pp);
     } while (0);
 
     mp4_hexdump(p, len, depth);
@@ -1006,8 +1633,11 @@ mp4_box_stpp_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_mime_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Version and Flags: %u\n", indent(depth, 0), get_u32(p));
-    printf("%s  Content Type: %.*s\n", indent(depth, 0), (int)(len - 4), (const char *)p + 4);
+    if (mp4_box_truncated(p, len, 4)) {
+        return;
+    }
+    mp4_field_u(depth, "Version and Flags: ", get_u32(p));
+    mp4_field_strn(depth, "Content Type: ", (const char *)p + 4, (int)(len - 4));
 }
 
 static void
@@ -1020,6 +1650,9 @@ mp4_box_mdat_hevc_nal_print(const uint8_t *p, size_t len, int depth)
     //      nuh_temporal_id_plus1       u(3)
     //  }
 
+    if (len < 2) {
+        return;
+    }
     uint8_t type = (p[0] >> 1) & 0x3f;
     uint8_t layer_id = ((p[0] & 1) << 5) | (p[1] >> 3);
     uint8_t temporal_id_plus1 = p[1] & 0x3;
@@ -1071,26 +1704,27 @@ mp4_box_mdat_hevc_nal_print(const uint8_t *p, size_t len, int depth)
         break;
     }
 
-    printf("%s  nal_unit_type:        %u (%s)\n", indent(depth, 0), type, typestr);
-    printf("%s  nuh_layer_id:         %u\n", indent(depth, 0), layer_id);
-    printf("%s  nuh_temporal_id_plus1 %u\n", indent(depth, 0), temporal_id_plus1);
+    mp4_nal_type_print(depth, "nal_unit_type:        ", type, typestr);
+    mp4_field_u(depth, "nuh_layer_id:         ", layer_id);
+    mp4_field_u(depth, "nuh_temporal_id_plus1 ", temporal_id_plus1);
     if (hexdump) {
         mp4_hexdump(p, len, depth);
     }
 }
 
 static void
-mp4_box_mdat_hevc_print(const uint8_t *p, size_t len, int depth)
+mp4_mdat_hevc_print(const uint8_t *p, size_t len, int length_size, int depth)
 {
 
     const uint8_t *p_end = p + len;
 
-    while (p < p_end) {
-        uint32_t nal_length = get_u32(p);
-        p += 4;
+    while (p < p_end && mp4_nal_fits(p, p_end, length_size)) {
+        uint32_t nal_length = mp4_nal_length(p, length_size);
+        p += length_size;
 
-        printf("%s--- Offset: %zu Length %u Type: HEVC NAL\n", indent(depth, 1), p - g_content_buf, nal_length);
+        mp4_header_print(depth, mp4_offset(p), " Length ", nal_length, "HEVC NAL");
         mp4_box_mdat_hevc_nal_print(p, nal_length, depth + 1);
+        mp4_box_end();
         p += nal_length;
     }
 }
@@ -1099,17 +1733,25 @@ static void
 mp4_box_stsd_hvcC_print(const uint8_t *p, size_t len, int depth)
 {
     mp4_hexdump(p, len, depth);
-    mdat_printer = mp4_box_mdat_hevc_print;
+    mdat_printer = mp4_mdat_hevc_print;
+    // lengthSizeMinusOne in the low bits of the 22nd byte
+    if (len >= 22) {
+        g_nal_length_size = (p[21] & 0x03) + 1;
+    }
 }
 
 static void
 mp4_box_stts_print(const uint8_t *p, size_t len, int depth)
 {
-    const int num = get_u32(p + 4);
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint32_t count = get_u32(p + 4);
+    const int num = mp4_table_num(p + 8, len - 8, count, 4, 2);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num);
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Num Entries: ", count);
 
     mp4_table_print("Time-to-sample table", "Sample count | Sample duration", p + 8, 4, 2, num, depth);
 }
@@ -1117,13 +1759,17 @@ mp4_box_stts_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_ctts_print(const uint8_t *p, size_t len, int depth)
 {
-    const int num = get_u32(p + 4);
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint32_t count = get_u32(p + 4);
+    const int num = mp4_table_num(p + 8, len - 8, count, 4, 2);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num);
-    printf("%s  Composition-offset table:\n", indent(depth, 0));
-    printf("%s        Sample count | Composition offset\n", indent(depth, 0));
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Num Entries: ", count);
+    mp4_field_text(depth, "Composition-offset table:");
+    mp4_field_text(depth, "      Sample count | Composition offset");
 
     mp4_table_print("Composition-offset table", "Sample count | Composition offset", p + 8, 4, 2, num, depth);
 }
@@ -1131,6 +1777,9 @@ mp4_box_ctts_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_saio_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 4)) {
+        return;
+    }
     /*
      * aligned(8) class SampleAuxiliaryInformationOffsetsBox
      * extends FullBox(‘saio’, version, flags)
@@ -1149,32 +1798,39 @@ mp4_box_saio_print(const uint8_t *p, size_t len, int depth)
      * }
      *
      */
+    const uint8_t *end = p + len;
     uint8_t version = p[0];
     uint32_t flags = get_u24(p + 1);
     uint8_t entry_count = 0;
 
-    printf("%s  Version:                  %u\n", indent(depth, 0), version);
-    printf("%s  Flags:                    0x%.6x\n", indent(depth, 0), flags);
+    mp4_field_u(depth, "Version:                  ", version);
+    mp4_field_hex(depth, "Flags:                    0x", flags, 6);
     p += 4;
 
+    if (mp4_box_truncated(p, end - p, flags & 1 ? 12 : 4)) {
+        return;
+    }
     if (flags & 1) {
-        printf("%s  Aux Info Type:            %c%c%c%c\n", indent(depth, 0), p[0], p[1], p[2], p[3]);
-        printf("%s  Aux Info Type Parameter:  %u\n", indent(depth, 0), get_u32(p + 4));
+        mp4_field_bytes(depth, "Aux Info Type:            ", p, 4);
+        mp4_field_u(depth, "Aux Info Type Parameter:  ", get_u32(p + 4));
         p += 8;
     }
 
     entry_count = get_u32(p);
     p += 4;
+    if (mp4_box_truncated(p, end - p, (size_t)entry_count * (version == 0 ? 4 : 8))) {
+        return;
+    }
     if (version == 0) {
-        printf("%s  Entry     Offset\n", indent(depth, 0));
+        mp4_field_text(depth, "Entry     Offset");
         for (int i = 0; i < entry_count; i++) {
-            printf("%s  %3d:       %u\n", indent(depth, 0), i, get_u32(p));
+            mp4_row_print(depth, i, ":       ", get_u32(p), 0);
             p += 4;
         }
     } else {
-        printf("%s  Entry     Offset\n", indent(depth, 0));
+        mp4_field_text(depth, "Entry     Offset");
         for (int i = 0; i < entry_count; i++) {
-            printf("%s  %3d:       %llu\n", indent(depth, 0), i, (long long unsigned)get_u64(p));
+            mp4_row_print(depth, i, ":       ", get_u64(p), 0);
             p += 8;
         }
     }
@@ -1183,6 +1839,9 @@ mp4_box_saio_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_saiz_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 4)) {
+        return;
+    }
     /*
      * aligned(8) class SampleAuxiliaryInformationSizesBox
      *  extends FullBox(‘saiz’, version = 0, flags)
@@ -1199,26 +1858,30 @@ mp4_box_saiz_print(const uint8_t *p, size_t len, int depth)
      * }
      *
      **/
+    const uint8_t *end = p + len;
     uint32_t flags = get_u24(p + 1);
 
-    printf("%s  Version:                  %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:                    0x%.6x\n", indent(depth, 0), flags);
+    mp4_field_u(depth, "Version:                  ", p[0]);
+    mp4_field_hex(depth, "Flags:                    0x", flags, 6);
     p += 4;
+    if (mp4_box_truncated(p, end - p, flags & 1 ? 13 : 5)) {
+        return;
+    }
     if (flags & 1) {
-        printf("%s  Aux Info Type:            %c%c%c%c\n", indent(depth, 0), p[0], p[1], p[2], p[3]);
-        printf("%s  Aux Info Type Parameter:  %u\n", indent(depth, 0), get_u32(p + 4));
+        mp4_field_bytes(depth, "Aux Info Type:            ", p, 4);
+        mp4_field_u(depth, "Aux Info Type Parameter:  ", get_u32(p + 4));
         p += 8;
     }
     uint8_t default_sample_info_size = p[0];
     uint8_t sample_count = get_u32(p + 1);
-    printf("%s  Default Sample Info Size: %u\n", indent(depth, 0), default_sample_info_size);
-    printf("%s  Sample Count:             %u\n", indent(depth, 0), sample_count);
+    mp4_field_u(depth, "Default Sample Info Size: ", default_sample_info_size);
+    mp4_field_u(depth, "Sample Count:             ", sample_count);
 
     p += 5;
-    if (default_sample_info_size == 0) {
-        printf("%s  Sample     Sample Info Size\n", indent(depth, 0));
+    if (default_sample_info_size == 0 && !mp4_box_truncated(p, end - p, sample_count)) {
+        mp4_field_text(depth, "Sample     Sample Info Size");
         for (int i = 0; i < sample_count; i++) {
-            printf("%s  %3d:           %.2u\n", indent(depth, 0), i, p[i]);
+            mp4_row_print(depth, i, ":           ", p[i], 2);
         }
     }
 }
@@ -1226,11 +1889,15 @@ mp4_box_saiz_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_stsc_print(const uint8_t *p, size_t len, int depth)
 {
-    const int num = get_u32(p + 4);
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint32_t count = get_u32(p + 4);
+    const int num = mp4_table_num(p + 8, len - 8, count, 4, 3);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num);
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Num Entries: ", count);
 
     mp4_table_print("Composition-offset table", "First chunk | Samples per chunk | Sample Description ID", p + 8, 4, 3, num, depth);
 }
@@ -1238,13 +1905,18 @@ mp4_box_stsc_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_stsz_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 12)) {
+        return;
+    }
     const int sample_size = get_u32(p + 4);
-    const int num = get_u32(p + 8);
+    const uint32_t count = get_u32(p + 8);
+    // a constant sample_size has no table
+    const int num = mp4_table_num(p + 12, len - 12, sample_size ? 0 : count, 4, 1);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Sample size: %u\n", indent(depth, 0), sample_size);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num);
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Sample size: ", sample_size);
+    mp4_field_u(depth, "Num Entries: ", count);
 
     mp4_table_print("Sample size table", "Size", p + 12, 4, 1, num, depth);
 }
@@ -1252,11 +1924,15 @@ mp4_box_stsz_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_stco_print(const uint8_t *p, size_t len, int depth)
 {
-    const int num = get_u32(p + 4);
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint32_t count = get_u32(p + 4);
+    const int num = mp4_table_num(p + 8, len - 8, count, 4, 1);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num);
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Num Entries: ", count);
 
     mp4_table_print("Sample size table", "Size", p + 8, 4, 1, num, depth);
 }
@@ -1264,11 +1940,15 @@ mp4_box_stco_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_stss_print(const uint8_t *p, size_t len, int depth)
 {
-    const int num = get_u32(p + 4);
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint32_t count = get_u32(p + 4);
+    const int num = mp4_table_num(p + 8, len - 8, count, 4, 1);
 
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num);
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Num Entries: ", count);
 
     mp4_table_print("Sync sample table", "Size", p + 8, 4, 1, num, depth);
 }
@@ -1277,37 +1957,56 @@ mp4_box_stss_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_subs_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 8)) {
+        return;
+    }
+    const uint8_t *end = p + len;
     const int num = get_u32(p + 4);
     const int version = p[0];
 
-    printf("%s  Version:     %u\n", indent(depth, 0), version);
-    printf("%s  Flags:       0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num);
+    mp4_field_u(depth, "Version:     ", version);
+    mp4_field_hex(depth, "Flags:       0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Num Entries: ", num);
 
     p += 8;
 
     int last_entry = 0;
     for (int entry = 0; entry < num; entry++) {
+        if (mp4_box_truncated(p, end - p, 6)) {
+            return;
+        }
         const int delta = get_u32(p);
         const int sub_count = get_u16(p + 4);
 
         p += 6;
         if (sub_count) {
             last_entry += delta;
-            printf("%s      %3u      Size     Prio  Discardable\n", indent(depth, 0), last_entry);
+            mp4_out_indent(depth, 0);
+            mp4_out_str("      ");
+            mp4_out_u64_width(last_entry, 3);
+            mp4_out_str("      Size     Prio  Discardable\n");
         }
         for (int sub = 0; sub < sub_count; sub++) {
-            printf("%s      %3d:", indent(depth, 0), sub + 1);
+            if (mp4_box_truncated(p, end - p, version == 1 ? 10 : 8)) {
+                return;
+            }
+            mp4_out_indent(depth, 0);
+            mp4_out_str("      ");
+            mp4_out_u64_width(sub + 1, 3);
+            mp4_out_char(':');
+            mp4_out_str("   ");
             if (version == 1) {
-                printf("   %6u", get_u32(p));
+                mp4_out_u64_width(get_u32(p), 6);
                 p += 4;
             } else {
-                printf("   %6u", get_u16(p));
+                mp4_out_u64_width(get_u16(p), 6);
                 p += 2;
             }
-            printf("   %6u", p[0]);
-            printf("   %6u", p[1]);
-            printf("\n");
+            mp4_out_str("   ");
+            mp4_out_u64_width(p[0], 6);
+            mp4_out_str("   ");
+            mp4_out_u64_width(p[1], 6);
+            mp4_out_char('\n');
             p += 6;
         }
     }
@@ -1316,31 +2015,41 @@ mp4_box_subs_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_tenc_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 24)) {
+        return;
+    }
     uint32_t flags = get_u24(p + 1);
     uint32_t is_encrypted = get_u24(p + 4);
 
-    printf("%s  Version:       %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:         0x%.6x\n", indent(depth, 0), flags);
-    printf("%s  IsEncrypted:   %u\n", indent(depth, 0), is_encrypted);
-    printf("%s  IV_Size:       %u\n", indent(depth, 0), p[7]);
+    mp4_field_u(depth, "Version:       ", p[0]);
+    mp4_field_hex(depth, "Flags:         0x", flags, 6);
+    mp4_field_u(depth, "IsEncrypted:   ", is_encrypted);
+    mp4_field_u(depth, "IV_Size:       ", p[7]);
 
-    printf("%s  Default Key ID %.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x%.2x\n", indent(depth, 0), p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15], p[16], p[17], p[18], p[19], p[20], p[21], p[22], p[23]);
+    mp4_field_hexbytes(depth, "Default Key ID ", p + 8, 16);
 }
 
 static void
 mp4_box_uuid_sample_encryption(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 4)) {
+        return;
+    }
+    const uint8_t *end = p + len;
     const uint32_t flags = get_u24(p + 1);
 
-    printf("%s  Name:        Sample Encryption Box\n", indent(depth, 0));
-    printf("%s  Version:     %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:       0x%.6x\n", indent(depth, 0), flags);
+    mp4_field_text(depth, "Name:        Sample Encryption Box");
+    mp4_field_u(depth, "Version:     ", p[0]);
+    mp4_field_hex(depth, "Flags:       0x", flags, 6);
 
     p += 4;
+    if (mp4_box_truncated(p, end - p, flags & 1 ? 24 : 4)) {
+        return;
+    }
     if (flags & 1) {
-        printf("%s  AlgorithmID: 0x%.2x%.2x%.2x\n", indent(depth, 0), p[0], p[1], p[2]);
-        printf("%s  IV Sizes:       %u\n", indent(depth, 0), p[3]);
-        printf("%s  Key ID:\n", indent(depth, 0));
+        mp4_field_hex(depth, "AlgorithmID: 0x", get_u24(p), 6);
+        mp4_field_u(depth, "IV Sizes:       ", p[3]);
+        mp4_field_text(depth, "Key ID:");
         mp4_hexdump(p + 4, 16, depth);
         p += 20;
     }
@@ -1348,25 +2057,38 @@ mp4_box_uuid_sample_encryption(const uint8_t *p, size_t len, int depth)
     uint32_t num_entries = get_u32(p);
     p += 4;
 
-    printf("%s  Num Entries: %u\n", indent(depth, 0), num_entries);
-    printf("%s  Entry           IV             Entries\n", indent(depth, 0));
+    mp4_field_u(depth, "Num Entries: ", num_entries);
+    mp4_field_text(depth, "Entry           IV             Entries");
 
     uint8_t iv_size = 8;
     for (uint32_t i = 0; i < num_entries; i++) {
+        if (mp4_box_truncated(p, end - p, iv_size + (flags & 2 ? 2 : 0))) {
+            return;
+        }
         if (iv_size) {
-            printf("%s Entry: %3u\n", indent(depth, 1), i);
-            printf("%s  IV:     %s\n", indent(depth + 1, 0), mp4_hexstr(p, 8));
+            mp4_header_field_print(depth, " Entry: ", i, 3);
+            mp4_field_str(depth + 1, "IV:     ", mp4_hexstr(p, 8));
             p += iv_size;
         }
 
         if (flags & 2) {
             uint16_t num_sub_samples = get_u16(p);
-            printf("%s  Sub-Entries Count: %u\n", indent(depth + 1, 1), num_sub_samples);
+            mp4_header_field_print(depth + 1, "  Sub-Entries Count: ", num_sub_samples, 0);
             p += 2;
 
-            printf("%s  Sub-Entry  BytesOfClear  BytesOfProtectedData\n", indent(depth + 2, 0));
+            mp4_field_text(depth + 2, "Sub-Entry  BytesOfClear  BytesOfProtectedData");
             for (uint32_t j = 0; j < num_sub_samples; j++) {
-                printf("%s  %9d  %12u  %20u\n", indent(depth + 2, 0), j, get_u16(p), get_u32(p + 2));
+                if (mp4_box_truncated(p, end - p, 6)) {
+                    return;
+                }
+                mp4_out_indent(depth + 2, 0);
+                mp4_out_str("  ");
+                mp4_out_u64_width(j, 9);
+                mp4_out_str("  ");
+                mp4_out_u64_width(get_u16(p), 12);
+                mp4_out_str("  ");
+                mp4_out_u64_width(get_u32(p + 2), 20);
+                mp4_out_char('\n');
                 p += 6;
             }
         }
@@ -1378,26 +2100,40 @@ mp4_box_uuid_sample_encryption(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_uuid_tfrf(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 5)) {
+        return;
+    }
     const uint32_t flags = get_u24(p + 1);
     const uint8_t fragment_count = p[4];
 
-    printf("%s  Name:           tfrf\n", indent(depth, 0));
-    printf("%s  Version:        %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:          0x%.6x\n", indent(depth, 0), flags);
-    printf("%s  Fragment Count: %u\n", indent(depth, 0), fragment_count);
-    printf("%s    Fragment    Time              Duration\n", indent(depth, 0));
+    mp4_field_text(depth, "Name:           tfrf");
+    mp4_field_u(depth, "Version:        ", p[0]);
+    mp4_field_hex(depth, "Flags:          0x", flags, 6);
+    mp4_field_u(depth, "Fragment Count: ", fragment_count);
+    mp4_field_text(depth, "  Fragment    Time              Duration");
+    if (fragment_count && mp4_box_truncated(p, len, flags & 1 ? 13 : 21)) {
+        return;
+    }
     for (unsigned int i = 0; i < fragment_count; i++) {
-        if (flags & 1) {
-            printf("%s    %u           %16u  %u\n", indent(depth, 0), i, get_u32(p + 5), get_u32(p + 9));
-        } else {
-            printf("%s    %u           %16lu  %lu\n", indent(depth, 0), i, get_u64(p + 5), get_u64(p + 13));
-        }
+        const uint64_t time = flags & 1 ? get_u32(p + 5) : get_u64(p + 5);
+        const uint64_t duration = flags & 1 ? get_u32(p + 9) : get_u64(p + 13);
+        mp4_out_indent(depth, 0);
+        mp4_out_str("    ");
+        mp4_out_u64(i);
+        mp4_out_str("           ");
+        mp4_out_u64_width(time, 16);
+        mp4_out_str("  ");
+        mp4_out_u64(duration);
+        mp4_out_char('\n');
     }
 }
 
 static void
 mp4_box_uuid_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 16)) {
+        return;
+    }
     struct {
         const uint8_t uuid[16];
         mp4_box_func func;
@@ -1419,20 +2155,25 @@ mp4_box_uuid_print(const uint8_t *p, size_t len, int depth)
 static void
 mp4_box_vmhd_print(const uint8_t *p, size_t len, int depth)
 {
-    printf("%s  Version:      %u\n", indent(depth, 0), p[0]);
-    printf("%s  Flags:        0x%.2x%.2x%.2x\n", indent(depth, 0), p[1], p[2], p[3]);
-    printf("%s  Graphic mode: %u\n", indent(depth, 0), get_u16(p + 4));
-    printf("%s  Opcolor       TODO\n", indent(depth, 0));
+    if (mp4_box_truncated(p, len, 6)) {
+        return;
+    }
+    mp4_field_u(depth, "Version:      ", p[0]);
+    mp4_field_hex(depth, "Flags:        0x", get_u24(p + 1), 6);
+    mp4_field_u(depth, "Graphic mode: ", get_u16(p + 4));
+    mp4_field_text(depth, "Opcolor       TODO");
 }
 
 static void
 mp4_box_mdat_print(const uint8_t *p, size_t len, int depth)
 {
-    if (mdat_printer != NULL) {
-        mdat_printer(p, len, depth);
+    if (mp4_mdat_samples_print(p, len, depth)) {
+        // walked by the sample tables
+    } else if (mdat_printer != NULL) {
+        mdat_printer(p, len, g_nal_length_size, depth);
     } else {
         // TODO: using h264 as default for now
-        mp4_box_mdat_hevc_print(p, len, depth);
+        mp4_mdat_hevc_print(p, len, g_nal_length_size, depth);
     }
 }
 
@@ -1451,75 +2192,858 @@ struct trex_flags {
 static void
 mp4_box_trex_print(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_box_truncated(p, len, 20)) {
+        return;
+    }
     uint32_t flags_value = get_u32(p + 16);
     const struct trex_flags *flags = (const struct trex_flags *)&flags_value;
 
-    printf("%s  Track ID:                %u\n", indent(depth, 0), get_u32(p));
-    printf("%s  Default sample description index: %u\n", indent(depth, 0), get_u32(p + 4));
-    printf("%s  Default sample duration: %u\n", indent(depth, 0), get_u32(p + 8));
-    printf("%s  Default sample size:     %u\n", indent(depth, 0), get_u32(p + 12));
+    mp4_field_u(depth, "Track ID:                ", get_u32(p));
+    mp4_field_u(depth, "Default sample description index: ", get_u32(p + 4));
+    mp4_field_u(depth, "Default sample duration: ", get_u32(p + 8));
+    mp4_field_u(depth, "Default sample size:     ", get_u32(p + 12));
+
+    mp4_field_u(depth, "Is Leading:              ", flags->is_leading);
+    mp4_field_u(depth, "Sample Depends On:       ", flags->sample_depends_on);
+    mp4_field_u(depth, "Sample Is Depended On:   ", flags->sample_is_depended_on);
+    mp4_field_u(depth, "Sample Has Redundancy:   ", flags->sample_has_redundancy);
+    mp4_field_u(depth, "Sample Padding Value:    ", flags->sample_padding_value);
+    mp4_field_u(depth, "Sample Is Non-Sync:      ", flags->sample_is_non_sync_sample);
+    mp4_field_u(depth, "Sample Degradation Prio: ", flags->sample_degradation_priority);
+}
+
+// "xx " for every byte value, so a line of hex is built by copying
+static const char g_hexdump_hex[256][3] = {
+#define MP4_HEX3(n) {"0123456789abcdef"[(n) >> 4], "0123456789abcdef"[(n)&0x0f], ' '}
+#define MP4_HEX3_ROW(n) MP4_HEX3(n), MP4_HEX3(n + 1), MP4_HEX3(n + 2), MP4_HEX3(n + 3), MP4_HEX3(n + 4), MP4_HEX3(n + 5), \
+                        MP4_HEX3(n + 6), MP4_HEX3(n + 7), MP4_HEX3(n + 8), MP4_HEX3(n + 9), MP4_HEX3(n + 10),            \
+                        MP4_HEX3(n + 11), MP4_HEX3(n + 12), MP4_HEX3(n + 13), MP4_HEX3(n + 14), MP4_HEX3(n + 15)
+    MP4_HEX3_ROW(0x00), MP4_HEX3_ROW(0x10), MP4_HEX3_ROW(0x20), MP4_HEX3_ROW(0x30),
+    MP4_HEX3_ROW(0x40), MP4_HEX3_ROW(0x50), MP4_HEX3_ROW(0x60), MP4_HEX3_ROW(0x70),
+    MP4_HEX3_ROW(0x80), MP4_HEX3_ROW(0x90), MP4_HEX3_ROW(0xa0), MP4_HEX3_ROW(0xb0),
+    MP4_HEX3_ROW(0xc0), MP4_HEX3_ROW(0xd0), MP4_HEX3_ROW(0xe0), MP4_HEX3_ROW(0xf0),
+#undef MP4_HEX3_ROW
+#undef MP4_HEX3
+};
 
-    printf("%s  Is Leading:              %u\n", indent(depth, 0), flags->is_leading);
-    printf("%s  Sample Depends On:       %u\n", indent(depth, 0), flags->sample_depends_on);
-    printf("%s  Sample Is Depended On:   %u\n", indent(depth, 0), flags->sample_is_depended_on);
-    printf("%s  Sample Has Redundancy:   %u\n", indent(depth, 0), flags->sample_has_redundancy);
-    printf("%s  Sample Padding Value:    %u\n", indent(depth, 0), flags->sample_padding_value);
-    printf("%s  Sample Is Non-Sync:      %u\n", indent(depth, 0), flags->sample_is_non_sync_sample);
-    printf("%s  Sample Degradation Prio: %u\n", indent(depth, 0), flags->sample_degradation_priority);
+// One line: 16 "xx " columns, " |", 16 characters, non-printable ones as
+// '.', "|\n"; a short last line is padded with spaces
+static size_t
+mp4_hexdump_line(char *line, const uint8_t *p, size_t len)
+{
+    char *hex = line;
+    char *txt = line + 16 * 3 + 2;
+    memset(line, ' ', 16 * 3 + 2 + 16);
+    for (size_t i = 0; i < len; i++) {
+        memcpy(hex + i * 3, g_hexdump_hex[p[i]], 3);
+        txt[i] = p[i] >= 0x20 && p[i] < 0x7f ? p[i] : '.';
+    }
+    line[16 * 3 + 1] = '|';
+    txt[16] = '|';
+    txt[17] = '\n';
+    return 16 * 3 + 2 + 16 + 2;
 }
 
 static void
 mp4_hexdump(const uint8_t *p, size_t len, int depth)
 {
+    if (mp4_output_format() != MP4_OUTPUT_TEXT) {
+        // text only, nothing would be written
+        return;
+    }
+
     size_t truncated_len = 0;
+    if (len > g_hexdump_limit) {
+        truncated_len = len - g_hexdump_limit;
+        len = g_hexdump_limit;
+    }
 
-    // String templates to keep pretty alignment
-    const char *empty_hex = "                                                ";
-    const char *empty_txt = "                ";
-    char hex_buf[1024];
-    char txt_buf[1024];
-    sprintf(hex_buf, "%s", empty_hex);
-    sprintf(txt_buf, "%s", empty_txt);
+    char line[16 * 3 + 2 + 16 + 2];
+    for (size_t i = 0; i < len; i += 16) {
+        mp4_out_indent(depth, 0);
+        mp4_out_str("  ");
+        mp4_out_hex(i, 4);
+        mp4_out_str("    ");
+        mp4_out_write(line, mp4_hexdump_line(line, p + i, len - i < 16 ? len - i : 16));
+    }
+    if (len == 0 && truncated_len == 0) {
+        // an empty box still gets its blank line
+        mp4_out_write(line, mp4_hexdump_line(line, p, 0));
+    }
 
-    if (len > 128) {
-        truncated_len = len - 128;
-        len = 128;
+    if (truncated_len) {
+        mp4_out_indent(depth, 0);
+        mp4_out_str("   ... ");
+        mp4_out_u64(truncated_len);
+        mp4_out_str(" bytes truncated\n");
     }
+}
 
-    size_t line_pos = 0;
-    for (size_t i = 0; i < len; i++) {
-        line_pos = i & 0x0f;
+// Streaming input: a window over a pipe that only ever moves forward. A box
+// is read whole before its printer runs, except containers, whose children
+// are read one after the other, and mdat, whose NAL units are read a chunk at
+// a time and skipped past. The window thus never grows past the largest
+// non-mdat box.
+
+#define MP4_STREAM_CHUNK (64 * 1024)
+
+typedef struct {
+    int fd;
+    uint8_t *buf;
+    size_t cap;
+    size_t pos;       // start of the window
+    size_t len;       // end of the data read so far
+    uint64_t offset;  // file offset of buf[0]
+    uint64_t size;    // input size for a regular file, 0 when not known
+    bool eof;
+    bool seekable;    // skips past the window seek instead of reading
+} mp4_stream_t;
+
+// Window start as a file offset
+static uint64_t
+mp4_stream_offset(const mp4_stream_t *s)
+{
+    return s->offset + s->pos;
+}
+
+// Make the window hold need bytes; returns how many it holds, fewer at the
+// end of the input. The missing bytes read as zeros, so printers that peek
+// at a fixed number of header bytes stay in the buffer.
+static size_t
+mp4_stream_fill(mp4_stream_t *s, size_t need)
+{
+    if (s->len - s->pos >= need) {
+        return need;
+    }
+    if (s->pos > 0) {
+        memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+        s->offset += s->pos;
+        s->len -= s->pos;
+        s->pos = 0;
+    }
+    if (need > s->cap) {
+        size_t cap = s->cap ? s->cap : MP4_STREAM_CHUNK;
+        while (cap < need) {
+            cap *= 2;
+        }
+        uint8_t *buf = realloc(s->buf, cap);
+        if (!buf) {
+            fprintf(stderr, "%s:%d %s realloc(%zu) error: %s\n", __FILE__, __LINE__, __FUNCTION__, cap, strerror(errno));
+            s->eof = true;
+            return 0;
+        }
+        s->buf = buf;
+        s->cap = cap;
+    }
+    while (s->len < need && !s->eof) {
+        ssize_t n = read(s->fd, s->buf + s->len, s->cap - s->len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "%s:%d %s read error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        }
+        if (n <= 0) {
+            s->eof = true;
+            break;
+        }
+        s->len += n;
+    }
+    if (s->len < need) {
+        memset(s->buf + s->len, 0, need - s->len);
+        return s->len;
+    }
+    return need;
+}
 
-        // Print hex output to temporary buffer...
-        char hex[4];
-        sprintf(hex, "%02x ", p[i]);
-        // ...and use strncpy to avoid null-termination
-        strncpy(&hex_buf[line_pos * 3], hex, 3);
+// Move the window start n bytes forward, reading and dropping what is not
+// buffered yet; false at the end of the input
+static bool
+mp4_stream_skip(mp4_stream_t *s, uint64_t n)
+{
+    while (n > 0) {
+        size_t avail = s->len - s->pos;
+        if (avail == 0 && s->seekable && n > MP4_STREAM_CHUNK && lseek(s->fd, n, SEEK_CUR) >= 0) {
+            // an end past the input shows as EOF on the next read
+            s->offset += s->len + n;
+            s->pos = 0;
+            s->len = 0;
+            return true;
+        }
+        if (avail == 0) {
+            avail = mp4_stream_fill(s, n < MP4_STREAM_CHUNK ? n : MP4_STREAM_CHUNK);
+            if (avail == 0) {
+                return false;
+            }
+        }
+        size_t step = n < avail ? n : avail;
+        s->pos += step;
+        n -= step;
+    }
+    return true;
+}
+
+// Point mp4_offset() at the window before a printer runs on it
+static const uint8_t *
+mp4_stream_window(const mp4_stream_t *s)
+{
+    g_content_buf = s->buf;
+    g_content_offset = s->offset;
+    return s->buf + s->pos;
+}
+
+// The NAL units of len bytes of mdat payload; with to_eof the payload runs to
+// the end of the input instead, and len only bounds it
+static bool
+mp4_stream_mdat_print(mp4_stream_t *s, uint64_t len, bool to_eof, int depth)
+{
+    const mp4_nals_func printer = mdat_printer ? mdat_printer : mp4_mdat_hevc_print;
+    const int length_size = g_nal_length_size;
+    while (len >= (uint64_t)length_size) {
+        if (mp4_stream_fill(s, length_size) < (size_t)length_size) {
+            return to_eof;
+        }
+        // one length-prefixed NAL unit at a time, the printers only look at
+        // its first bytes
+        const uint64_t nal_size = length_size + (uint64_t)mp4_nal_length(s->buf + s->pos, length_size);
+        const size_t need = nal_size < MP4_STREAM_CHUNK ? nal_size : MP4_STREAM_CHUNK;
+        const size_t avail = mp4_stream_fill(s, need);
+        const uint8_t *p = mp4_stream_window(s);
+        printer(p, avail < need ? avail : nal_size, length_size, depth);
+
+        const uint64_t step = nal_size < len ? nal_size : len;
+        if (!mp4_stream_skip(s, step)) {
+            return to_eof;
+        }
+        len -= step;
+    }
+    return mp4_stream_skip(s, len) || to_eof;
+}
+
+// Boxes from the window start up to the file offset end, or to the end of
+// the input at the top level
+static bool
+mp4_stream_print(mp4_stream_t *s, uint64_t end, int depth)
+{
+    int path_matches = 0;
+    while (mp4_stream_offset(s) < end) {
+        size_t avail = mp4_stream_fill(s, 8);
+        if (avail == 0 && end == UINT64_MAX) {
+            return true;
+        }
+        if (avail < 8) {
+            fprintf(stderr, "%s:%d %s truncated box header at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)mp4_stream_offset(s));
+            return false;
+        }
+
+        const uint64_t box_offset = mp4_stream_offset(s);
+        uint64_t box_size = get_u32(s->buf + s->pos);
+        uint8_t box_type[5] = {0};
+        memcpy(box_type, s->buf + s->pos + 4, 4);
+        size_t header_size = 8;
+        if (box_size == 1) {
+            if (mp4_stream_fill(s, 16) < 16) {
+                fprintf(stderr, "%s:%d %s truncated box header at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)box_offset);
+                return false;
+            }
+            box_size = get_u64(s->buf + s->pos + 8);
+            header_size = 16;
+        }
+        // a box of size 0 extends to the end of its parent, at the top level
+        // to the end of the input: to its size for a file, until read()
+        // returns 0 for a pipe
+        bool to_eof = false;
+        if (box_size == 0 && end != UINT64_MAX) {
+            box_size = end - box_offset;
+        } else if (box_size == 0 && s->size > box_offset) {
+            box_size = s->size - box_offset;
+        } else if (box_size == 0) {
+            box_size = end - box_offset;
+            to_eof = true;
+        }
+        if (box_size < header_size || box_size > end - box_offset) {
+            fprintf(stderr, "%s:%d %s invalid box size %llu at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)box_size, (unsigned long long)box_offset);
+            return false;
+        }
 
-        if (isprint(p[i])) {
-            // A printable character
-            txt_buf[line_pos] = p[i];
+        const mp4_path_match_t match = mp4_path_match(depth, box_type, &path_matches);
+        if (match == MP4_PATH_SKIP) {
+            if (!mp4_stream_skip(s, box_size) && depth > 0) {
+                fprintf(stderr, "%s:%d %s truncated %s box at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (const char *)box_type, (unsigned long long)box_offset);
+                return false;
+            }
+            continue;
+        }
+        const bool path_matched = g_path.matched;
+        g_path.matched = path_matched || match == MP4_PATH_ALL;
+
+        mp4_stream_skip(s, header_size);
+
+        uint64_t data_size = box_size - header_size;
+        const mp4_box_func func = mp4_box_printer_get(box_type);
+        bool ok = true;
+        if (to_eof && func != mp4_box_container_print && func != mp4_box_mdat_print) {
+            // the printers take the whole box: read it all
+            while (!s->eof && s->len - s->pos < SIZE_MAX - MP4_STREAM_CHUNK) {
+                mp4_stream_fill(s, s->len - s->pos + MP4_STREAM_CHUNK);
+            }
+            data_size = s->len - s->pos;
+            box_size = data_size + header_size;
+        }
+        if (func == mp4_box_container_print || func == mp4_box_mdat_print) {
+            // the length of a box that runs to the end of a pipe is not known
+            mp4_header_print(depth, box_offset, " Length: ", to_eof ? 0 : box_size, (const char *)box_type);
+            mp4_field_str(depth + 1, "Description: ", get_box_desc(box_type));
+        }
+        if (func == mp4_box_container_print) {
+            if (depth == g_max_depth) {
+                fprintf(stderr, "%s:%d %s %s box at offset %llu: %s\n", __FILE__, __LINE__, __FUNCTION__, (const char *)box_type, (unsigned long long)box_offset, mp4_index_strerror(MP4_INDEX_ERR_DEPTH));
+                ok = false;
+            } else {
+                ok = mp4_stream_print(s, box_offset + box_size, depth + 1);
+            }
+        } else if (func == mp4_box_mdat_print) {
+            ok = mp4_stream_mdat_print(s, data_size, to_eof, depth + 1);
+            if (!ok) {
+                fprintf(stderr, "%s:%d %s truncated %s box at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (const char *)box_type, (unsigned long long)box_offset);
+            }
+        } else if (data_size > SIZE_MAX || mp4_stream_fill(s, data_size) < data_size) {
+            fprintf(stderr, "%s:%d %s truncated %s box at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (const char *)box_type, (unsigned long long)box_offset);
+            ok = false;
         } else {
-            // Replace non-printable characters with a dot.
-            txt_buf[line_pos] = '.';
+            // a whole box in the window: its children go through mp4_print()
+            const uint8_t *data = mp4_stream_window(s);
+            if (mp4_box_fields_print(depth, box_offset, box_size, box_type, data, data_size)) {
+                if (g_children.p < data || g_children.p > data + data_size || g_children.len > (size_t)(data + data_size - g_children.p)) {
+                    fprintf(stderr, "%s:%d %s %s box at offset %llu: %s\n", __FILE__, __LINE__, __FUNCTION__, (const char *)box_type, (unsigned long long)box_offset, mp4_index_strerror(MP4_INDEX_ERR_FORMAT));
+                    ok = false;
+                } else {
+                    ok = mp4_print(g_children.p, g_children.len, depth + 1);
+                }
+            }
+            mp4_stream_skip(s, data_size);
         }
+        mp4_box_end();
+        g_path.matched = path_matched;
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+mp4_stream_print_fd(int fd)
+{
+    struct stat sb;
+    mp4_stream_t stream = {.fd = fd, .seekable = lseek(fd, 0, SEEK_CUR) >= 0};
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        stream.size = sb.st_size;
+    }
+    bool ok = mp4_stream_print(&stream, UINT64_MAX, 0);
+    free(stream.buf);
+    g_content_buf = NULL;
+    g_content_offset = 0;
+    return ok;
+}
 
-        if (i % 16 == 0) {
-            printf("%s  %.4zx    ", indent(depth, 0), i);
+// --boxes: printers driven by the flat box index instead of a walk of the
+// whole file. The index only costs a read of each box header, then either
+// the headers are listed or each box of the requested type is read and
+// printed on its own.
+
+static bool
+pread_full(int fd, uint8_t *buf, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
         }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
 
-        if (line_pos == 15) {
-            printf("%s |%s|\n", hex_buf, txt_buf);
-            sprintf(hex_buf, "%s", empty_hex);
-            sprintf(txt_buf, "%s", empty_txt);
+static bool
+mp4_boxes_print_tree(int fd, const mp4_box_tree_t *tree, const char *type)
+{
+    const mp4_boxes_t *boxes = mp4_box_tree_boxes(tree);
+    if (!type) {
+        for (size_t i = 0; i < boxes->num; i++) {
+            const uint8_t box_type[5] = {boxes->type[i] >> 24, boxes->type[i] >> 16, boxes->type[i] >> 8, boxes->type[i], 0};
+            mp4_header_print(boxes->depth[i], boxes->offset[i], " Length: ", boxes->size[i], (const char *)box_type);
+            mp4_box_end();
         }
+        return true;
     }
 
-    if (line_pos != 15) {
-        printf("%s |%s|\n", hex_buf, txt_buf);
+    bool ok = true;
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    for (size_t i = mp4_box_tree_next(tree, 0, type); i < boxes->num; i = mp4_box_tree_next(tree, i + 1, type)) {
+        const uint64_t size = boxes->size[i];
+        if (size > cap) {
+            uint8_t *p = size <= SIZE_MAX ? realloc(buf, size) : NULL;
+            if (!p) {
+                fprintf(stderr, "%s:%d %s realloc(%llu) error: %s\n", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)size, strerror(errno));
+                ok = false;
+                break;
+            }
+            buf = p;
+            cap = size;
+        }
+        if (!pread_full(fd, buf, size, boxes->offset[i])) {
+            fprintf(stderr, "%s:%d %s pread error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+            ok = false;
+            break;
+        }
+        g_content_buf = buf;
+        g_content_offset = boxes->offset[i];
+        if (!mp4_print(buf, size, boxes->depth[i])) {
+            ok = false;
+            break;
+        }
     }
+    free(buf);
+    g_content_buf = NULL;
+    g_content_offset = 0;
+    return ok;
+}
 
-    if (truncated_len) {
-        printf("%s   ... %zu bytes truncated\n", indent(depth, 0), truncated_len);
+static bool
+mp4_boxes_print(const char *filename, const char *type, const char *index_path)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s:%d %s open(\"%s\", O_RDONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+        return false;
+    }
+    struct stat sb = {0};
+    mp4_box_tree_t *tree = mp4_box_tree_create();
+    if (!tree || fstat(fd, &sb) < 0) {
+        fprintf(stderr, "%s:%d %s error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        mp4_box_tree_destroy(tree);
+        close(fd);
+        return false;
+    }
+
+    int err = MP4_INDEX_ERR_STALE;
+    if (index_path) {
+        err = mp4_box_tree_load(tree, index_path, &sb);
+    }
+    if (err != MP4_INDEX_OK) {
+        err = mp4_box_tree_build_fd(tree, fd);
+        if (err == MP4_INDEX_OK && index_path) {
+            int save_err = mp4_box_tree_save(tree, index_path, &sb);
+            if (save_err != MP4_INDEX_OK) {
+                fprintf(stderr, "%s:%d %s mp4_box_tree_save(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, index_path, strerror(errno));
+            }
+        }
+    }
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_box_tree_build_fd(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, mp4_index_strerror(err));
+        mp4_box_tree_destroy(tree);
+        close(fd);
+        return false;
+    }
+
+    bool ok = mp4_boxes_print_tree(fd, tree, type);
+    mp4_box_tree_destroy(tree);
+    close(fd);
+    return ok;
+}
+
+// --summary: per-track aggregates of the sample tables. The top-level boxes
+// are read from the stream one by one; moov and moof are read whole and
+// added up, everything else, mdat above all, is skipped, with a seek when
+// the input allows it.
+
+static void
+mp4_track_summary_print(const mp4_track_summary_t *t)
+{
+    // the stts and trun durations, mdhd when there are none
+    const uint64_t delta = t->sample_delta ? t->sample_delta : t->duration;
+    const double seconds = t->time_scale ? (double)delta / t->time_scale : 0;
+    // every stsz sample is a sync sample without stss, and every audio
+    // sample is one whatever the fragment flags say: muxers often copy the
+    // video defaults into the audio trex
+    uint64_t sync_num = t->sync_num + (t->has_stss ? 0 : t->table_samples);
+    if (memcmp(t->handler, "soun", 4) == 0) {
+        sync_num = t->sample_num;
+    }
+
+    mp4_header_print(0, t->offset, " Length: ", t->size, "trak");
+    mp4_field_u(1, "Track ID:                    ", t->track_id);
+    mp4_field_strn(1, "Handler:                     ", t->handler, 4);
+    mp4_field_strn(1, "Codec:                       ", t->codec, 4);
+    mp4_field_u(1, "Time scale:                  ", t->time_scale);
+    mp4_field_f(1, "Duration (s):                ", seconds, 3);
+    mp4_field_u(1, "Samples:                     ", t->sample_num);
+    mp4_field_u(1, "Min sample size:             ", t->sample_num ? t->size_min : 0);
+    mp4_field_f(1, "Avg sample size:             ", t->sample_num ? (double)t->size_total / t->sample_num : 0, 1);
+    mp4_field_u(1, "Max sample size:             ", t->size_max);
+    mp4_field_u(1, "Keyframes:                   ", sync_num);
+    mp4_field_f(1, "Keyframe interval (samples): ", sync_num ? (double)t->sample_num / sync_num : 0, 1);
+    mp4_field_f(1, "Keyframe interval (s):       ", sync_num ? seconds / sync_num : 0, 3);
+    mp4_field_u(1, "Bitrate (bit/s):             ", seconds > 0 ? (uint64_t)(t->size_total * 8 / seconds + 0.5) : 0);
+    mp4_box_end();
+}
+
+static bool
+mp4_summary_print_fd(int fd)
+{
+    mp4_summary_t *summary = mp4_summary_create(g_max_depth);
+    if (!summary) {
+        fprintf(stderr, "%s:%d %s mp4_summary_create error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        return false;
+    }
+    mp4_stream_t stream = {.fd = fd, .seekable = lseek(fd, 0, SEEK_CUR) >= 0};
+    mp4_stream_t *s = &stream;
+    bool ok = true;
+    while (ok) {
+        size_t avail = mp4_stream_fill(s, 16);
+        if (avail == 0) {
+            break;
+        }
+        const uint64_t box_offset = mp4_stream_offset(s);
+        uint64_t box_size = get_u32(s->buf + s->pos);
+        const size_t header_size = box_size == 1 ? 16 : 8;
+        if (box_size == 1) {
+            box_size = get_u64(s->buf + s->pos + 8);
+        }
+        if (avail < header_size || (box_size != 0 && box_size < header_size)) {
+            fprintf(stderr, "%s:%d %s invalid box header at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)box_offset);
+            ok = false;
+            break;
+        }
+        char type[5] = {0};
+        memcpy(type, s->buf + s->pos + 4, 4);
+        if (strcmp(type, "moov") != 0 && strcmp(type, "moof") != 0) {
+            if (box_size == 0) {
+                // runs to the end of the input
+                break;
+            }
+            mp4_stream_skip(s, box_size);
+            continue;
+        }
+        if (box_size == 0 || box_size > SIZE_MAX || mp4_stream_fill(s, box_size) < box_size) {
+            fprintf(stderr, "%s:%d %s truncated %s box at offset %llu\n", __FILE__, __LINE__, __FUNCTION__, type, (unsigned long long)box_offset);
+            ok = false;
+            break;
+        }
+        int err = mp4_summary_add(summary, s->buf + s->pos, box_size, box_offset);
+        if (err != MP4_INDEX_OK) {
+            fprintf(stderr, "%s:%d %s %s box at offset %llu: %s\n", __FILE__, __LINE__, __FUNCTION__, type, (unsigned long long)box_offset, mp4_index_strerror(err));
+            ok = false;
+        }
+        mp4_stream_skip(s, box_size);
+    }
+
+    for (size_t i = 0; i < mp4_summary_track_num(summary); i++) {
+        mp4_track_summary_print(mp4_summary_track(summary, i));
+    }
+    mp4_summary_destroy(summary);
+    free(stream.buf);
+    return ok;
+}
+
+// --samples: the columns of mp4_samples_t, one table row per sample, or the
+// size of each column once packed by mp4samplepack
+static void
+mp4_track_samples_print(const mp4_track_t *track, bool packed)
+{
+    const mp4_samples_t *samples = &track->samples;
+    mp4_box_begin(0, 0, 0, "trak");
+    mp4_header_field_print(0, "--- Track ID: ", track->track_id, 0);
+    mp4_field_u(1, "Track ID:   ", track->track_id);
+    mp4_field_strn(1, "Handler:    ", track->handler, 4);
+    mp4_field_strn(1, "Codec:      ", track->codec, 4);
+    mp4_field_u(1, "Time scale: ", track->time_scale);
+    mp4_field_u(1, "Samples:    ", samples->num);
+    if (packed) {
+        static const char *const labels[MP4_SAMPLES_COLUMNS] = {
+            "Packed offset bytes:     ",
+            "Packed size bytes:       ",
+            "Packed DTS bytes:        ",
+            "Packed CTS offset bytes: ",
+            "Packed chunk bytes:      ",
+            "Packed sync bytes:       ",
+        };
+        mp4_samples_packed_t columns;
+        if (mp4_samples_pack(samples, &columns) != MP4_INDEX_OK) {
+            fprintf(stderr, "%s:%d %s mp4_samples_pack error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        } else {
+            size_t total = 0;
+            for (int i = 0; i < MP4_SAMPLES_COLUMNS; i++) {
+                mp4_field_u(1, labels[i], columns.len[i]);
+                total += columns.len[i];
+            }
+            mp4_field_u(1, "Packed bytes:            ", total);
+            mp4_field_u(1, "Unpacked bytes:          ", samples->num * (8 + 4 + 8 + 4 + 4 + 1));
+        }
+        mp4_samples_packed_free(&columns);
+        mp4_box_end();
+        return;
+    }
+
+    mp4_field_table_begin(1, "Sample table", "DTS | CTS | Size | Offset | Sync | Chunk", 6);
+    for (size_t i = 0; i < samples->num; i++) {
+        // the table is unsigned: a composition time before 0, from a
+        // negative ctts offset, shows as 0
+        const int64_t cts = (int64_t)samples->dts[i] + samples->cts_offset[i];
+        const uint64_t row[6] = {samples->dts[i], cts > 0 ? cts : 0, samples->size[i], samples->offset[i], samples->sync[i], samples->chunk[i]};
+        mp4_field_table_row(row);
+    }
+    mp4_field_table_end();
+    mp4_box_end();
+}
+
+static bool
+mp4_samples_print_fd(int fd, bool packed)
+{
+    mp4_index_t *index = mp4_index_create();
+    if (!index) {
+        fprintf(stderr, "%s:%d %s mp4_index_create error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        return false;
+    }
+    mp4_index_set_max_depth(index, g_max_depth);
+    mp4_index_set_samples(index, true);
+    int err = mp4_index_build_fd(fd, index);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_index_build_fd error: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        mp4_index_destroy(index);
+        return false;
+    }
+    for (size_t i = 0; i < mp4_index_track_num(index); i++) {
+        mp4_track_samples_print(mp4_index_track(index, i), packed);
+    }
+    mp4_index_destroy(index);
+    return true;
+}
+
+// The mdat NAL units are found from the sample tables instead of a walk from
+// the start of mdat: each video sample is handed to the printer of its
+// track's codec with the length field size of its avcC or hvcC, and the
+// bytes of other tracks are never looked at. With --jobs the samples inside
+// an mdat are cut into one run per job, each run is printed by its own
+// thread into a capture buffer, and the captures are appended in file order.
+
+// Sample entry types whose samples are length-prefixed NAL units
+static const struct {
+    const char *codec;
+    mp4_nals_func print;
+} g_nal_codecs[] = {
+    {"avc1", mp4_mdat_h264_print},
+    {"avc2", mp4_mdat_h264_print},
+    {"avc3", mp4_mdat_h264_print},
+    {"avc4", mp4_mdat_h264_print},
+    {"hev1", mp4_mdat_hevc_print},
+    {"hvc1", mp4_mdat_hevc_print},
+};
+
+static int
+mp4_sample_loc_cmp(const void *a, const void *b)
+{
+    const uint64_t x = ((const mp4_sample_loc_t *)a)->offset;
+    const uint64_t y = ((const mp4_sample_loc_t *)b)->offset;
+    return x < y ? -1 : x > y;
+}
+
+// Build the sample tables from the moov and moof boxes of the whole file in
+// buf
+static int
+mp4_samples_index(mp4_index_t *index, const uint8_t *buf, size_t len)
+{
+    bool has_moov = false;
+    for (const uint8_t *p = buf; buf + len - p >= 8;) {
+        uint64_t box_size = get_u32(p);
+        if (box_size == 1 && buf + len - p >= 16) {
+            box_size = get_u64(p + 8);
+        } else if (box_size == 0) {
+            box_size = buf + len - p;
+        }
+        if (box_size < 8 || box_size > (uint64_t)(buf + len - p)) {
+            break;
+        }
+        int err = MP4_INDEX_OK;
+        if (memcmp(p + 4, "moov", 4) == 0 && !has_moov) {
+            err = mp4_index_build(p, box_size, index);
+            mp4_index_set_file_size(index, len);
+            has_moov = true;
+        } else if (memcmp(p + 4, "moof", 4) == 0 && has_moov) {
+            err = mp4_index_add_fragment(index, p, box_size, p - buf);
+        }
+        if (err != MP4_INDEX_OK) {
+            return err;
+        }
+        p += box_size;
+    }
+    return has_moov ? MP4_INDEX_OK : MP4_INDEX_ERR_NO_MOOV;
+}
+
+static bool
+mp4_samples_load(const uint8_t *buf, size_t len)
+{
+    mp4_index_t *index = mp4_index_create();
+    if (!index) {
+        fprintf(stderr, "%s:%d %s mp4_index_create error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        return false;
+    }
+    mp4_index_set_max_depth(index, g_max_depth);
+    mp4_index_set_samples(index, true);
+    int err = mp4_samples_index(index, buf, len);
+    if (err != MP4_INDEX_OK) {
+        // files without usable tables are walked the old way
+        if (g_samples.jobs > 1) {
+            fprintf(stderr, "%s:%d %s no sample tables, --jobs ignored: %s\n", __FILE__, __LINE__, __FUNCTION__, mp4_index_strerror(err));
+        }
+        mp4_index_destroy(index);
+        return false;
+    }
+
+    // the video tracks with a NAL unit codec, as their codec index
+    int codecs[mp4_index_track_num(index) + 1];
+    size_t num = 0;
+    for (size_t i = 0; i < mp4_index_track_num(index); i++) {
+        const mp4_track_t *track = mp4_index_track(index, i);
+        codecs[i] = -1;
+        if (strcmp(track->handler, "vide") != 0 || track->nal_length_size == 0) {
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(g_nal_codecs) / sizeof(g_nal_codecs[0]); j++) {
+            if (strcmp(track->codec, g_nal_codecs[j].codec) == 0) {
+                codecs[i] = j;
+                num += track->samples.num;
+                break;
+            }
+        }
+    }
+    g_samples.samples = malloc((num ? num : 1) * sizeof(*g_samples.samples));
+    if (!g_samples.samples) {
+        fprintf(stderr, "%s:%d %s malloc error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        mp4_index_destroy(index);
+        return false;
+    }
+    g_samples.num = 0;
+    for (size_t i = 0; i < mp4_index_track_num(index); i++) {
+        const mp4_track_t *track = mp4_index_track(index, i);
+        if (codecs[i] < 0) {
+            continue;
+        }
+        for (size_t j = 0; j < track->samples.num; j++) {
+            mp4_sample_loc_t *sample = &g_samples.samples[g_samples.num++];
+            sample->offset = track->samples.offset[j];
+            sample->size = track->samples.size[j];
+            sample->codec = codecs[i];
+            sample->length_size = track->nal_length_size;
+        }
+    }
+    mp4_index_destroy(index);
+    qsort(g_samples.samples, g_samples.num, sizeof(*g_samples.samples), mp4_sample_loc_cmp);
+    return true;
+}
+
+typedef struct {
+    const mp4_sample_loc_t *samples;
+    size_t num;
+    uint64_t end;  // file offset of the end of mdat
+    int depth;
+    mp4_output_format_t format;
+    char *out;
+    size_t out_len;
+} mp4_mdat_job_t;
+
+static void
+mp4_mdat_job_print(const mp4_mdat_job_t *job)
+{
+    for (size_t i = 0; i < job->num; i++) {
+        const mp4_sample_loc_t *sample = &job->samples[i];
+        const uint64_t len = sample->size < job->end - sample->offset ? sample->size : job->end - sample->offset;
+        g_nal_codecs[sample->codec].print(g_content_buf + (sample->offset - g_content_offset), len, sample->length_size, job->depth);
+    }
+}
+
+static void *
+mp4_mdat_job_run(void *arg)
+{
+    mp4_mdat_job_t *job = arg;
+    mp4_output_capture_begin(job->format);
+    mp4_mdat_job_print(job);
+    job->out = mp4_output_capture_end(&job->out_len);
+    return NULL;
+}
+
+// false when there are no sample tables and mdat has to be walked from its
+// start
+static bool
+mp4_mdat_samples_print(const uint8_t *p, size_t len, int depth)
+{
+    // loaded at the first mdat, so the runs that print no mdat never build
+    // the tables
+    if (!g_samples.loaded) {
+        g_samples.loaded = true;
+        g_samples.found = g_samples.file_len && mp4_samples_load(g_content_buf, g_samples.file_len);
+    }
+    if (!g_samples.found) {
+        return false;
+    }
+
+    // the samples that start inside this mdat
+    const uint64_t begin = mp4_offset(p);
+    const uint64_t end = begin + len;
+    const mp4_sample_loc_t key = {.offset = begin};
+    size_t first = 0;
+    size_t hi = g_samples.num;
+    while (first < hi) {
+        const size_t mid = first + (hi - first) / 2;
+        if (mp4_sample_loc_cmp(&g_samples.samples[mid], &key) < 0) {
+            first = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t last = first;
+    while (last < g_samples.num && g_samples.samples[last].offset < end) {
+        last++;
+    }
+    const size_t num = last - first;
+
+    // a thread per few samples costs more than it saves, e.g. on the small
+    // mdat of each fragment
+    size_t jobs_num = g_samples.jobs;
+    if (jobs_num > num / MP4_JOB_SAMPLES_MIN) {
+        jobs_num = num / MP4_JOB_SAMPLES_MIN;
+    }
+    if (jobs_num <= 1) {
+        const mp4_mdat_job_t job = {g_samples.samples + first, num, end, depth};
+        mp4_mdat_job_print(&job);
+        return true;
+    }
+
+    mp4_mdat_job_t jobs[MP4_JOBS_MAX];
+    pthread_t threads[MP4_JOBS_MAX];
+    bool started[MP4_JOBS_MAX];
+    for (size_t i = 0; i < jobs_num; i++) {
+        const size_t from = first + num * i / jobs_num;
+        const size_t to = first + num * (i + 1) / jobs_num;
+        jobs[i] = (mp4_mdat_job_t){g_samples.samples + from, to - from, end, depth, mp4_output_format(), NULL, 0};
+        started[i] = pthread_create(&threads[i], NULL, mp4_mdat_job_run, &jobs[i]) == 0;
+    }
+    // a job without a thread is printed here, in its turn
+    for (size_t i = 0; i < jobs_num; i++) {
+        if (!started[i]) {
+            mp4_mdat_job_print(&jobs[i]);
+            continue;
+        }
+        pthread_join(threads[i], NULL);
+        mp4_output_append(jobs[i].out, jobs[i].out_len);
+        free(jobs[i].out);
     }
+    return true;
 }
@@ -0,0 +1,212 @@
+#include "mp4index.h"
+#include "mp4sampleio.h"
+#include "mp4walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--track video|audio|<handler>|--track-id <id>] [--sample N|--sample-at <seconds>|--keyframe-at <seconds>] [--count N] [--output <file>] <filename>\n", prog);
+    fprintf(stderr, "Write the raw bytes of samples of one track, read straight from the file.\n");
+    fprintf(stderr, "  --track T           use the first track with handler T (default: video)\n");
+    fprintf(stderr, "  --track-id N        use the track with tkhd track ID N\n");
+    fprintf(stderr, "  --sample N          start at sample N, 1-based (default: 1)\n");
+    fprintf(stderr, "  --sample-at T       start at the sample being decoded at T seconds\n");
+    fprintf(stderr, "  --keyframe-at T     start at the keyframe shown at or before T seconds\n");
+    fprintf(stderr, "  --count N           write N samples in decode order (default: 1)\n");
+    fprintf(stderr, "  --output FILE       write to FILE instead of stdout\n");
+    fprintf(stderr, "  --max-depth N       reject files with boxes nested deeper than N levels (default %d)\n", MP4_WALK_MAX_DEPTH);
+}
+
+static double
+parse_time(const char *arg)
+{
+    char *end = NULL;
+    double time = strtod(arg, &end);
+    if (end == arg || *end != '\0' || time < 0) {
+        fprintf(stderr, "%s:%d %s invalid time: %s\n", __FILE__, __LINE__, __FUNCTION__, arg);
+        exit(EXIT_FAILURE);
+    }
+    return time;
+}
+
+static long
+parse_number(const char *arg, const char *what, long min, long max)
+{
+    char *end = NULL;
+    long value = strtol(arg, &end, 0);
+    if (end == arg || *end != '\0' || value < min || value > max) {
+        fprintf(stderr, "%s:%d %s invalid %s: %s\n", __FILE__, __LINE__, __FUNCTION__, what, arg);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+// The first sample to write, 0 when there is none
+static uint32_t
+first_sample(const mp4_track_t *track, long sample, double sample_time, double keyframe_time)
+{
+    if (sample_time >= 0) {
+        return mp4_track_sample_at(track, (uint64_t)(sample_time * track->time_scale));
+    }
+    if (keyframe_time >= 0) {
+        // keyframes taken from an mfra box have no sample number (0)
+        long i = mp4_keyframes_seek(&track->keyframes, keyframe_time);
+        return i < 0 ? 0 : track->keyframes.sample[i];
+    }
+    return sample;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"track", required_argument, NULL, 't'},
+        {"track-id", required_argument, NULL, 'i'},
+        {"sample", required_argument, NULL, 'n'},
+        {"sample-at", required_argument, NULL, 'a'},
+        {"keyframe-at", required_argument, NULL, 'k'},
+        {"count", required_argument, NULL, 'c'},
+        {"output", required_argument, NULL, 'o'},
+        {"max-depth", required_argument, NULL, 'd'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    const char *handler = NULL;
+    long track_id = -1;
+    long sample = -1;
+    double sample_time = -1;
+    double keyframe_time = -1;
+    long count = 1;
+    const char *output = NULL;
+    long max_depth = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:i:n:a:k:c:o:d:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            if (strcmp(optarg, "video") == 0) {
+                handler = "vide";
+            } else if (strcmp(optarg, "audio") == 0) {
+                handler = "soun";
+            } else if (strlen(optarg) == 4) {
+                handler = optarg;
+            } else {
+                fprintf(stderr, "%s:%d %s invalid track: %s\n", __FILE__, __LINE__, __FUNCTION__, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i':
+            track_id = parse_number(optarg, "track ID", 0, UINT32_MAX);
+            break;
+        case 'n':
+            sample = parse_number(optarg, "sample", 1, UINT32_MAX);
+            break;
+        case 'a':
+            sample_time = parse_time(optarg);
+            break;
+        case 'k':
+            keyframe_time = parse_time(optarg);
+            break;
+        case 'c':
+            count = parse_number(optarg, "count", 1, UINT32_MAX);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'd':
+            max_depth = parse_number(optarg, "max depth", 1, 1024);
+            break;
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc || (sample >= 0) + (sample_time >= 0) + (keyframe_time >= 0) > 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (sample < 0) {
+        sample = 1;
+    }
+
+    const char *filename = argv[optind];
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s:%d %s open(\"%s\", O_RDONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    mp4_index_t *index = mp4_index_create();
+    if (!index) {
+        fprintf(stderr, "%s:%d %s mp4_index_create error: %s\n", __FILE__, __LINE__, __FUNCTION__, strerror(errno));
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    mp4_index_set_max_depth(index, max_depth);
+    // the sample columns are what covers the samples of movie fragments
+    mp4_index_set_samples(index, true);
+
+    // only the moov and moof boxes are read, the samples are read on their own
+    int err = mp4_index_build_fd(fd, index);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_index_build_fd(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, mp4_index_strerror(err));
+        mp4_index_destroy(index);
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    const mp4_track_t *track = NULL;
+    if (track_id >= 0) {
+        track = mp4_index_track_by_id(index, track_id);
+    } else if (handler) {
+        track = mp4_index_track_by_handler(index, handler);
+    } else {
+        track = mp4_index_default_track(index);
+    }
+    if (!track) {
+        fprintf(stderr, "%s:%d %s no such track in \"%s\"\n", __FILE__, __LINE__, __FUNCTION__, filename);
+        mp4_index_destroy(index);
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    const uint32_t first = first_sample(track, sample, sample_time, keyframe_time);
+    const uint64_t last = (uint64_t)first + count;
+    mp4_sample_t last_sample;
+    if (first == 0 || last - 1 > UINT32_MAX || !mp4_track_sample(track, last - 1, &last_sample)) {
+        fprintf(stderr, "%s:%d %s no such samples in track %u of \"%s\"\n", __FILE__, __LINE__, __FUNCTION__, track->track_id, filename);
+        mp4_index_destroy(index);
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    int out_fd = STDOUT_FILENO;
+    if (output) {
+        out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0) {
+            fprintf(stderr, "%s:%d %s open(\"%s\", O_WRONLY) error: %s\n", __FILE__, __LINE__, __FUNCTION__, output, strerror(errno));
+            mp4_index_destroy(index);
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    err = mp4_samples_send(out_fd, fd, track, first, last);
+    if (err != MP4_INDEX_OK) {
+        fprintf(stderr, "%s:%d %s mp4_samples_send(\"%s\") error: %s\n", __FILE__, __LINE__, __FUNCTION__, filename, mp4_index_strerror(err));
+    }
+    if (output) {
+        close(out_fd);
+    }
+    mp4_index_destroy(index);
+    close(fd);
+    return err == MP4_INDEX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include "mp4sampleio.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Bytes a pread()/write() round moves when the file has to be copied
+#define MP4_SAMPLEIO_BUF_SIZE (256 * 1024)
+
+// How a range gets from fd to out_fd, each falling back to the next
+enum {
+    MP4_SEND_COPY_FILE_RANGE,
+    MP4_SEND_SENDFILE,
+    MP4_SEND_READ_WRITE,
+};
+
+int
+mp4_sample_read(int fd, const mp4_sample_t *sample, uint8_t *buf)
+{
+    size_t len = sample->size;
+    uint64_t offset = sample->offset;
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return MP4_INDEX_ERR_IO;
+        }
+        if (n == 0) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_write_full(int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return MP4_INDEX_ERR_IO;
+        }
+        buf += n;
+        len -= n;
+    }
+    return MP4_INDEX_OK;
+}
+
+// Copy len bytes at offset of fd through buf, the last resort
+static int
+mp4_range_copy(int out_fd, int fd, uint64_t offset, uint64_t len)
+{
+    uint8_t *buf = malloc(MP4_SAMPLEIO_BUF_SIZE);
+    if (!buf) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    int err = MP4_INDEX_OK;
+    while (len > 0 && err == MP4_INDEX_OK) {
+        mp4_sample_t chunk = {.offset = offset, .size = len < MP4_SAMPLEIO_BUF_SIZE ? len : MP4_SAMPLEIO_BUF_SIZE};
+        err = mp4_sample_read(fd, &chunk, buf);
+        if (err == MP4_INDEX_OK) {
+            err = mp4_write_full(out_fd, buf, chunk.size);
+        }
+        offset += chunk.size;
+        len -= chunk.size;
+    }
+    free(buf);
+    return err;
+}
+
+// Whether errno says the call cannot move data between these two fds (or on
+// this kernel) at all, rather than that the I/O failed
+static bool
+mp4_send_unsupported(void)
+{
+    return errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP || errno == EBADF;
+}
+
+// Send len bytes at offset of fd to out_fd with the method in *how, moving
+// *how on to the next method when this one does not apply to the fds
+static int
+mp4_range_send(int out_fd, int fd, uint64_t offset, uint64_t len, int *how)
+{
+    while (len > 0 && *how != MP4_SEND_READ_WRITE) {
+        // both calls move at most about 2GB at a time
+        const size_t count = len < 0x40000000 ? len : 0x40000000;
+        off_t off = offset;
+        ssize_t n;
+        if (*how == MP4_SEND_COPY_FILE_RANGE) {
+            n = copy_file_range(fd, &off, out_fd, NULL, count, 0);
+        } else {
+            n = sendfile(out_fd, fd, &off, count);
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && mp4_send_unsupported()) {
+            (*how)++;
+            continue;
+        }
+        if (n < 0) {
+            return MP4_INDEX_ERR_IO;
+        }
+        if (n == 0) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        offset += n;
+        len -= n;
+    }
+    return len > 0 ? mp4_range_copy(out_fd, fd, offset, len) : MP4_INDEX_OK;
+}
+
+int
+mp4_samples_send(int out_fd, int fd, const mp4_track_t *track, uint32_t first, uint32_t last)
+{
+    int how = MP4_SEND_COPY_FILE_RANGE;
+    uint64_t offset = 0;
+    uint64_t len = 0;
+    for (uint32_t i = first; i < last; i++) {
+        mp4_sample_t sample;
+        if (!mp4_track_sample(track, i, &sample)) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        if (len > 0 && sample.offset == offset + len) {
+            len += sample.size;
+            continue;
+        }
+        int err = mp4_range_send(out_fd, fd, offset, len, &how);
+        if (err != MP4_INDEX_OK) {
+            return err;
+        }
+        offset = sample.offset;
+        len = sample.size;
+    }
+    return mp4_range_send(out_fd, fd, offset, len, &how);
+}
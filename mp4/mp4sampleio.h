@@ -0,0 +1,28 @@
+#ifndef _MP4_SAMPLEIO_H_2018
+#define _MP4_SAMPLEIO_H_2018
+
+#include "mp4index.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reading samples straight from the file by their index entry, for callers
+// that only need a few of them (e.g. keyframes for thumbnails) and should not
+// load the file. The file offset of fd is never used or moved, so one fd can
+// be shared by threads. Build the index with mp4_index_build_fd(), which
+// reads only the moov (and moof) boxes.
+
+// pread() exactly the bytes of sample into buf, which holds sample->size
+// bytes. MP4_INDEX_ERR_IO on a read error, MP4_INDEX_ERR_FORMAT when the file
+// ends inside the sample.
+int mp4_sample_read(int fd, const mp4_sample_t *sample, uint8_t *buf);
+
+// Write samples first to last - 1 of track, in decode order, to out_fd at its
+// current position. Samples back to back in the file go out as one range, by
+// copy_file_range() or sendfile() so the data does not pass through user
+// space, and by pread()/write() where neither works for the two fds. Errors
+// as for mp4_sample_read(), and MP4_INDEX_ERR_FORMAT for a range past the
+// samples of track.
+int mp4_samples_send(int out_fd, int fd, const mp4_track_t *track, uint32_t first, uint32_t last);
+
+#endif  //_MP4_SAMPLEIO_H_2018
@@ -0,0 +1,180 @@
+#include "mp4samplepack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes of the longest LEB128 varint, a 64-bit value
+#define MP4_VARINT_MAX 10
+
+static uint64_t
+mp4_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t
+mp4_unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint8_t *
+mp4_varint_put(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// NULL when the varint runs past end or past 64 bits
+static const uint8_t *
+mp4_varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = value;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int64_t
+mp4_sample_value(const mp4_samples_t *samples, int column, size_t i)
+{
+    switch (column) {
+    case MP4_SAMPLES_OFFSET:
+        return samples->offset[i];
+    case MP4_SAMPLES_SIZE:
+        return samples->size[i];
+    case MP4_SAMPLES_DTS:
+        return samples->dts[i];
+    case MP4_SAMPLES_CTS_OFFSET:
+        return samples->cts_offset[i];
+    case MP4_SAMPLES_CHUNK:
+        return samples->chunk[i];
+    default:
+        return samples->sync[i];
+    }
+}
+
+// What sample i of column is packed as the difference to
+static int64_t
+mp4_sample_prediction(const mp4_samples_t *samples, int column, size_t i)
+{
+    if (i == 0) {
+        return 0;
+    }
+    if (column == MP4_SAMPLES_OFFSET) {
+        return samples->offset[i - 1] + samples->size[i - 1];
+    }
+    if (column == MP4_SAMPLES_DTS && i >= 2) {
+        return 2 * samples->dts[i - 1] - samples->dts[i - 2];
+    }
+    return mp4_sample_value(samples, column, i - 1);
+}
+
+int
+mp4_samples_pack(const mp4_samples_t *samples, mp4_samples_packed_t *packed)
+{
+    memset(packed, 0, sizeof(*packed));
+    packed->num = samples->num;
+    for (int column = 0; column < MP4_SAMPLES_COLUMNS; column++) {
+        uint8_t *data = malloc(samples->num * MP4_VARINT_MAX + 1);
+        if (!data) {
+            return MP4_INDEX_ERR_NOMEM;
+        }
+        uint8_t *p = data;
+        for (size_t i = 0; i < samples->num; i++) {
+            const int64_t delta = mp4_sample_value(samples, column, i) - mp4_sample_prediction(samples, column, i);
+            p = mp4_varint_put(p, mp4_zigzag(delta));
+        }
+        packed->len[column] = p - data;
+        // most columns shrink to a byte or two a sample
+        uint8_t *shrunk = realloc(data, packed->len[column] + 1);
+        packed->data[column] = shrunk ? shrunk : data;
+    }
+    return MP4_INDEX_OK;
+}
+
+void
+mp4_samples_packed_free(mp4_samples_packed_t *packed)
+{
+    for (int column = 0; column < MP4_SAMPLES_COLUMNS; column++) {
+        free(packed->data[column]);
+        packed->data[column] = NULL;
+        packed->len[column] = 0;
+    }
+    packed->num = 0;
+}
+
+// The zigzag deltas of one column, still to be added to their predictions
+static int
+mp4_column_unpack(const mp4_samples_packed_t *packed, int column, int64_t *values)
+{
+    const uint8_t *p = packed->data[column];
+    const uint8_t *end = p + packed->len[column];
+    for (size_t i = 0; i < packed->num; i++) {
+        uint64_t v = 0;
+        p = mp4_varint_get(p, end, &v);
+        if (!p) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        values[i] = mp4_unzigzag(v);
+    }
+    return p == end ? MP4_INDEX_OK : MP4_INDEX_ERR_FORMAT;
+}
+
+int
+mp4_samples_unpack(const mp4_samples_packed_t *packed, uint64_t *offset, uint32_t *size, uint64_t *dts, int32_t *cts_offset,
+    uint32_t *chunk, uint8_t *sync)
+{
+    int64_t *values = malloc((packed->num ? packed->num : 1) * sizeof(*values));
+    if (!values) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+
+    // size first: the offsets are predicted from the end of the previous sample
+    int err = mp4_column_unpack(packed, MP4_SAMPLES_SIZE, values);
+    for (size_t i = 0; err == MP4_INDEX_OK && i < packed->num; i++) {
+        size[i] = (i ? size[i - 1] : 0) + values[i];
+    }
+    if (err == MP4_INDEX_OK) {
+        err = mp4_column_unpack(packed, MP4_SAMPLES_OFFSET, values);
+    }
+    for (size_t i = 0; err == MP4_INDEX_OK && i < packed->num; i++) {
+        offset[i] = (i ? offset[i - 1] + size[i - 1] : 0) + values[i];
+    }
+    if (err == MP4_INDEX_OK) {
+        err = mp4_column_unpack(packed, MP4_SAMPLES_DTS, values);
+    }
+    for (size_t i = 0; err == MP4_INDEX_OK && i < packed->num; i++) {
+        dts[i] = (i >= 2 ? 2 * dts[i - 1] - dts[i - 2] : i ? dts[i - 1] : 0) + values[i];
+    }
+    if (err == MP4_INDEX_OK) {
+        err = mp4_column_unpack(packed, MP4_SAMPLES_CTS_OFFSET, values);
+    }
+    for (size_t i = 0; err == MP4_INDEX_OK && i < packed->num; i++) {
+        cts_offset[i] = (i ? cts_offset[i - 1] : 0) + values[i];
+    }
+    if (err == MP4_INDEX_OK) {
+        err = mp4_column_unpack(packed, MP4_SAMPLES_CHUNK, values);
+    }
+    for (size_t i = 0; err == MP4_INDEX_OK && i < packed->num; i++) {
+        chunk[i] = (i ? chunk[i - 1] : 0) + values[i];
+    }
+    if (err == MP4_INDEX_OK) {
+        err = mp4_column_unpack(packed, MP4_SAMPLES_SYNC, values);
+    }
+    for (size_t i = 0; err == MP4_INDEX_OK && i < packed->num; i++) {
+        sync[i] = (i ? sync[i - 1] : 0) + values[i];
+    }
+    free(values);
+    return err;
+}
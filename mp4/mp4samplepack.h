@@ -0,0 +1,42 @@
+#ifndef _MP4_SAMPLEPACK_H_2018
+#define _MP4_SAMPLEPACK_H_2018
+
+#include "mp4index.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Delta + varint packing of the mp4_samples_t columns, for keeping the
+// sample index of long files around. Each column is packed on its own as
+// LEB128 varints of the zigzag difference to a prediction: the end of the
+// previous sample for offset, so samples back to back in a chunk take one
+// byte, the previous decode time plus the previous duration for dts, and
+// the previous value for the other columns, so a constant duration or
+// sample size takes one byte too.
+
+enum {
+    MP4_SAMPLES_OFFSET,
+    MP4_SAMPLES_SIZE,
+    MP4_SAMPLES_DTS,
+    MP4_SAMPLES_CTS_OFFSET,
+    MP4_SAMPLES_CHUNK,
+    MP4_SAMPLES_SYNC,
+    MP4_SAMPLES_COLUMNS,
+};
+
+typedef struct {
+    size_t num;                          // samples
+    size_t len[MP4_SAMPLES_COLUMNS];     // bytes of each column
+    uint8_t *data[MP4_SAMPLES_COLUMNS];  // malloc'ed columns
+} mp4_samples_packed_t;
+
+// MP4_INDEX_OK or MP4_INDEX_ERR_NOMEM; free packed with
+// mp4_samples_packed_free() either way
+int mp4_samples_pack(const mp4_samples_t *samples, mp4_samples_packed_t *packed);
+void mp4_samples_packed_free(mp4_samples_packed_t *packed);
+// Unpack into arrays of packed->num entries each; MP4_INDEX_ERR_FORMAT when a
+// column is truncated or corrupt
+int mp4_samples_unpack(const mp4_samples_packed_t *packed, uint64_t *offset, uint32_t *size, uint64_t *dts, int32_t *cts_offset,
+    uint32_t *chunk, uint8_t *sync);
+
+#endif  //_MP4_SAMPLEPACK_H_2018
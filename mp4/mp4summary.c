@@ -0,0 +1,477 @@
+#include "mp4summary.h"
+#include "mp4be.h"
+#include "mp4bytes.h"
+#include "mp4index.h"
+#include "mp4walk.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MP4_TFHD_BASE_DATA_OFFSET 0x000001
+#define MP4_TFHD_SAMPLE_DESCRIPTION_INDEX 0x000002
+#define MP4_TFHD_DEFAULT_SAMPLE_DURATION 0x000008
+#define MP4_TFHD_DEFAULT_SAMPLE_SIZE 0x000010
+#define MP4_TFHD_DEFAULT_SAMPLE_FLAGS 0x000020
+
+#define MP4_TRUN_DATA_OFFSET 0x000001
+#define MP4_TRUN_FIRST_SAMPLE_FLAGS 0x000004
+#define MP4_TRUN_SAMPLE_DURATION 0x000100
+#define MP4_TRUN_SAMPLE_SIZE 0x000200
+#define MP4_TRUN_SAMPLE_FLAGS 0x000400
+#define MP4_TRUN_SAMPLE_COMPOSITION_TIME_OFFSET 0x000800
+
+#define MP4_SAMPLE_IS_NON_SYNC 0x00010000
+
+// Table entries decoded at a time before they are added up
+#define MP4_TABLE_BLOCK 1024
+
+typedef struct {
+    mp4_track_summary_t summary;
+    // trex defaults of the track's fragments
+    uint32_t trex_sample_duration;
+    uint32_t trex_sample_size;
+    uint32_t trex_sample_flags;
+} mp4_summary_track_t;
+
+struct mp4_summary {
+    mp4_summary_track_t *tracks;
+    size_t num;
+    size_t cap;
+    int max_depth;
+
+    // box being added
+    const uint8_t *buf;
+    uint64_t offset;
+    // trak or traf being walked, -1 outside
+    ptrdiff_t cur;
+    // defaults of the traf being walked
+    uint32_t traf_sample_duration;
+    uint32_t traf_sample_size;
+    uint32_t traf_sample_flags;
+};
+
+mp4_summary_t *
+mp4_summary_create(int max_depth)
+{
+    mp4_summary_t *summary = calloc(1, sizeof(*summary));
+    if (summary) {
+        summary->max_depth = max_depth;
+        summary->cur = -1;
+    }
+    return summary;
+}
+
+void
+mp4_summary_destroy(mp4_summary_t *summary)
+{
+    if (summary) {
+        free(summary->tracks);
+        free(summary);
+    }
+}
+
+size_t
+mp4_summary_track_num(const mp4_summary_t *summary)
+{
+    return summary->num;
+}
+
+const mp4_track_summary_t *
+mp4_summary_track(const mp4_summary_t *summary, size_t i)
+{
+    return &summary->tracks[i].summary;
+}
+
+static mp4_summary_track_t *
+mp4_summary_track_new(mp4_summary_t *summary)
+{
+    if (summary->num == summary->cap) {
+        size_t cap = summary->cap ? summary->cap * 2 : 4;
+        mp4_summary_track_t *tracks = realloc(summary->tracks, cap * sizeof(*tracks));
+        if (!tracks) {
+            return NULL;
+        }
+        summary->tracks = tracks;
+        summary->cap = cap;
+    }
+    mp4_summary_track_t *track = &summary->tracks[summary->num++];
+    memset(track, 0, sizeof(*track));
+    track->summary.size_min = UINT64_MAX;
+    return track;
+}
+
+// The track with the given ID, added when a trex or tfhd names a track no
+// trak declared
+static ptrdiff_t
+mp4_summary_track_by_id(mp4_summary_t *summary, uint32_t track_id)
+{
+    for (size_t i = 0; i < summary->num; i++) {
+        if (summary->tracks[i].summary.track_id == track_id) {
+            return i;
+        }
+    }
+    mp4_summary_track_t *track = mp4_summary_track_new(summary);
+    if (!track) {
+        return -1;
+    }
+    track->summary.track_id = track_id;
+    return summary->num - 1;
+}
+
+static bool
+mp4_table_fits(size_t len, size_t offset, uint32_t num, size_t esize)
+{
+    return len >= offset && (len - offset) / esize >= num;
+}
+
+static void
+mp4_summary_sizes_add(mp4_track_summary_t *t, uint64_t num, uint64_t min, uint64_t max, uint64_t total)
+{
+    if (num == 0) {
+        return;
+    }
+    t->sample_num += num;
+    t->size_total += total;
+    if (min < t->size_min) {
+        t->size_min = min;
+    }
+    if (max > t->size_max) {
+        t->size_max = max;
+    }
+}
+
+static int
+mp4_summary_stts(mp4_track_summary_t *t, const uint8_t *p, size_t len)
+{
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint32_t num = get_u32(p + 4);
+    if (!mp4_table_fits(len, 8, num, 8)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    // count/duration pairs
+    uint32_t block[MP4_TABLE_BLOCK];
+    uint64_t delta = 0;
+    for (uint32_t i = 0; i < num; i += MP4_TABLE_BLOCK / 2) {
+        const uint32_t n = num - i < MP4_TABLE_BLOCK / 2 ? num - i : MP4_TABLE_BLOCK / 2;
+        mp4_be32_decode(block, p + 8 + (size_t)i * 8, (size_t)n * 2);
+        for (uint32_t j = 0; j < n; j++) {
+            delta += (uint64_t)block[2 * j] * block[2 * j + 1];
+        }
+    }
+    t->sample_delta += delta;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_summary_stsz(mp4_track_summary_t *t, const uint8_t *p, size_t len)
+{
+    if (len < 12) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint32_t sample_size = get_u32(p + 4);
+    const uint32_t num = get_u32(p + 8);
+    t->table_samples += num;
+    if (sample_size != 0) {
+        mp4_summary_sizes_add(t, num, sample_size, sample_size, (uint64_t)sample_size * num);
+        return MP4_INDEX_OK;
+    }
+    if (!mp4_table_fits(len, 12, num, 4)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    uint32_t block[MP4_TABLE_BLOCK];
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < num; i += MP4_TABLE_BLOCK) {
+        const uint32_t n = num - i < MP4_TABLE_BLOCK ? num - i : MP4_TABLE_BLOCK;
+        mp4_be32_decode(block, p + 12 + (size_t)i * 4, n);
+        for (uint32_t j = 0; j < n; j++) {
+            const uint32_t size = block[j];
+            min = size < min ? size : min;
+            max = size > max ? size : max;
+            total += size;
+        }
+    }
+    mp4_summary_sizes_add(t, num, min, max, total);
+    return MP4_INDEX_OK;
+}
+
+// Compact sample sizes: 4, 8 or 16 bits per sample
+static int
+mp4_summary_stz2(mp4_track_summary_t *t, const uint8_t *p, size_t len)
+{
+    if (len < 12) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint8_t field_size = p[7];
+    const uint32_t num = get_u32(p + 8);
+    if (field_size != 4 && field_size != 8 && field_size != 16) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    if ((len - 12) * 8 / field_size < num) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    t->table_samples += num;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t total = 0;
+    const uint8_t *entry = p + 12;
+    for (uint32_t i = 0; i < num; i++) {
+        uint32_t size;
+        if (field_size == 16) {
+            size = get_u16(entry + 2 * i);
+        } else if (field_size == 8) {
+            size = entry[i];
+        } else {
+            size = i & 1 ? entry[i / 2] & 0x0f : entry[i / 2] >> 4;
+        }
+        min = size < min ? size : min;
+        max = size > max ? size : max;
+        total += size;
+    }
+    mp4_summary_sizes_add(t, num, min, max, total);
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_summary_tfhd(mp4_summary_t *summary, const uint8_t *p, size_t len)
+{
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint32_t flags = get_u24(p + 1);
+    size_t need = 8;
+    need += flags & MP4_TFHD_BASE_DATA_OFFSET ? 8 : 0;
+    need += flags & MP4_TFHD_SAMPLE_DESCRIPTION_INDEX ? 4 : 0;
+    need += flags & MP4_TFHD_DEFAULT_SAMPLE_DURATION ? 4 : 0;
+    need += flags & MP4_TFHD_DEFAULT_SAMPLE_SIZE ? 4 : 0;
+    need += flags & MP4_TFHD_DEFAULT_SAMPLE_FLAGS ? 4 : 0;
+    if (len < need) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const ptrdiff_t cur = mp4_summary_track_by_id(summary, get_u32(p + 4));
+    if (cur < 0) {
+        return MP4_INDEX_ERR_NOMEM;
+    }
+    const mp4_summary_track_t *track = &summary->tracks[cur];
+    const uint8_t *field = p + 8;
+    field += flags & MP4_TFHD_BASE_DATA_OFFSET ? 8 : 0;
+    field += flags & MP4_TFHD_SAMPLE_DESCRIPTION_INDEX ? 4 : 0;
+    summary->traf_sample_duration = track->trex_sample_duration;
+    if (flags & MP4_TFHD_DEFAULT_SAMPLE_DURATION) {
+        summary->traf_sample_duration = get_u32(field);
+        field += 4;
+    }
+    summary->traf_sample_size = track->trex_sample_size;
+    if (flags & MP4_TFHD_DEFAULT_SAMPLE_SIZE) {
+        summary->traf_sample_size = get_u32(field);
+        field += 4;
+    }
+    summary->traf_sample_flags = track->trex_sample_flags;
+    if (flags & MP4_TFHD_DEFAULT_SAMPLE_FLAGS) {
+        summary->traf_sample_flags = get_u32(field);
+    }
+    summary->cur = cur;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_summary_trun(mp4_summary_t *summary, const uint8_t *p, size_t len)
+{
+    if (summary->cur < 0) {
+        // no tfhd before it
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    mp4_track_summary_t *t = &summary->tracks[summary->cur].summary;
+    if (len < 8) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    const uint32_t flags = get_u24(p + 1);
+    const uint32_t num = get_u32(p + 4);
+    size_t entry_offset = 8;
+    entry_offset += flags & MP4_TRUN_DATA_OFFSET ? 4 : 0;
+    uint32_t first_sample_flags = summary->traf_sample_flags;
+    if (flags & MP4_TRUN_FIRST_SAMPLE_FLAGS) {
+        if (len < entry_offset + 4) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        first_sample_flags = get_u32(p + entry_offset);
+        entry_offset += 4;
+    }
+    size_t esize = 0;
+    esize += flags & MP4_TRUN_SAMPLE_DURATION ? 4 : 0;
+    esize += flags & MP4_TRUN_SAMPLE_SIZE ? 4 : 0;
+    esize += flags & MP4_TRUN_SAMPLE_FLAGS ? 4 : 0;
+    esize += flags & MP4_TRUN_SAMPLE_COMPOSITION_TIME_OFFSET ? 4 : 0;
+    if (esize && !mp4_table_fits(len, entry_offset, num, esize)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    if (num == 0) {
+        return MP4_INDEX_OK;
+    }
+
+    // the per-sample columns, or the defaults where a column is missing
+    const uint8_t *entry = p + entry_offset;
+    const size_t duration_at = 0;
+    const size_t size_at = duration_at + (flags & MP4_TRUN_SAMPLE_DURATION ? 4 : 0);
+    const size_t flags_at = size_at + (flags & MP4_TRUN_SAMPLE_SIZE ? 4 : 0);
+
+    uint64_t delta = (uint64_t)summary->traf_sample_duration * num;
+    if (flags & MP4_TRUN_SAMPLE_DURATION) {
+        delta = 0;
+        for (uint32_t i = 0; i < num; i++) {
+            delta += get_u32(entry + i * esize + duration_at);
+        }
+    }
+    t->sample_delta += delta;
+
+    uint32_t min = summary->traf_sample_size;
+    uint32_t max = summary->traf_sample_size;
+    uint64_t total = (uint64_t)summary->traf_sample_size * num;
+    if (flags & MP4_TRUN_SAMPLE_SIZE) {
+        min = UINT32_MAX;
+        max = 0;
+        total = 0;
+        for (uint32_t i = 0; i < num; i++) {
+            const uint32_t size = get_u32(entry + i * esize + size_at);
+            min = size < min ? size : min;
+            max = size > max ? size : max;
+            total += size;
+        }
+    }
+    mp4_summary_sizes_add(t, num, min, max, total);
+
+    uint64_t sync = !(first_sample_flags & MP4_SAMPLE_IS_NON_SYNC);
+    if (flags & MP4_TRUN_SAMPLE_FLAGS) {
+        // per-sample flags override the first sample flags
+        sync = 0;
+        for (uint32_t i = 0; i < num; i++) {
+            sync += !(get_u32(entry + i * esize + flags_at) & MP4_SAMPLE_IS_NON_SYNC);
+        }
+    } else if (!(summary->traf_sample_flags & MP4_SAMPLE_IS_NON_SYNC)) {
+        sync += num - 1;
+    }
+    t->sync_num += sync;
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_summary_leaf(mp4_summary_t *summary, const mp4_walk_box_t *box)
+{
+    const uint8_t *p = box->data;
+    const size_t len = box->len;
+    const uint8_t *type = box->type;
+
+    if (memcmp(type, "trex", 4) == 0) {
+        if (len < 24) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        const ptrdiff_t i = mp4_summary_track_by_id(summary, get_u32(p + 4));
+        if (i < 0) {
+            return MP4_INDEX_ERR_NOMEM;
+        }
+        summary->tracks[i].trex_sample_duration = get_u32(p + 12);
+        summary->tracks[i].trex_sample_size = get_u32(p + 16);
+        summary->tracks[i].trex_sample_flags = get_u32(p + 20);
+        return MP4_INDEX_OK;
+    }
+    if (memcmp(type, "tfhd", 4) == 0) {
+        return mp4_summary_tfhd(summary, p, len);
+    }
+    if (memcmp(type, "trun", 4) == 0) {
+        return mp4_summary_trun(summary, p, len);
+    }
+    if (summary->cur < 0) {
+        return MP4_INDEX_OK;
+    }
+
+    mp4_track_summary_t *t = &summary->tracks[summary->cur].summary;
+    if (memcmp(type, "tkhd", 4) == 0) {
+        const size_t at = p[0] == 1 ? 20 : 12;
+        if (len < at + 4) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        t->track_id = get_u32(p + at);
+    } else if (memcmp(type, "mdhd", 4) == 0) {
+        const size_t at = p[0] == 1 ? 20 : 12;
+        if (len < at + (p[0] == 1 ? 12 : 8)) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        t->time_scale = get_u32(p + at);
+        t->duration = p[0] == 1 ? get_u64(p + at + 4) : get_u32(p + at + 4);
+    } else if (memcmp(type, "hdlr", 4) == 0) {
+        if (len < 12) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        memcpy(t->handler, p + 8, 4);
+    } else if (memcmp(type, "stsd", 4) == 0) {
+        if (len >= 16 && get_u32(p + 4) > 0) {
+            memcpy(t->codec, p + 12, 4);
+        }
+    } else if (memcmp(type, "stts", 4) == 0) {
+        return mp4_summary_stts(t, p, len);
+    } else if (memcmp(type, "stsz", 4) == 0) {
+        return mp4_summary_stsz(t, p, len);
+    } else if (memcmp(type, "stz2", 4) == 0) {
+        return mp4_summary_stz2(t, p, len);
+    } else if (memcmp(type, "stss", 4) == 0) {
+        if (len < 8) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        t->sync_num += get_u32(p + 4);
+        t->has_stss = true;
+    }
+    return MP4_INDEX_OK;
+}
+
+static int
+mp4_summary_enter(void *arg, const mp4_walk_box_t *box, const uint8_t **children, size_t *children_len)
+{
+    mp4_summary_t *summary = arg;
+    static const char containers[][4] = {"moov", "trak", "mdia", "minf", "stbl", "mvex", "moof", "traf"};
+    for (size_t i = 0; i < sizeof(containers) / sizeof(containers[0]); i++) {
+        if (memcmp(box->type, containers[i], 4) == 0) {
+            if (memcmp(box->type, "trak", 4) == 0) {
+                mp4_summary_track_t *track = mp4_summary_track_new(summary);
+                if (!track) {
+                    return MP4_INDEX_ERR_NOMEM;
+                }
+                track->summary.offset = summary->offset + (box->p - summary->buf);
+                track->summary.size = box->size;
+                summary->cur = summary->num - 1;
+            }
+            *children = box->data;
+            *children_len = box->len;
+            return MP4_WALK_DESCEND;
+        }
+    }
+    int err = mp4_summary_leaf(summary, box);
+    return err != MP4_INDEX_OK ? err : MP4_WALK_NEXT;
+}
+
+static int
+mp4_summary_leave(void *arg, const mp4_walk_box_t *box)
+{
+    mp4_summary_t *summary = arg;
+    if (memcmp(box->type, "trak", 4) == 0 || memcmp(box->type, "traf", 4) == 0) {
+        summary->cur = -1;
+    }
+    return MP4_INDEX_OK;
+}
+
+int
+mp4_summary_add(mp4_summary_t *summary, const uint8_t *buf, size_t len, uint64_t offset)
+{
+    const mp4_walker_t walker = {
+        .max_depth = summary->max_depth,
+        .enter = mp4_summary_enter,
+        .leave = mp4_summary_leave,
+        .arg = summary,
+    };
+    summary->buf = buf;
+    summary->offset = offset;
+    summary->cur = -1;
+    return mp4_walk(&walker, buf, len);
+}
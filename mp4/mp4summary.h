@@ -0,0 +1,45 @@
+#ifndef _MP4_SUMMARY_H_2018
+#define _MP4_SUMMARY_H_2018
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-track aggregates of mp4parse --summary, added up from the sample
+// tables of moov (stts, stsz/stz2, stss) and from the trun boxes of every
+// moof, without expanding the tables into samples. Only moov and the moof
+// boxes are ever read, mdat is not needed. Error codes are the MP4_INDEX_*
+// codes of mp4index.h.
+
+typedef struct {
+    uint32_t track_id;
+    uint64_t offset;         // file offset of the trak box, 0 for a track only seen in moof
+    uint64_t size;           // trak box size
+    char handler[5];         // hdlr handler type, e.g. "vide"
+    char codec[5];           // type of the first stsd entry, e.g. "avc1"
+    uint32_t time_scale;     // mdhd
+    uint64_t duration;       // mdhd, in time_scale units
+    uint64_t sample_delta;   // sum of the stts and trun sample durations
+    uint64_t sample_num;     // stsz/stz2 and trun samples
+    uint64_t size_min;
+    uint64_t size_max;
+    uint64_t size_total;
+    uint64_t sync_num;       // stss entries and trun sync samples
+    uint64_t table_samples;  // samples of stsz/stz2 alone
+    bool has_stss;           // without stss every stsz sample is a sync sample
+} mp4_track_summary_t;
+
+typedef struct mp4_summary mp4_summary_t;
+
+// max_depth limits the box nesting like mp4_walker_t.max_depth
+mp4_summary_t *mp4_summary_create(int max_depth);
+void mp4_summary_destroy(mp4_summary_t *summary);
+
+// Add the tables of one whole top-level box, moov or moof, at file offset
+// offset; other boxes are ignored
+int mp4_summary_add(mp4_summary_t *summary, const uint8_t *buf, size_t len, uint64_t offset);
+
+size_t mp4_summary_track_num(const mp4_summary_t *summary);
+const mp4_track_summary_t *mp4_summary_track(const mp4_summary_t *summary, size_t i);
+
+#endif  //_MP4_SUMMARY_H_2018
@@ -0,0 +1,124 @@
+#include "mp4walk.h"
+#include "mp4bytes.h"
+#include "mp4index.h"
+
+#include <stdlib.h>
+
+// One open box: its own fields for leave(), and the rest of the region its
+// children are walked from
+typedef struct {
+    mp4_walk_box_t box;
+    const uint8_t *p;
+    const uint8_t *end;
+} mp4_walk_level_t;
+
+// Read and check the header of the box at p, which has end - p bytes left in
+// its parent
+static int
+mp4_walk_header(const uint8_t *p, const uint8_t *end, int depth, mp4_walk_box_t *box)
+{
+    uint64_t size = get_u32(p);
+    const uint8_t *data = p + 8;
+    if (size == 1) {
+        if (end - p < 16) {
+            return MP4_INDEX_ERR_FORMAT;
+        }
+        size = get_u64(p + 8);
+        data = p + 16;
+    } else if (size == 0) {
+        size = end - p;
+    }
+    if (size < (uint64_t)(data - p) || size > (uint64_t)(end - p)) {
+        return MP4_INDEX_ERR_FORMAT;
+    }
+    box->p = p;
+    box->type = p + 4;
+    box->size = size;
+    box->data = data;
+    box->len = size - (data - p);
+    box->depth = depth;
+    return MP4_INDEX_OK;
+}
+
+int
+mp4_walk(const mp4_walker_t *walker, const uint8_t *buf, size_t len)
+{
+    const int max_depth = walker->max_depth > 0 ? walker->max_depth : MP4_WALK_MAX_DEPTH;
+    mp4_walk_level_t local[MP4_WALK_MAX_DEPTH + 1];
+    mp4_walk_level_t *stack = local;
+    if (max_depth > MP4_WALK_MAX_DEPTH) {
+        stack = malloc((max_depth + 1) * sizeof(*stack));
+        if (!stack) {
+            return MP4_INDEX_ERR_NOMEM;
+        }
+    }
+
+    // stack[0] is the walked buffer itself, it has no box
+    int depth = 0;
+    stack[0].p = buf;
+    stack[0].end = buf + len;
+    int err = MP4_INDEX_OK;
+
+    while (err == MP4_INDEX_OK) {
+        mp4_walk_level_t *level = &stack[depth];
+        if (level->end - level->p < 8) {
+            // fewer bytes left than a box header: the parent is done
+            if (depth == 0) {
+                break;
+            }
+            if (walker->leave) {
+                err = walker->leave(walker->arg, &level->box);
+            }
+            depth--;
+            continue;
+        }
+
+        mp4_walk_box_t box;
+        err = mp4_walk_header(level->p, level->end, depth, &box);
+        if (err != MP4_INDEX_OK) {
+            break;
+        }
+        level->p += box.size;
+
+        const uint8_t *children = NULL;
+        size_t children_len = 0;
+        int next = walker->enter(walker->arg, &box, &children, &children_len);
+        if (next < 0) {
+            err = next;
+            break;
+        }
+        if (next == MP4_WALK_DESCEND) {
+            if (children < box.data || children > box.data + box.len || children_len > (size_t)(box.data + box.len - children)) {
+                err = MP4_INDEX_ERR_FORMAT;
+            } else if (depth == max_depth) {
+                err = MP4_INDEX_ERR_DEPTH;
+            }
+            if (err != MP4_INDEX_OK) {
+                if (walker->leave) {
+                    walker->leave(walker->arg, &box);
+                }
+                break;
+            }
+            depth++;
+            stack[depth].box = box;
+            stack[depth].p = children;
+            stack[depth].end = children + children_len;
+            continue;
+        }
+        if (walker->leave) {
+            err = walker->leave(walker->arg, &box);
+        }
+    }
+
+    // the boxes left open by an error are still closed
+    for (; depth > 0; depth--) {
+        if (walker->leave) {
+            walker->leave(walker->arg, &stack[depth].box);
+        }
+    }
+
+    if (stack != local) {
+        free(stack);
+    }
+    return err;
+}
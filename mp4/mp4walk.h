@@ -0,0 +1,47 @@
+#ifndef _MP4_WALK_H_2018
+#define _MP4_WALK_H_2018
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Box walker shared by mp4parse and the mp4index library. Nested boxes are
+// walked with an explicit stack instead of recursion, so a hostile file can
+// neither overflow the C stack nor loop: every box must fit in its parent,
+// a size of 0 runs to the end of the parent, and nesting deeper than
+// max_depth stops the walk with MP4_INDEX_ERR_DEPTH. Error codes are the
+// MP4_INDEX_* codes of mp4index.h.
+
+#define MP4_WALK_MAX_DEPTH 32
+
+enum {
+    MP4_WALK_NEXT = 0,     // step over the payload to the next sibling
+    MP4_WALK_DESCEND = 1,  // walk the boxes in the children region
+};
+
+typedef struct {
+    const uint8_t *p;     // box header
+    const uint8_t *type;  // the 4 type bytes
+    uint64_t size;        // header included, the end of the parent for size 0
+    const uint8_t *data;  // payload after the 8/16-byte header
+    size_t len;           // payload bytes
+    int depth;            // 0 for the boxes of the walked buffer
+} mp4_walk_box_t;
+
+// Called for every box: MP4_WALK_NEXT, MP4_WALK_DESCEND after setting
+// *children and *children_len to a region inside the payload, or an error
+// that ends the walk
+typedef int (*mp4_walk_enter_t)(void *arg, const mp4_walk_box_t *box, const uint8_t **children, size_t *children_len);
+// Called for every entered box once its children are walked, also for the
+// boxes still open when the walk stops at an error; may be NULL
+typedef int (*mp4_walk_leave_t)(void *arg, const mp4_walk_box_t *box);
+
+typedef struct {
+    int max_depth;  // 0 for MP4_WALK_MAX_DEPTH
+    mp4_walk_enter_t enter;
+    mp4_walk_leave_t leave;
+    void *arg;
+} mp4_walker_t;
+
+int mp4_walk(const mp4_walker_t *walker, const uint8_t *buf, size_t len);
+
+#endif  //_MP4_WALK_H_2018